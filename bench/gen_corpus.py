@@ -0,0 +1,283 @@
+#!/usr/bin/python3
+
+# Generates a synthetic Objective-C project to run the plugin on. It only
+# depends on its own root class, so it compiles on Linux with
+# `-fobjc-runtime=gnustep-2.0`, no Foundation needed.
+#
+#   include/BenchObject.h       root class
+#   include/BenchProtocolN.h    protocols, their selectors can't be direct
+#   include/ClassN.h            class, superclass chains `depth` long
+#   include/ClassN+CatK.h       categories
+#   include/BenchTemplates.h    C++ templates, with --cxx-functions
+#   include/module.modulemap    one module per header, for -fmodules runs
+#   src/ClassN.m                one TU per class, its categories included,
+#                               ObjC++ .mm files with --cxx-functions
+#
+# Every random choice comes from `seed`, the same arguments give the same files.
+
+import argparse
+import os
+import pathlib
+import random
+
+
+def write(path, lines):
+	with open(path, "w") as f:
+		f.write("\n".join(lines) + "\n")
+
+
+class Corpus:
+	def __init__(self, args):
+		self.args = args
+		self.rnd = random.Random(args.seed)
+		# selectors shared between classes, a `collisions` fraction of the methods uses them
+		self.shared_sels = ["shared%d:" % i for i in range(max(1, args.classes // 2))]
+		self.protocol_sels = [["protocol%dSel%d" % (p, i) for i in range(4)] for p in range(args.protocols)]
+		self.classes = []
+		for c in range(args.classes):
+			self.classes.append(self.make_class(c))
+
+	def sel(self, owner, index):
+		if self.rnd.random() < self.args.collisions:
+			return self.rnd.choice(self.shared_sels)
+		return "%s_m%d:" % (owner.lower(), index)
+
+	# a shared selector drawn twice would be a duplicate definition
+	def sels(self, owner, count):
+		return list(dict.fromkeys(self.sel(owner, i) for i in range(count)))
+
+	def make_class(self, c):
+		args = self.args
+		name = "Class%d" % c
+		# chains of `depth` classes, the first of each chain derives from the root
+		superclass = "Class%d" % (c - 1) if c % args.depth else "BenchObject"
+		conformances = []
+		if args.protocols and self.rnd.random() < 0.3:
+			conformances.append(self.rnd.randrange(args.protocols))
+		return {
+			"name": name,
+			"super": superclass,
+			"protocols": conformances,
+			"properties": ["%sProp%d" % (name.lower(), i) for i in range(args.properties)],
+			"methods": self.sels(name, args.methods),
+			"categories": [
+				{"name": "Cat%d" % k, "methods": self.sels(name + "Cat%d" % k, max(1, args.methods // 2))}
+				for k in range(args.categories)
+			],
+		}
+
+	@staticmethod
+	def declaration(sel):
+		return "- (int)%s(int)arg;" % sel if sel.endswith(":") else "- (int)%s;" % sel
+
+	@staticmethod
+	def send(receiver, sel):
+		return "[%s %s0]" % (receiver, sel) if sel.endswith(":") else "[%s %s]" % (receiver, sel)
+
+	# ObjC++ TUs subscript objects in C++ code, objectAtIndexedSubscript: is sent to `id`
+	def subscript_methods(self):
+		return ["- (id)objectAtIndexedSubscript:(long)index;"] if self.args.cxx_functions else []
+
+	def write_headers(self, include):
+		write(os.path.join(include, "BenchObject.h"), [
+			"#pragma once",
+			"typedef signed char BOOL;",
+			"__attribute__((objc_root_class))",
+			"@interface BenchObject {",
+			"    Class isa;",
+			"}",
+			"+ (instancetype)alloc;",
+			"+ (Class)class;",
+			"- (instancetype)init;",
+			"- (BOOL)isKindOfClass:(Class)cls;",
+			"- (BOOL)respondsToSelector:(SEL)sel;",
+		] + self.subscript_methods() + [
+			"@end",
+		])
+		modules = ["module BenchObject { header \"BenchObject.h\" export * }"]
+		for p, sels in enumerate(self.protocol_sels):
+			write(os.path.join(include, "BenchProtocol%d.h" % p), [
+				"#pragma once",
+				"@protocol BenchProtocol%d" % p,
+				"@optional",
+			] + ["- (void)%s;" % sel for sel in sels] + ["@end"])
+			modules.append("module BenchProtocol%d { header \"BenchProtocol%d.h\" export * }" % (p, p))
+
+		for clz in self.classes:
+			imports = ["#import \"%s.h\"" % clz["super"]]
+			imports += ["#import \"BenchProtocol%d.h\"" % p for p in clz["protocols"]]
+			adopted = " <%s>" % ", ".join("BenchProtocol%d" % p for p in clz["protocols"]) if clz["protocols"] else ""
+			lines = ["#pragma once"] + imports + ["@interface %s : %s%s" % (clz["name"], clz["super"], adopted)]
+			lines += ["@property (nonatomic) int %s;" % prop for prop in clz["properties"]]
+			lines += [self.declaration(sel) for sel in clz["methods"]]
+			lines += ["@end"]
+			write(os.path.join(include, clz["name"] + ".h"), lines)
+			modules.append("module %s { header \"%s.h\" export * }" % (clz["name"], clz["name"]))
+
+			for cat in clz["categories"]:
+				header = "%s+%s" % (clz["name"], cat["name"])
+				lines = ["#pragma once", "#import \"%s.h\"" % clz["name"], "@interface %s (%s)" % (clz["name"], cat["name"])]
+				lines += [self.declaration(sel) for sel in cat["methods"]]
+				lines += ["@end"]
+				write(os.path.join(include, header + ".h"), lines)
+				modules.append("module %s_%s { header \"%s.h\" export * }" % (clz["name"], cat["name"], header))
+		if self.args.cxx_functions:
+			write(os.path.join(include, "BenchTemplates.h"), self.templates())
+			modules.append("module BenchTemplates { requires cplusplus header \"BenchTemplates.h\" export * }")
+		write(os.path.join(include, "module.modulemap"), modules)
+
+	# header only C++ the way ObjC++ TUs pull it in, nothing ObjC in it
+	@staticmethod
+	def templates():
+		return [
+			"#pragma once",
+			"namespace bench {",
+			"template <typename T, int N> struct Array {",
+			"    T items[N];",
+			"    int size() const { return N; }",
+			"    T &operator[](int i) { return items[i]; }",
+			"    template <typename F> void each(F f) { for (int i = 0; i < N; i++) f(items[i]); }",
+			"};",
+			"template <typename T> T accumulate(Array<T, 16> &array) {",
+			"    T total = T();",
+			"    array.each([&](T item) { total += item; });",
+			"    return total;",
+			"}",
+			"template <typename T> struct Pair { T first, second; T sum() const { return first + second; } };",
+			"}",
+		]
+
+	# C++ helpers of a TU, each instantiating the templates, and one subscripting
+	# an object, whose only send is the subscript
+	def cxx_functions(self, clz):
+		lines = [
+			"#import \"BenchTemplates.h\"",
+			"",
+			"static inline int %s_subscript(id items, int arg) {" % clz["name"].lower(),
+			"    return items[arg & 15] ? 1 : 0;",
+			"}",
+			"",
+		]
+		for i in range(self.args.cxx_functions):
+			kind = ("int", "long", "double")[self.rnd.randrange(3)]
+			lines += [
+				"static inline int %s_cxx%d(int arg) {" % (clz["name"].lower(), i),
+				"    bench::Array<%s, 16> array;" % kind,
+				"    for (int i = 0; i < array.size(); i++) array[i] = arg * i + %d;" % i,
+				"    bench::Pair<%s> pair = {bench::accumulate(array), array[arg & 15]};" % kind,
+				"    return (int)pair.sum();",
+				"}",
+			]
+		return lines + [""]
+
+	def method_body(self, clz, others):
+		args = self.args
+		rnd = self.rnd
+		body = ["    int result = arg;"]
+		own = clz["methods"] + clz["properties"]
+		for _ in range(args.sends):
+			sel = rnd.choice(own)
+			body.append("    result += %s;" % (self.send("self", sel) if sel.endswith(":") else "self.%s" % sel))
+		for other in others:
+			sel = rnd.choice(other["methods"])
+			body.append("    result += %s;" % self.send("[[%s alloc] init]" % other["name"], sel))
+		# dynamic dispatch, makes the sent selectors undirectable
+		if rnd.random() < args.id_density:
+			target = rnd.choice(others + [clz])
+			body.append("    id any = [[%s alloc] init];" % target["name"])
+			body.append("    result += %s;" % self.send("any", rnd.choice(target["methods"])))
+		if rnd.random() < args.selector_density:
+			target = rnd.choice(others + [clz])
+			body.append("    if ([self respondsToSelector:@selector(%s)]) result++;" % rnd.choice(target["methods"]))
+		if args.cxx_functions:
+			body.append("    result += %s_cxx%d(arg);" % (clz["name"].lower(), rnd.randrange(args.cxx_functions)))
+			body.append("    result += %s_subscript(self, arg);" % clz["name"].lower())
+		body.append("    return result;")
+		return body
+
+	def implementation(self, name, sels, clz, others, protocol_sels=()):
+		lines = [name]
+		# only declared by the adopted protocols
+		lines += ["- (void)%s {}" % sel for sel in protocol_sels]
+		for sel in sels:
+			lines.append(self.declaration(sel)[:-1] + " {")
+			if sel.endswith(":"):
+				lines += self.method_body(clz, others)
+			else:
+				lines.append("    return 0;")
+			lines.append("}")
+		lines.append("@end")
+		return lines
+
+	def write_sources(self, src):
+		args = self.args
+		for clz in self.classes:
+			others = self.rnd.sample(self.classes, min(args.imports, len(self.classes)))
+			lines = ["#import \"%s.h\"" % clz["name"]]
+			lines += ["#import \"%s+%s.h\"" % (clz["name"], cat["name"]) for cat in clz["categories"]]
+			lines += ["#import \"%s.h\"" % other["name"] for other in others]
+			lines.append("")
+			if args.cxx_functions:
+				lines += self.cxx_functions(clz)
+			protocol_sels = [self.protocol_sels[p][0] for p in clz["protocols"]]
+			lines += self.implementation("@implementation %s" % clz["name"], clz["methods"], clz, others, protocol_sels)
+			for cat in clz["categories"]:
+				lines += self.implementation("@implementation %s (%s)" % (clz["name"], cat["name"]), cat["methods"], clz, others)
+			write(os.path.join(src, clz["name"] + (".mm" if args.cxx_functions else ".m")), lines)
+		write(os.path.join(src, "BenchObject.m"), [
+			"#import \"BenchObject.h\"",
+			"@implementation BenchObject",
+			"+ (instancetype)alloc { return 0; }",
+			"+ (Class)class { return self; }",
+			"- (instancetype)init { return self; }",
+			"- (BOOL)isKindOfClass:(Class)cls { return 0; }",
+			"- (BOOL)respondsToSelector:(SEL)sel { return 0; }",
+		] + [m[:-1] + " { return 0; }" for m in self.subscript_methods()] + [
+			"@end",
+		])
+
+
+def make_corpus(args):
+	include = os.path.join(args.output, "include")
+	src = os.path.join(args.output, "src")
+	os.makedirs(include, exist_ok=True)
+	os.makedirs(src, exist_ok=True)
+	corpus = Corpus(args)
+	corpus.write_headers(include)
+	corpus.write_sources(src)
+	return sorted(os.path.join(src, f) for f in os.listdir(src))
+
+
+CORPUS_ARGUMENTS = ["classes", "depth", "categories", "properties", "methods", "protocols", "collisions", "imports", "sends", "id_density", "selector_density", "seed"]
+
+
+# everything the generated files depend on, --cxx-functions only when used so
+# reports of plain ObjC corpora stay comparable
+def corpus_config(args):
+	config = {name: getattr(args, name) for name in CORPUS_ARGUMENTS}
+	if args.cxx_functions:
+		config["cxx_functions"] = args.cxx_functions
+	return config
+
+
+def add_corpus_arguments(parser):
+	parser.add_argument("--classes", type=int, default=200)
+	parser.add_argument("--depth", type=int, default=4, help="superclass chain length")
+	parser.add_argument("--categories", type=int, default=2, help="categories per class")
+	parser.add_argument("--properties", type=int, default=6, help="properties per class")
+	parser.add_argument("--methods", type=int, default=12, help="methods per class")
+	parser.add_argument("--protocols", type=int, default=20)
+	parser.add_argument("--collisions", type=float, default=0.1, help="fraction of methods using a selector shared between classes")
+	parser.add_argument("--imports", type=int, default=20, help="other class headers imported by each TU")
+	parser.add_argument("--sends", type=int, default=4, help="sends to self per method body")
+	parser.add_argument("--id-density", type=float, default=0.2, help="fraction of method bodies sending to an id receiver")
+	parser.add_argument("--selector-density", type=float, default=0.1, help="fraction of method bodies with a @selector")
+	parser.add_argument("--cxx-functions", type=int, default=0, help="C++ functions per TU, makes the TUs ObjC++")
+	parser.add_argument("--seed", type=int, default=1)
+
+
+if __name__ == "__main__":
+	parser = argparse.ArgumentParser(description="generate a synthetic Objective-C corpus")
+	parser.add_argument("-o", "--output", type=pathlib.Path, required=True, help="output directory")
+	add_corpus_arguments(parser)
+	make_corpus(parser.parse_args())
@@ -0,0 +1,57 @@
+#!/usr/bin/python3
+
+# Generates a synthetic directory of plugin shards, shaped like the output of
+# an app build: every TU repeats the candidates of the headers it imports.
+
+import argparse
+import json
+import os
+import pathlib
+import random
+
+
+def make_corpus(out_dir, shard_count, header_count, headers_per_tu, seed):
+	rnd = random.Random(seed)
+	os.makedirs(out_dir, exist_ok=True)
+
+	# selector pool, with collisions between classes
+	sel_pool = ["sel%d" % i for i in range(header_count * 4)]
+	sel_pool += ["set%d:" % i for i in range(header_count * 2)]
+
+	headers = []
+	for h in range(header_count):
+		# a few non-ascii identifiers exercise the \u escaping
+		clz = ("GLClass%d" if h % 97 else "GLClassé%d") % h
+		path = "/Users/dev/App/Module%d/%s.h" % (h % 37, clz)
+		meths = []
+		for line, sel in enumerate(rnd.sample(sel_pool, 8)):
+			meths.append({
+				"isPropertyAccessor": rnd.random() < 0.4,
+				"loc": "%s:%d:1" % (path, line + 10),
+				"name": "-[%s %s]" % (clz, sel),
+				"sel": sel,
+			})
+		headers.append(meths)
+
+	protocol_sels = rnd.sample(sel_pool, len(sel_pool) // 10)
+	for s in range(shard_count):
+		imported = rnd.sample(range(header_count), min(headers_per_tu, header_count))
+		meths = []
+		for h in imported:
+			meths += headers[h]
+		sels = set(protocol_sels) | set(rnd.sample(sel_pool, 5))
+		undirect = ["-[GLClass%d %s]" % (rnd.randrange(header_count), rnd.choice(sel_pool)) for _ in range(5)]
+		shard = {"sels": sorted(sels), "meths": meths, "undirect_meths": sorted(set(undirect))}
+		with open(os.path.join(out_dir, "GLClass%d%d.json" % (s, rnd.getrandbits(48))), "w") as f:
+			f.write(json.dumps(shard, indent=2, sort_keys=True))
+
+
+if __name__ == "__main__":
+	parser = argparse.ArgumentParser(description="generate synthetic plugin shards")
+	parser.add_argument("-o", "--output", dest="output", type=pathlib.Path, required=True, help="output directory")
+	parser.add_argument("--shards", type=int, default=2000)
+	parser.add_argument("--headers", type=int, default=3000)
+	parser.add_argument("--headers-per-tu", type=int, default=150)
+	parser.add_argument("--seed", type=int, default=1)
+	args = parser.parse_args()
+	make_corpus(args.output, args.shards, args.headers, args.headers_per_tu, args.seed)
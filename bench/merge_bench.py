@@ -0,0 +1,56 @@
+#!/usr/bin/python3
+
+# Times merge.py against objc-direct-merge on a synthetic shard corpus and
+# checks that both produce the same bytes.
+
+import argparse
+import filecmp
+import os
+import pathlib
+import subprocess
+import sys
+import tempfile
+import time
+
+import gen_shards
+
+ROOT = pathlib.Path(__file__).resolve().parent.parent
+
+
+def run(cmd):
+	start = time.monotonic()
+	proc = subprocess.Popen(cmd, stdout=subprocess.DEVNULL)
+	_, status, usage = os.wait4(proc.pid, 0)
+	elapsed = time.monotonic() - start
+	if status != 0:
+		sys.exit("%s failed" % cmd[0])
+	# ru_maxrss is KiB on Linux
+	return elapsed, usage.ru_maxrss / 1024
+
+
+if __name__ == "__main__":
+	parser = argparse.ArgumentParser(description="compare merge.py and objc-direct-merge")
+	parser.add_argument("--merge-tool", type=pathlib.Path, required=True, help="objc-direct-merge executable")
+	parser.add_argument("--shards", type=int, default=2000)
+	parser.add_argument("--headers", type=int, default=3000)
+	parser.add_argument("--headers-per-tu", type=int, default=150)
+	parser.add_argument("--seed", type=int, default=1)
+	parser.add_argument("-j", dest="jobs", type=int, default=0)
+	args = parser.parse_args()
+
+	with tempfile.TemporaryDirectory() as tmp:
+		shard_dir = os.path.join(tmp, "shards")
+		gen_shards.make_corpus(shard_dir, args.shards, args.headers, args.headers_per_tu, args.seed)
+		size = sum(os.path.getsize(os.path.join(shard_dir, f)) for f in os.listdir(shard_dir))
+		print("corpus: %d shards, %.1f MB" % (args.shards, size / 1e6))
+
+		py_out = os.path.join(tmp, "merge_py.json")
+		native_out = os.path.join(tmp, "native.json")
+		py_time, py_rss = run([sys.executable, str(ROOT / "merge.py"), "-i", shard_dir, "-o", py_out])
+		native_time, native_rss = run([str(args.merge_tool), "-i", shard_dir, "-o", native_out, "-j", str(args.jobs)])
+
+		print("merge.py:          %6.2f s  %7.1f MB peak RSS" % (py_time, py_rss))
+		print("objc-direct-merge: %6.2f s  %7.1f MB peak RSS" % (native_time, native_rss))
+		same = filecmp.cmp(py_out, native_out, shallow=False)
+		print("identical output:  %s" % ("yes" if same else "NO"))
+		sys.exit(0 if same else 1)
@@ -0,0 +1,238 @@
+#!/usr/bin/python3
+
+# Runs directable-finder over a generated Objective-C corpus (see gen_corpus.py)
+# and reports the cost of the plugin per TU, of the merge and of a whole build:
+#
+#   tu          each TU compiled one at a time, -fsyntax-only with and without
+#               the plugin, best of --repeat runs, and the peak RSS of clang
+#   merge       objc-direct-merge (or merge.py) over the shards of the corpus
+#   end_to_end  every TU with the plugin on -j jobs, then the merge
+#   pruning     with --check-pruning, whether the merged result is the same
+#               when C and C++ bodies without ObjC tokens are walked too, and
+#               the per TU time of that walk, with --cxx-functions the cost of
+#               the plugin on ObjC++ TUs pruning saves
+#
+# with modules off, on, or both. The report is written as json; pass the report
+# of an earlier run as --baseline to fail on regressions, e.g. after an LLVM
+# upgrade or a change to the hierarchy lookups.
+
+import argparse
+import concurrent.futures
+import json
+import os
+import pathlib
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+import gen_corpus
+from merge_bench import run
+
+ROOT = pathlib.Path(__file__).resolve().parent.parent
+
+
+def compile_flags(corpus_dir, modules, cache_dir):
+	flags = ["-fsyntax-only", "-fobjc-runtime=gnustep-2.0", "-fobjc-arc", "-I", os.path.join(corpus_dir, "include")]
+	if modules:
+		flags += ["-fmodules", "-fimplicit-module-maps", "-fmodules-cache-path=" + cache_dir]
+	return flags
+
+
+def plugin_flags(plugin, output_dir, plugin_args):
+	flags = ["-Xclang", "-load", "-Xclang", str(plugin), "-Xclang", "-plugin", "-Xclang", "directable-finder"]
+	for arg in ["-output-dir=" + output_dir] + plugin_args:
+		flags += ["-Xclang", "-plugin-arg-directable-finder", "-Xclang", arg]
+	return flags
+
+
+def summarize(times, rss):
+	times = sorted(times)
+	return {
+		"total_s": sum(times),
+		"mean_ms": statistics.mean(times) * 1e3,
+		"p50_ms": times[len(times) // 2] * 1e3,
+		"p95_ms": times[min(len(times) - 1, int(len(times) * 0.95))] * 1e3,
+		"max_ms": times[-1] * 1e3,
+		"peak_rss_mb": max(rss),
+	}
+
+
+# best of `repeat` per TU, so one noisy run doesn't count
+def time_tus(clang, files, flags, repeat):
+	times, rss = [], []
+	for path in files:
+		samples = [run([clang] + flags + [path]) for _ in range(repeat)]
+		times.append(min(s[0] for s in samples))
+		rss.append(max(s[1] for s in samples))
+	return summarize(times, rss)
+
+
+def merge(args, shard_dir, output):
+	if args.merge_tool:
+		cmd = [str(args.merge_tool), "-i", shard_dir, "-o", output]
+	else:
+		cmd = [sys.executable, str(ROOT / "merge.py"), "-i", shard_dir, "-o", output]
+	elapsed, rss = run(cmd)
+	with open(output) as f:
+		entries = len(json.load(f))
+	return {"seconds": elapsed, "peak_rss_mb": rss, "entries": entries}
+
+
+def end_to_end(args, files, flags, shard_dir, output):
+	start = time.monotonic()
+	with concurrent.futures.ThreadPoolExecutor(args.jobs or os.cpu_count()) as pool:
+		results = list(pool.map(lambda path: run([args.clang] + flags + [path]), files))
+	compiled = time.monotonic() - start
+	merged = merge(args, shard_dir, output)
+	total = compiled + merged["seconds"]
+	return {
+		"compile_s": compiled,
+		"merge_s": merged["seconds"],
+		"total_s": total,
+		"tus_per_s": len(files) / total,
+		"peak_rss_mb": max([r[1] for r in results] + [merged["peak_rss_mb"]]),
+	}
+
+
+def bench_mode(args, corpus_dir, files, modules, tmp):
+	mode_dir = os.path.join(tmp, "modules" if modules else "textual")
+	cache_dir = os.path.join(mode_dir, "module-cache")
+	shard_dir = os.path.join(mode_dir, "shards")
+	os.makedirs(shard_dir)
+	flags = compile_flags(corpus_dir, modules, cache_dir)
+	with_plugin = flags + plugin_flags(args.plugin, shard_dir, args.plugin_arg)
+
+	# fills the module cache, per TU timings don't include building modules
+	for path in files:
+		run([args.clang] + flags + [path])
+
+	result = {
+		"tu": {
+			"baseline": time_tus(args.clang, files, flags, args.repeat),
+			"plugin": time_tus(args.clang, files, with_plugin, args.repeat),
+		},
+	}
+	tu = result["tu"]
+	tu["overhead_pct"] = (tu["plugin"]["total_s"] / tu["baseline"]["total_s"] - 1) * 100
+	result["merge"] = merge(args, shard_dir, os.path.join(mode_dir, "merged.json"))
+
+	shutil.rmtree(shard_dir)
+	os.makedirs(shard_dir)
+	result["end_to_end"] = end_to_end(args, files, with_plugin, shard_dir, os.path.join(mode_dir, "merged.json"))
+	if args.check_pruning:
+		result["pruning"] = check_pruning(args, files, flags, mode_dir, tu)
+	return result
+
+
+# the same build with -no-body-pruning, the merged results have to be identical
+def check_pruning(args, files, flags, mode_dir, tu):
+	shard_dir = os.path.join(mode_dir, "unpruned-shards")
+	os.makedirs(shard_dir)
+	unpruned = flags + plugin_flags(args.plugin, shard_dir, args.plugin_arg + ["-no-body-pruning"])
+	unpruned_tu = time_tus(args.clang, files, unpruned, args.repeat)
+	shutil.rmtree(shard_dir)
+	os.makedirs(shard_dir)
+	end_to_end(args, files, unpruned, shard_dir, os.path.join(mode_dir, "unpruned.json"))
+	with open(os.path.join(mode_dir, "merged.json")) as a, open(os.path.join(mode_dir, "unpruned.json")) as b:
+		pruned, walked = json.load(a), json.load(b)
+	return {
+		"tu_unpruned": unpruned_tu,
+		"overhead_unpruned_pct": (unpruned_tu["total_s"] / tu["baseline"]["total_s"] - 1) * 100,
+		"entries": len(pruned),
+		"entries_unpruned": len(walked),
+		"only_pruned": sorted(set(pruned) - set(walked)),
+		"only_unpruned": sorted(set(walked) - set(pruned)),
+		"same_result": pruned == walked,
+	}
+
+
+# (path in the report, what the number is), larger is worse for all of them
+TRACKED = [
+	(("tu", "plugin", "total_s"), "plugin TU time"),
+	(("tu", "plugin", "peak_rss_mb"), "plugin TU peak RSS"),
+	(("merge", "seconds"), "merge time"),
+	(("merge", "peak_rss_mb"), "merge peak RSS"),
+	(("end_to_end", "total_s"), "end to end time"),
+]
+
+
+def compare(report, baseline, threshold):
+	if report["corpus"] != baseline["corpus"]:
+		print("warning: the baseline was measured on a different corpus")
+	regressions = []
+	for mode, result in report["modes"].items():
+		if mode not in baseline["modes"]:
+			continue
+		for path, label in TRACKED:
+			now, before = result, baseline["modes"][mode]
+			for key in path:
+				now, before = now[key], before[key]
+			change = (now / before - 1) * 100 if before else 0
+			if change > threshold:
+				regressions.append("%s, modules %s: %.3f -> %.3f (+%.1f%%)" % (label, mode, before, now, change))
+	return regressions
+
+
+def print_report(report):
+	for mode, result in report["modes"].items():
+		tu = result["tu"]
+		print("modules %s:" % mode)
+		print("  TU without plugin: %8.2f ms mean  %8.2f ms p95  %7.1f MB peak RSS" % (tu["baseline"]["mean_ms"], tu["baseline"]["p95_ms"], tu["baseline"]["peak_rss_mb"]))
+		print("  TU with plugin:    %8.2f ms mean  %8.2f ms p95  %7.1f MB peak RSS  (%+.1f%%)" % (tu["plugin"]["mean_ms"], tu["plugin"]["p95_ms"], tu["plugin"]["peak_rss_mb"], tu["overhead_pct"]))
+		print("  merge:             %8.2f s  %7.1f MB peak RSS  %d entries" % (result["merge"]["seconds"], result["merge"]["peak_rss_mb"], result["merge"]["entries"]))
+		e2e = result["end_to_end"]
+		print("  end to end:        %8.2f s  %7.1f TUs/s  %7.1f MB peak RSS" % (e2e["total_s"], e2e["tus_per_s"], e2e["peak_rss_mb"]))
+		if "pruning" in result:
+			pruning = result["pruning"]
+			print("  TU without pruning:%8.2f ms mean  %8.2f ms p95  %7.1f MB peak RSS  (%+.1f%%)" % (pruning["tu_unpruned"]["mean_ms"], pruning["tu_unpruned"]["p95_ms"], pruning["tu_unpruned"]["peak_rss_mb"], pruning["overhead_unpruned_pct"]))
+			print("  body pruning:      %s, %d entries, %d without pruning" % ("same result" if pruning["same_result"] else "DIFFERENT RESULT", pruning["entries"], pruning["entries_unpruned"]))
+			for name in pruning["only_pruned"]:
+				print("    only with pruning: " + name)
+			for name in pruning["only_unpruned"]:
+				print("    only without pruning: " + name)
+
+
+if __name__ == "__main__":
+	parser = argparse.ArgumentParser(description="benchmark directable-finder on a synthetic Objective-C corpus")
+	parser.add_argument("--clang", required=True, help="clang executable the plugin was built for")
+	parser.add_argument("--plugin", type=pathlib.Path, required=True, help="ObjCDirectFinder plugin library")
+	parser.add_argument("--merge-tool", type=pathlib.Path, help="objc-direct-merge executable, merge.py when not given")
+	parser.add_argument("--plugin-arg", action="append", default=[], help="extra plugin argument, e.g. -local-decls-only")
+	parser.add_argument("--modules", choices=["off", "on", "both"], default="both")
+	parser.add_argument("--repeat", type=int, default=3, help="runs per TU, the fastest counts")
+	parser.add_argument("-j", dest="jobs", type=int, default=0, help="parallel jobs of the end to end run, 0 uses all cores")
+	parser.add_argument("--report", type=pathlib.Path, help="write the json report here")
+	parser.add_argument("--baseline", type=pathlib.Path, help="report of an earlier run to compare against")
+	parser.add_argument("--threshold", type=float, default=10, help="percent slower or bigger than the baseline that fails")
+	parser.add_argument("--keep-corpus", type=pathlib.Path, help="generate the corpus here and keep it")
+	parser.add_argument("--check-pruning", action="store_true", help="also build with -no-body-pruning and fail when the merged result differs")
+	gen_corpus.add_corpus_arguments(parser)
+	args = parser.parse_args()
+
+	with tempfile.TemporaryDirectory() as tmp:
+		args.output = str(args.keep_corpus or os.path.join(tmp, "corpus"))
+		files = gen_corpus.make_corpus(args)
+		version = subprocess.run([args.clang, "--version"], stdout=subprocess.PIPE, universal_newlines=True, check=True).stdout.splitlines()[0]
+
+		report = {"clang": version, "corpus": gen_corpus.corpus_config(args), "plugin_args": args.plugin_arg, "modes": {}}
+		for mode in (["off", "on"] if args.modules == "both" else [args.modules]):
+			report["modes"][mode] = bench_mode(args, args.output, files, mode == "on", tmp)
+
+	print(version)
+	print("corpus: %d TUs" % len(files))
+	print_report(report)
+	if args.report:
+		with open(args.report, "w") as f:
+			json.dump(report, f, indent=2, sort_keys=True)
+
+	failed = any(not result["pruning"]["same_result"] for result in report["modes"].values() if "pruning" in result)
+	if args.baseline:
+		with open(args.baseline) as f:
+			regressions = compare(report, json.load(f), args.threshold)
+		for regression in regressions:
+			print("REGRESSION: " + regression)
+		failed = failed or bool(regressions)
+	sys.exit(1 if failed else 0)
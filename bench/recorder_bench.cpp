@@ -0,0 +1,388 @@
+//
+//  recorder_bench.cpp
+//  DirectableFinder
+//
+//  Allocation count and peak memory of the DirectableRecorder storage, the
+//  original string keyed maps of heap allocated entries against the current
+//  arena of handle keyed entries, on the same seeded stream of candidate
+//  inserts and undirectable selectors and names of one big TU. Both recorders
+//  are modelled outside clang: identifiers, selectors and locations are
+//  handles into tables built before measuring, like the AST's, and rendered
+//  to strings the way the recorders do. Each recorder runs in a child process
+//  so their peak RSS don't mix.
+//
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/raw_ostream.h"
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <list>
+#include <map>
+#include <new>
+#include <random>
+#include <set>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace llvm;
+
+static cl::opt<unsigned> Classes("classes", cl::desc("Classes whose methods are candidates"), cl::init(4000));
+static cl::opt<unsigned> Methods("methods", cl::desc("Methods per class"), cl::init(24));
+static cl::opt<unsigned> Visits("visits", cl::desc("Times each method is inserted, interfaces are visited by every implementation"), cl::init(3));
+static cl::opt<double> Collisions("collisions", cl::desc("Fraction of selectors shared between classes"), cl::init(0.3));
+static cl::opt<double> UndirectableSels("undirectable-sels", cl::desc("Fraction of selectors marked undirectable"), cl::init(0.1));
+static cl::opt<double> UndirectableNames("undirectable-names", cl::desc("Fraction of methods marked undirectable by name"), cl::init(0.05));
+static cl::opt<unsigned> Seed("seed", cl::init(1));
+
+// every operator new is counted, the live size is kept in front of the block
+static size_t allocations = 0;
+static size_t liveBytes = 0;
+static size_t peakBytes = 0;
+
+void *operator new(size_t size) {
+    auto block = static_cast<size_t *>(malloc(size + sizeof(max_align_t)));
+    if (!block) report_bad_alloc_error("recorder_bench: out of memory");
+    *block = size;
+    allocations++;
+    liveBytes += size;
+    if (liveBytes > peakBytes) peakBytes = liveBytes;
+    return reinterpret_cast<char *>(block) + sizeof(max_align_t);
+}
+
+void operator delete(void *p) noexcept {
+    if (!p) return;
+    auto block = reinterpret_cast<size_t *>(static_cast<char *>(p) - sizeof(max_align_t));
+    liveBytes -= *block;
+    free(block);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    operator delete(p);
+}
+
+// The AST side, built before measuring: identifiers and selectors are uniqued
+// by clang, locations are 32 bit encodings the source manager prints.
+struct Method {
+    unsigned cls;
+    unsigned sel;
+    unsigned loc;
+    bool isPropertyAccessor;
+};
+
+struct Workload {
+    deque<string> classNames;
+    deque<string> selNames;
+    vector<string> files;
+    // insert(method) or an undirectable selector or name, in visit order
+    enum Kind { Insert, UndirectSel, UndirectName };
+    vector<pair<Kind, Method>> events;
+
+    string printLoc(unsigned loc) const {
+        return files[loc >> 16] + ":" + to_string((loc & 0xffff) + 10) + ":1";
+    }
+};
+
+static Workload makeWorkload() {
+    Workload work;
+    mt19937 rnd(Seed);
+    unsigned selCount = Classes * Methods;
+    for (unsigned i = 0; i < Classes; i++) {
+        work.classNames.push_back("GLClass" + to_string(i));
+        work.files.push_back("/Users/dev/App/Module" + to_string(i % 37) + "/GLClass" + to_string(i) + ".h");
+    }
+    for (unsigned i = 0; i < selCount; i++) {
+        work.selNames.push_back(i % 3 ? "configureWithItem" + to_string(i) + ":animated:" : "item" + to_string(i));
+    }
+
+    uniform_real_distribution<double> unit(0, 1);
+    uniform_int_distribution<unsigned> anySel(0, selCount - 1);
+    vector<Method> methods;
+    for (unsigned c = 0; c < Classes; c++) {
+        for (unsigned m = 0; m < Methods; m++) {
+            unsigned sel = unit(rnd) < Collisions ? anySel(rnd) % (selCount / 8 + 1) : c * Methods + m;
+            methods.push_back({c, sel, (c << 16) | m, unit(rnd) < 0.4});
+        }
+    }
+    for (unsigned v = 0; v < Visits; v++) {
+        for (auto &method : methods) {
+            work.events.push_back({Workload::Insert, method});
+            if (v == 0 && unit(rnd) < UndirectableNames) work.events.push_back({Workload::UndirectName, method});
+        }
+    }
+    for (unsigned i = 0, count = selCount * UndirectableSels; i < count; i++) {
+        Method method = {0, anySel(rnd), 0, false};
+        work.events.push_back({Workload::UndirectSel, method});
+    }
+    std::shuffle(work.events.begin() + methods.size(), work.events.end(), rnd);
+    return work;
+}
+
+// what survives a TU, as the shard gets it
+struct Survivor {
+    string name;
+    string sel;
+    string loc;
+    bool isPropertyAccessor;
+};
+
+// map<string, list<DirectableEntry *> *> of the original plugin: every insert
+// renders its name, selector and location, duplicates are found by a list scan
+namespace original {
+struct DirectableEntry {
+    string fullName;
+    string selectorName;
+    string firstDeclLocation;
+    bool isPropertyAccessor;
+};
+
+static string readableName(const Workload &work, const Method &method) {
+    return string("-") + string("[") + work.classNames[method.cls] + string(" ") + work.selNames[method.sel] + string("]");
+}
+
+static size_t run(const Workload &work, vector<Survivor> &survivors) {
+    map<string, list<DirectableEntry *> *> storage;
+    map<string, unsigned> undirectableSels;
+    set<string> undirectableNames;
+
+    auto eraseSel = [&](const string &selName) {
+        auto listTarget = storage.find(selName);
+        if (listTarget == storage.end()) return;
+        for (auto entry : *listTarget->second) {
+            delete entry;
+        }
+        delete listTarget->second;
+        storage.erase(listTarget);
+    };
+    auto eraseName = [&](const string &name) {
+        size_t pos = name.find(" ") + 1;
+        auto selName = name.substr(pos, name.length() - pos - 1);
+        auto listTarget = storage.find(selName);
+        if (listTarget == storage.end()) return;
+        auto mList = listTarget->second;
+        for (auto j = mList->begin(); j != mList->end(); j++) {
+            if ((*j)->fullName == name) {
+                delete *j;
+                mList->erase(j);
+                break;
+            }
+        }
+    };
+
+    for (auto &event : work.events) {
+        auto &method = event.second;
+        if (event.first == Workload::UndirectSel) {
+            string selName = work.selNames[method.sel];
+            eraseSel(selName);
+            undirectableSels.insert({selName, method.sel});
+            continue;
+        }
+        if (event.first == Workload::UndirectName) {
+            auto name = readableName(work, method);
+            undirectableNames.insert(name);
+            eraseName(name);
+            continue;
+        }
+
+        auto entry = new DirectableEntry{readableName(work, method), work.selNames[method.sel], work.printLoc(method.loc), method.isPropertyAccessor};
+        if (undirectableSels.count(entry->selectorName) || undirectableNames.count(entry->fullName)) {
+            delete entry;
+            continue;
+        }
+        auto &mList = storage[entry->selectorName];
+        if (!mList) mList = new list<DirectableEntry *>();
+        bool exist = false;
+        for (auto meth : *mList) {
+            if (meth->fullName == entry->fullName) {
+                exist = true;
+                break;
+            }
+        }
+        if (exist) {
+            delete entry;
+        } else {
+            mList->push_back(entry);
+        }
+    }
+
+    for (auto &i : storage) {
+        for (auto entry : *i.second) {
+            survivors.push_back({entry->fullName, entry->selectorName, entry->firstDeclLocation, entry->isPropertyAccessor});
+        }
+    }
+    // the plugin leaked these, freed here so both runs end clean
+    for (auto &i : storage) {
+        for (auto entry : *i.second) {
+            delete entry;
+        }
+        delete i.second;
+    }
+    return survivors.size();
+}
+}
+
+// The current recorder: entries in a BumpPtrAllocator keyed by identifier and
+// selector handles, names and locations are only rendered for survivors.
+namespace current {
+struct NameKey {
+    const string *cls;
+    const string *sel;
+};
+}
+
+namespace llvm {
+template <> struct DenseMapInfo<current::NameKey> {
+    static current::NameKey getEmptyKey() { return {DenseMapInfo<const string *>::getEmptyKey(), nullptr}; }
+    static current::NameKey getTombstoneKey() { return {DenseMapInfo<const string *>::getTombstoneKey(), nullptr}; }
+    static unsigned getHashValue(const current::NameKey &key) { return hash_combine(key.cls, key.sel); }
+    static bool isEqual(const current::NameKey &a, const current::NameKey &b) { return a.cls == b.cls && a.sel == b.sel; }
+};
+}
+
+namespace current {
+struct DirectableEntry {
+    NameKey name;
+    unsigned firstDeclLocation;
+    bool isPropertyAccessor;
+};
+
+static size_t run(const Workload &work, vector<Survivor> &survivors) {
+    BumpPtrAllocator arena;
+    DenseMap<const string *, SmallVector<DirectableEntry *, 1>> storage;
+    DenseMap<NameKey, DirectableEntry *> entryByName;
+    DenseSet<const string *> undirectableSels;
+    DenseSet<NameKey> undirectableNames;
+
+    auto eraseSel = [&](const string *sel) {
+        auto listTarget = storage.find(sel);
+        if (listTarget == storage.end()) return;
+        for (auto entry : listTarget->second) {
+            entryByName.erase(entry->name);
+        }
+        storage.erase(listTarget);
+    };
+    auto eraseName = [&](NameKey name) {
+        auto entryTarget = entryByName.find(name);
+        if (entryTarget == entryByName.end()) return;
+        auto entry = entryTarget->second;
+        entryByName.erase(entryTarget);
+        auto &mList = storage[entry->name.sel];
+        mList.erase(find(mList.begin(), mList.end(), entry));
+    };
+
+    for (auto &event : work.events) {
+        auto &method = event.second;
+        NameKey name = {&work.classNames[method.cls], &work.selNames[method.sel]};
+        if (event.first == Workload::UndirectSel) {
+            eraseSel(name.sel);
+            undirectableSels.insert(name.sel);
+            continue;
+        }
+        if (event.first == Workload::UndirectName) {
+            undirectableNames.insert(name);
+            eraseName(name);
+            continue;
+        }
+        if (undirectableSels.count(name.sel) || undirectableNames.count(name) || entryByName.count(name)) continue;
+        auto entry = new (arena.Allocate<DirectableEntry>()) DirectableEntry{name, method.loc, method.isPropertyAccessor};
+        storage[name.sel].push_back(entry);
+        entryByName[name] = entry;
+    }
+
+    for (auto &i : storage) {
+        for (auto entry : i.second) {
+            survivors.push_back({"-[" + *entry->name.cls + " " + *entry->name.sel + "]", *i.first, work.printLoc(entry->firstDeclLocation), entry->isPropertyAccessor});
+        }
+    }
+    return survivors.size();
+}
+}
+
+struct Result {
+    uint64_t allocations;
+    uint64_t peakBytes;
+    uint64_t peakRSSKiB;
+    uint64_t survivors;
+    double seconds;
+};
+
+// allocations and bytes only count the recorder and its survivors, the
+// workload is built before
+template <typename Run>
+static Result measure(const Workload &work, Run run) {
+    size_t allocationsBefore = allocations;
+    size_t bytesBefore = liveBytes;
+    peakBytes = liveBytes;
+    auto start = chrono::steady_clock::now();
+    Result result;
+    {
+        vector<Survivor> survivors;
+        result.survivors = run(work, survivors);
+    }
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    result.allocations = allocations - allocationsBefore;
+    result.peakBytes = peakBytes - bytesBefore;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    result.peakRSSKiB = usage.ru_maxrss;
+    return result;
+}
+
+// the result is written back over a pipe
+template <typename Run>
+static bool measureInChild(const Workload &work, Run run, Result &result) {
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    pid_t pid = fork();
+    if (pid < 0) return false;
+    if (pid == 0) {
+        close(fds[0]);
+        Result measured = measure(work, run);
+        bool ok = write(fds[1], &measured, sizeof(measured)) == sizeof(measured);
+        _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    bool ok = read(fds[0], &result, sizeof(result)) == sizeof(result);
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, const char **argv) {
+    InitLLVM X(argc, argv);
+    cl::ParseCommandLineOptions(argc, argv, "compare the original and the current DirectableRecorder storage\n");
+
+    auto work = makeWorkload();
+    size_t inserts = count_if(work.events.begin(), work.events.end(), [](const pair<Workload::Kind, Method> &event) { return event.first == Workload::Insert; });
+    outs() << "workload: " << inserts << " inserts, " << (work.events.size() - inserts) << " undirectable selectors and names\n";
+
+    Result original, current;
+    if (!measureInChild(work, original::run, original) || !measureInChild(work, current::run, current)) {
+        errs() << "recorder_bench: a measuring child failed\n";
+        return 1;
+    }
+    if (original.survivors != current.survivors) {
+        errs() << "recorder_bench: the recorders disagree, " << original.survivors << " and " << current.survivors << " survivors\n";
+        return 1;
+    }
+
+    auto print = [](StringRef name, const Result &result) {
+        outs() << format("%-10s %12llu allocations %10.1f MB peak heap %10.1f MB peak RSS %8.3f s\n", name.str().c_str(),
+                         (unsigned long long)result.allocations, result.peakBytes / 1e6, result.peakRSSKiB / 1024.0, result.seconds);
+    };
+    print("original", original);
+    print("current", current);
+    outs() << "survivors: " << current.survivors << "\n";
+    return 0;
+}
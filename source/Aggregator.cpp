@@ -0,0 +1,257 @@
+//
+//  Aggregator.cpp
+//  DirectableFinder
+//
+
+#include "Aggregator.h"
+
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/Errno.h"
+#include "llvm/Support/LEB128.h"
+#include "llvm/Support/raw_ostream.h"
+
+#ifdef LLVM_ON_UNIX
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace llvm;
+
+static Error aggregatorError(const Twine &message) {
+    return make_error<StringError>(message, inconvertibleErrorCode());
+}
+
+#ifdef LLVM_ON_UNIX
+
+static Error socketError(const Twine &what) {
+    int error = errno;
+    return make_error<StringError>(what + ": " + sys::StrError(error), error_code(error, generic_category()));
+}
+
+static Expected<sockaddr_un> socketAddress(StringRef socketPath) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        return aggregatorError("socket path too long: " + socketPath);
+    }
+    memcpy(address.sun_path, socketPath.data(), socketPath.size());
+    return address;
+}
+
+static int openSocket() {
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+#ifdef SO_NOSIGPIPE
+    // a daemon that went away must not kill the compiler
+    int on = 1;
+    if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    return fd;
+}
+
+AggregatorConnection::~AggregatorConnection() {
+    if (fd >= 0) ::close(fd);
+}
+
+Expected<AggregatorConnection> AggregatorConnection::connect(StringRef socketPath) {
+    auto address = socketAddress(socketPath);
+    if (!address) return address.takeError();
+    int fd = openSocket();
+    if (fd < 0) return socketError("socket");
+    AggregatorConnection connection(fd);
+    int result = sys::RetryAfterSignal(-1, ::connect, fd, (sockaddr *)&*address, sizeof(*address));
+    if (result < 0) return socketError("can't connect to " + socketPath);
+    return connection;
+}
+
+static Error writeAll(int fd, StringRef bytes) {
+    while (!bytes.empty()) {
+#ifdef MSG_NOSIGNAL
+        ssize_t written = ::send(fd, bytes.data(), bytes.size(), MSG_NOSIGNAL);
+#else
+        ssize_t written = ::send(fd, bytes.data(), bytes.size(), 0);
+#endif
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return socketError("aggregator write");
+        }
+        bytes = bytes.drop_front(written);
+    }
+    return Error::success();
+}
+
+// false if the stream ended before the first byte
+static Expected<bool> readAll(int fd, char *buffer, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t count = ::read(fd, buffer + done, size - done);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            return socketError("aggregator read");
+        }
+        if (count == 0) {
+            if (done == 0) return false;
+            return aggregatorError("aggregator connection closed in the middle of a frame");
+        }
+        done += count;
+    }
+    return true;
+}
+
+Error AggregatorConnection::writeFrame(char kind, StringRef body) {
+    char header[5];
+    support::endian::write32le(header, body.size() + 1);
+    header[4] = kind;
+    if (auto err = writeAll(fd, StringRef(header, sizeof(header)))) return err;
+    return writeAll(fd, body);
+}
+
+Expected<bool> AggregatorConnection::readFrame(string &frame) {
+    char header[4];
+    auto started = readAll(fd, header, sizeof(header));
+    if (!started || !*started) return started;
+    uint32_t size = support::endian::read32le(header);
+    if (size == 0) return aggregatorError("empty aggregator frame");
+    frame.resize(size);
+    auto complete = readAll(fd, &frame[0], size);
+    if (!complete) return complete.takeError();
+    if (!*complete) return aggregatorError("aggregator connection closed in the middle of a frame");
+    return true;
+}
+
+AggregatorListener::~AggregatorListener() {
+    if (fd < 0) return;
+    ::close(fd);
+    ::unlink(path.c_str());
+}
+
+Expected<AggregatorListener> AggregatorListener::listen(StringRef socketPath) {
+    auto address = socketAddress(socketPath);
+    if (!address) return address.takeError();
+
+    // a socket file left by a daemon that died, nobody accepts on it anymore
+    auto existing = AggregatorConnection::connect(socketPath);
+    if (existing) return aggregatorError("an aggregator is already listening on " + socketPath);
+    consumeError(existing.takeError());
+    ::unlink(address->sun_path);
+
+    int fd = openSocket();
+    if (fd < 0) return socketError("socket");
+    if (::bind(fd, (sockaddr *)&*address, sizeof(*address)) < 0 || ::listen(fd, SOMAXCONN) < 0) {
+        auto err = socketError("can't listen on " + socketPath);
+        ::close(fd);
+        return {move(err)};
+    }
+    return AggregatorListener(fd, socketPath.str());
+}
+
+Expected<unique_ptr<AggregatorConnection>> AggregatorListener::accept(int timeoutMs) {
+    pollfd waiting = {fd, POLLIN, 0};
+    int ready = ::poll(&waiting, 1, timeoutMs);
+    if (ready < 0 && errno != EINTR) return socketError("poll");
+    if (ready <= 0) return nullptr;
+    int client = sys::RetryAfterSignal(-1, ::accept, fd, nullptr, nullptr);
+    if (client < 0) return socketError("accept");
+    return make_unique<AggregatorConnection>(client);
+}
+
+#else
+
+AggregatorConnection::~AggregatorConnection() {}
+
+Expected<AggregatorConnection> AggregatorConnection::connect(StringRef socketPath) {
+    return aggregatorError("the aggregator needs Unix domain sockets");
+}
+
+Error AggregatorConnection::writeFrame(char kind, StringRef body) {
+    return aggregatorError("the aggregator needs Unix domain sockets");
+}
+
+Expected<bool> AggregatorConnection::readFrame(string &frame) {
+    return aggregatorError("the aggregator needs Unix domain sockets");
+}
+
+AggregatorListener::~AggregatorListener() {}
+
+Expected<AggregatorListener> AggregatorListener::listen(StringRef socketPath) {
+    return aggregatorError("the aggregator needs Unix domain sockets");
+}
+
+Expected<unique_ptr<AggregatorConnection>> AggregatorListener::accept(int timeoutMs) {
+    return aggregatorError("the aggregator needs Unix domain sockets");
+}
+
+#endif
+
+Error sendShardToAggregator(StringRef socketPath, const DirectableShard &shard) {
+    auto connection = AggregatorConnection::connect(socketPath);
+    if (!connection) return connection.takeError();
+
+    // undirectables first, the daemon drops candidates they rule out on arrival
+    DirectableShard batch;
+    size_t records = 0;
+    auto flush = [&]() -> Error {
+        if (records == 0) return Error::success();
+        auto err = connection->writeFrame(AggregatorBatch, shardToBinary(batch, /*compress=*/false));
+        batch = DirectableShard();
+        records = 0;
+        return err;
+    };
+    auto added = [&]() -> Error {
+        if (++records < AggregatorBatchRecords) return Error::success();
+        return flush();
+    };
+    for (auto &sel : shard.sels) {
+        batch.sels.push_back(sel);
+        if (auto err = added()) return err;
+    }
+    for (auto &name : shard.undirectMeths) {
+        batch.undirectMeths.push_back(name);
+        if (auto err = added()) return err;
+    }
+    for (auto &meth : shard.meths) {
+        batch.meths.push_back(meth);
+        if (auto err = added()) return err;
+    }
+    if (auto err = flush()) return err;
+    if (auto err = connection->writeFrame(AggregatorEnd, "")) return err;
+
+    string reply;
+    auto received = connection->readFrame(reply);
+    if (!received) return received.takeError();
+    if (!*received || reply[0] != AggregatorAck) return aggregatorError("aggregator didn't acknowledge the shard");
+    return Error::success();
+}
+
+static void writeString(raw_ostream &out, StringRef str) {
+    encodeULEB128(str.size(), out);
+    out << str;
+}
+
+Expected<uint64_t> finishAggregation(StringRef socketPath, StringRef outputPath, StringRef fallbackDir) {
+    auto connection = AggregatorConnection::connect(socketPath);
+    if (!connection) return connection.takeError();
+
+    string body;
+    raw_string_ostream out(body);
+    writeString(out, outputPath);
+    writeString(out, fallbackDir);
+    if (auto err = connection->writeFrame(AggregatorFinish, out.str())) return {move(err)};
+
+    string reply;
+    auto received = connection->readFrame(reply);
+    if (!received) return received.takeError();
+    if (!*received || reply[0] != AggregatorResult) return aggregatorError("aggregator didn't answer");
+    StringRef result(reply.data() + 1, reply.size() - 1);
+    unsigned size = 0;
+    const char *error = nullptr;
+    uint64_t count = decodeULEB128(result.bytes_begin(), &size, result.bytes_end(), &error);
+    if (error) return aggregatorError("malformed aggregator result");
+    result = result.drop_front(size);
+    if (!result.empty()) return aggregatorError(result);
+    return count;
+}
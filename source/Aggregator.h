@@ -0,0 +1,79 @@
+//
+//  Aggregator.h
+//  DirectableFinder
+//
+
+#ifndef AGGREGATOR_H
+#define AGGREGATOR_H
+
+#include "DirectableShard.h"
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include <memory>
+#include <string>
+
+// Wire protocol between plugin instances and objc-direct-aggregator, over a
+// Unix domain socket. Every message is a frame, `u32 little endian size,
+// payload`, whose first payload byte is its kind:
+//   AggregatorBatch   client -> daemon  a binary shard holding part of a TU's records
+//   AggregatorEnd     client -> daemon  the TU is complete
+//   AggregatorAck     daemon -> client  every batch of the TU is applied
+//   AggregatorFinish  client -> daemon  uleb128 sized output path and fallback directory
+//   AggregatorResult  daemon -> client  uleb128 entry count, or an error message when 0
+//                                       with a non-empty rest
+// Undirectable selectors and names of a TU are sent before its candidates.
+enum AggregatorMessage : char {
+    AggregatorBatch = 'B',
+    AggregatorEnd = 'E',
+    AggregatorAck = 'A',
+    AggregatorFinish = 'F',
+    AggregatorResult = 'R',
+};
+
+// records per batch, keeps frames small while the daemon applies earlier ones
+const size_t AggregatorBatchRecords = 4096;
+
+// One connected socket. Only available on Unix, elsewhere connecting fails
+// and the plugin writes shard files.
+class AggregatorConnection {
+    int fd = -1;
+public:
+    explicit AggregatorConnection(int socket) : fd(socket) {}
+    AggregatorConnection(AggregatorConnection &&other) : fd(other.fd) { other.fd = -1; }
+    AggregatorConnection(const AggregatorConnection &) = delete;
+    ~AggregatorConnection();
+
+    static llvm::Expected<AggregatorConnection> connect(llvm::StringRef socketPath);
+
+    llvm::Error writeFrame(char kind, llvm::StringRef body);
+    // false at a clean end of stream
+    llvm::Expected<bool> readFrame(std::string &frame);
+};
+
+// Listening socket of the daemon, replaces a stale socket file nobody listens on.
+class AggregatorListener {
+    int fd = -1;
+    std::string path;
+public:
+    AggregatorListener(const AggregatorListener &) = delete;
+    AggregatorListener(AggregatorListener &&other) : fd(other.fd), path(std::move(other.path)) { other.fd = -1; }
+    ~AggregatorListener();
+
+    static llvm::Expected<AggregatorListener> listen(llvm::StringRef socketPath);
+
+    // waits up to `timeoutMs` for a client, null on timeout
+    llvm::Expected<std::unique_ptr<AggregatorConnection>> accept(int timeoutMs);
+
+private:
+    AggregatorListener(int socket, std::string p) : fd(socket), path(std::move(p)) {}
+};
+
+// streams `shard` in batches and waits until the daemon applied all of them
+llvm::Error sendShardToAggregator(llvm::StringRef socketPath, const DirectableShard &shard);
+
+// asks the daemon to write the merged result, shards in `fallbackDir` (written
+// by plugins that couldn't reach it) are merged too; returns the entry count
+llvm::Expected<uint64_t> finishAggregation(llvm::StringRef socketPath, llvm::StringRef outputPath, llvm::StringRef fallbackDir);
+
+#endif
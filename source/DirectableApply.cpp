@@ -0,0 +1,265 @@
+//
+//  DirectableApply.cpp
+//  DirectableFinder
+//
+
+#include "DirectableApply.h"
+#include "DirectableMerge.h"
+#include "ShardStore.h"
+
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Lex/Lexer.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+
+using namespace clang;
+using namespace std;
+
+llvm::Expected<DirectableTargets> DirectableTargets::load(llvm::StringRef content) {
+    auto meths = readMergedResult(content);
+    if (!meths) return meths.takeError();
+
+    DirectableTargets targets;
+    for (auto &meth : *meths) {
+        // "<file>:<line>:<column>", locations in macros are followed by " <Spelling=...>"
+        llvm::StringRef loc = llvm::StringRef(meth.loc).split(" <Spelling=").first;
+        llvm::StringRef rest, line, column;
+        tie(rest, column) = loc.rsplit(':');
+        llvm::StringRef file;
+        tie(file, line) = rest.rsplit(':');
+        unsigned lineNumber, columnNumber;
+        if (file.empty() || line.getAsInteger(10, lineNumber) || column.getAsInteger(10, columnNumber)) {
+            return llvm::make_error<llvm::StringError>("malformed loc " + meth.loc, llvm::inconvertibleErrorCode());
+        }
+        // TUs spell the paths of the same header differently
+        llvm::SmallString<256> realPath;
+        if (!llvm::sys::fs::real_path(file, realPath)) file = realPath;
+        targets.files[file][{lineNumber, columnNumber}] = meth.isPropertyAccessor;
+        targets.count++;
+    }
+    return targets;
+}
+
+const DirectableTargets::Locations *DirectableTargets::inFile(llvm::StringRef file) const {
+    auto found = files.find(file);
+    return found == files.end() ? nullptr : &found->second;
+}
+
+void DirectableEdits::add(tooling::Replacement edit) {
+    lock_guard<mutex> guard(lock);
+    auto path = edit.getFilePath().str();
+    edits[path].insert(move(edit));
+}
+
+void DirectableEdits::skip(string loc) {
+    lock_guard<mutex> guard(lock);
+    skipped.insert(move(loc));
+}
+
+// zero context unified diff, annotations never add or remove lines
+static void writeDiff(llvm::StringRef path, llvm::StringRef before, llvm::StringRef after, string &diff) {
+    llvm::raw_string_ostream out(diff);
+    llvm::SmallVector<llvm::StringRef, 0> oldLines, newLines;
+    before.split(oldLines, '\n');
+    after.split(newLines, '\n');
+    out << "--- " << path << "\n+++ " << path << "\n";
+    size_t lines = min(oldLines.size(), newLines.size());
+    for (size_t i = 0; i < lines; i++) {
+        if (oldLines[i] == newLines[i]) continue;
+        size_t end = i;
+        while (end < lines && oldLines[end] != newLines[end]) end++;
+        out << "@@ -" << i + 1 << "," << end - i << " +" << i + 1 << "," << end - i << " @@\n";
+        for (size_t j = i; j < end; j++) out << "-" << oldLines[j] << "\n";
+        for (size_t j = i; j < end; j++) out << "+" << newLines[j] << "\n";
+        i = end;
+    }
+    out.flush();
+}
+
+static llvm::Error applyFile(llvm::StringRef path, const set<tooling::Replacement> &edits, string *diff) {
+    auto buf = llvm::MemoryBuffer::getFile(path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (!buf) return llvm::createFileError(path, buf.getError());
+    tooling::Replacements replacements;
+    for (auto &edit : edits) {
+        if (auto err = replacements.add(edit)) return llvm::createFileError(path, move(err));
+    }
+    auto code = (*buf)->getBuffer();
+    auto rewritten = tooling::applyAllReplacements(code, replacements);
+    if (!rewritten) return llvm::createFileError(path, rewritten.takeError());
+    if (diff) {
+        writeDiff(path, code, *rewritten, *diff);
+        return llvm::Error::success();
+    }
+    return writeFileAtomically(path, *rewritten);
+}
+
+DirectableEdits::Stats DirectableEdits::apply(unsigned jobs, llvm::raw_ostream *diff) {
+    // std::map, files and their diffs come out sorted by path
+    vector<const pair<const string, set<tooling::Replacement>> *> files;
+    for (auto &file : edits) {
+        files.push_back(&file);
+    }
+
+    Stats stats;
+    vector<string> diffs(files.size());
+    vector<bool> failed(files.size());
+    mutex errorLock;
+    {
+        llvm::ThreadPool pool(llvm::hardware_concurrency(jobs));
+        for (size_t i = 0; i < files.size(); i++) {
+            pool.async([&, i] {
+                if (auto err = applyFile(files[i]->first, files[i]->second, diff ? &diffs[i] : nullptr)) {
+                    lock_guard<mutex> guard(errorLock);
+                    llvm::logAllUnhandledErrors(move(err), llvm::errs(), "objc-direct-finder: ");
+                    failed[i] = true;
+                }
+            });
+        }
+        pool.wait();
+    }
+
+    for (size_t i = 0; i < files.size(); i++) {
+        if (failed[i]) {
+            stats.failures++;
+            continue;
+        }
+        stats.files++;
+        stats.edits += files[i]->second.size();
+        if (diff) *diff << diffs[i];
+    }
+    return stats;
+}
+
+namespace {
+
+class DirectAnnotator : public RecursiveASTVisitor<DirectAnnotator> {
+    SourceManager &sourceManager;
+    const LangOptions &langOpts;
+    const DirectableTargets &targets;
+    DirectableEdits &edits;
+    // entries of each file, null for files without any
+    llvm::DenseMap<FileID, const DirectableTargets::Locations *> fileTargets;
+
+    // the entry's isPropertyAccessor, none without an entry at `loc`
+    llvm::Optional<bool> targetAt(SourceLocation loc) {
+        auto fileLoc = sourceManager.getExpansionLoc(loc);
+        auto fileID = sourceManager.getFileID(fileLoc);
+        auto cached = fileTargets.find(fileID);
+        if (cached == fileTargets.end()) {
+            const DirectableTargets::Locations *locations = nullptr;
+            if (auto fileEntry = sourceManager.getFileEntryForID(fileID)) {
+                auto realPath = fileEntry->tryGetRealPathName();
+                if (!realPath.empty()) locations = targets.inFile(realPath);
+            }
+            // a `#line` file name, or a file the loader couldn't resolve
+            auto presumed = sourceManager.getPresumedLoc(fileLoc);
+            if (!locations && presumed.isValid()) locations = targets.inFile(presumed.getFilename());
+            cached = fileTargets.insert({fileID, locations}).first;
+        }
+        if (!cached->second) return llvm::None;
+        auto presumed = sourceManager.getPresumedLoc(fileLoc);
+        auto entry = cached->second->find({presumed.getLine(), presumed.getColumn()});
+        if (entry == cached->second->end()) return llvm::None;
+        return entry->second;
+    }
+
+    llvm::StringRef textAt(SourceLocation loc) {
+        auto decomposed = sourceManager.getDecomposedLoc(loc);
+        return sourceManager.getBufferData(decomposed.first).substr(decomposed.second);
+    }
+
+    void add(SourceLocation loc, llvm::StringRef text) {
+        auto fileEntry = sourceManager.getFileEntryForID(sourceManager.getFileID(loc));
+        if (!fileEntry) return;
+        // TUs spell the paths of the same header differently
+        llvm::StringRef path = fileEntry->tryGetRealPathName();
+        if (path.empty()) path = fileEntry->getName();
+        edits.add(tooling::Replacement(path, sourceManager.getFileOffset(loc), 0, text));
+    }
+
+    void skip(SourceLocation loc) {
+        edits.skip(loc.printToString(sourceManager));
+    }
+
+public:
+    DirectAnnotator(CompilerInstance &CI, const DirectableTargets &t, DirectableEdits &e)
+    : sourceManager(CI.getSourceManager()), langOpts(CI.getLangOpts()), targets(t), edits(e) {}
+
+    bool TraverseDecl(Decl *D) {
+        if (D && !isa<TranslationUnitDecl>(D) && sourceManager.isInSystemHeader(D->getLocation())) return true;
+        return RecursiveASTVisitor<DirectAnnotator>::TraverseDecl(D);
+    }
+
+    // properties and methods to annotate are never declared in a body
+    bool TraverseStmt(Stmt *S, DataRecursionQueue *Queue = nullptr) {
+        return true;
+    }
+
+    // @property (nonatomic, assign, direct) BOOL isLaunchFinished;
+    bool VisitObjCPropertyDecl(ObjCPropertyDecl *propertyDecl) {
+        auto target = targetAt(propertyDecl->getLocation());
+        if (!target || !*target || propertyDecl->isDirectProperty()) return true;
+
+        auto lParenLoc = propertyDecl->getLParenLoc();
+        auto atLoc = propertyDecl->getAtLoc();
+        if (lParenLoc.isValid()) {
+            if (lParenLoc.isMacroID()) {
+                skip(propertyDecl->getLocation());
+                return true;
+            }
+            auto attributesLoc = lParenLoc.getLocWithOffset(1);
+            bool emptyList = textAt(attributesLoc).ltrim().startswith(")");
+            add(attributesLoc, emptyList ? "direct" : "direct, ");
+        } else {
+            if (atLoc.isMacroID() || !textAt(atLoc).startswith("@property")) {
+                skip(propertyDecl->getLocation());
+                return true;
+            }
+            add(atLoc.getLocWithOffset(llvm::StringRef("@property").size()), " (direct)");
+        }
+        return true;
+    }
+
+    // - (BOOL)isLaunching __attribute__((objc_direct));
+    bool VisitObjCMethodDecl(ObjCMethodDecl *methodDecl) {
+        // implicit accessors are annotated through their property, an accessor
+        // declared explicitly is the entry's loc itself and annotated here
+        if (methodDecl->isImplicit() || methodDecl->isDirectMethod()) return true;
+        auto target = targetAt(methodDecl->getLocation());
+        if (!target) return true;
+
+        // the `;` of a declaration, the `{` of a definition
+        auto endLoc = methodDecl->getDeclaratorEndLoc();
+        if (!methodDecl->getLocation().isMacroID() && endLoc.isFileID()) {
+            auto endText = textAt(endLoc);
+            if (!endText.startswith(";") && !endText.startswith("{")) {
+                endLoc = Lexer::getLocForEndOfToken(endLoc, 0, sourceManager, langOpts);
+            }
+        }
+        if (methodDecl->getLocation().isMacroID() || endLoc.isInvalid() || endLoc.isMacroID()) {
+            skip(methodDecl->getLocation());
+            return true;
+        }
+        add(endLoc, " __attribute__((objc_direct))");
+        return true;
+    }
+};
+
+class DirectableApplyConsumer : public ASTConsumer {
+    DirectAnnotator annotator;
+public:
+    DirectableApplyConsumer(CompilerInstance &CI, const DirectableTargets &targets, DirectableEdits &edits) : annotator(CI, targets, edits) {}
+
+    void HandleTranslationUnit(ASTContext &context) override {
+        annotator.TraverseDecl(context.getTranslationUnitDecl());
+    }
+};
+
+}
+
+unique_ptr<ASTConsumer> createDirectableApplyConsumer(CompilerInstance &CI, const DirectableTargets &targets, DirectableEdits &edits) {
+    return make_unique<DirectableApplyConsumer>(CI, targets, edits);
+}
@@ -0,0 +1,65 @@
+//
+//  DirectableApply.h
+//  DirectableFinder
+//
+
+#ifndef DIRECTABLE_APPLY_H
+#define DIRECTABLE_APPLY_H
+
+#include "clang/AST/ASTConsumer.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Tooling/Core/Replacement.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/raw_ostream.h"
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+
+// Entries of a merged result, by file and (line, column) of their loc.
+class DirectableTargets {
+public:
+    // (line, column) : isPropertyAccessor
+    using Locations = llvm::DenseMap<std::pair<unsigned, unsigned>, bool>;
+
+    static llvm::Expected<DirectableTargets> load(llvm::StringRef content);
+
+    // null when no entry is in `file`
+    const Locations *inFile(llvm::StringRef file) const;
+    size_t size() const { return count; }
+
+private:
+    llvm::StringMap<Locations> files;
+    size_t count = 0;
+};
+
+// Annotations collected from every TU, each file's edits are kept once however
+// many TUs include it, so headers are edited once.
+class DirectableEdits {
+    std::mutex lock;
+    std::map<std::string, std::set<clang::tooling::Replacement>> edits;
+    // locs of declarations spelled in a macro expansion
+    std::set<std::string> skipped;
+public:
+    struct Stats {
+        size_t edits = 0;
+        size_t files = 0;
+        size_t failures = 0;
+    };
+
+    void add(clang::tooling::Replacement edit);
+    void skip(std::string loc);
+    const std::set<std::string> &skippedLocs() const { return skipped; }
+
+    // Rewrites every file on a thread pool, once every TU is done. With `diff`
+    // the files are left alone and a unified diff is written there instead.
+    Stats apply(unsigned jobs, llvm::raw_ostream *diff);
+};
+
+// Annotates the declarations at `targets` that aren't direct yet: `direct` is
+// added to the attribute list of properties, `__attribute__((objc_direct))`
+// to methods.
+std::unique_ptr<clang::ASTConsumer> createDirectableApplyConsumer(clang::CompilerInstance &CI, const DirectableTargets &targets, DirectableEdits &edits);
+
+#endif
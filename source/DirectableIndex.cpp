@@ -0,0 +1,263 @@
+//
+//  DirectableIndex.cpp
+//  DirectableFinder
+//
+
+#include "DirectableIndex.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/EndianStream.h"
+
+using namespace std;
+using namespace llvm;
+
+static const char Magic[8] = {'D', 'F', 'I', 'N', 'D', 'E', 'X', '1'};
+static const size_t HeaderSize = sizeof(Magic) + 2 * sizeof(uint32_t);
+static const size_t EntrySize = 8 * sizeof(uint32_t) + 3 * sizeof(uint64_t);
+static const size_t FileSize = 4 * sizeof(uint32_t);
+
+enum EntryFlags : uint32_t {
+    PropertyAccessor = 1 << 0,
+    HasEstimatedDispatches = 1 << 1,
+    HasEstimatedSavings = 1 << 2,
+    HasStaticSends = 1 << 3,
+};
+
+StringRef locFile(StringRef loc) {
+    auto line = loc.rsplit(':').first;
+    auto file = line.rsplit(':').first;
+    return file.size() == line.size() ? loc : file;
+}
+
+DirectableMeth DirectableIndex::Entry::meth() const {
+    DirectableMeth meth;
+    meth.name = name.str();
+    meth.sel = sel.str();
+    meth.loc = loc.str();
+    meth.isPropertyAccessor = isPropertyAccessor;
+    return meth;
+}
+
+Expected<unique_ptr<DirectableIndex>> DirectableIndex::load(StringRef path) {
+    auto buf = MemoryBuffer::getFile(path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (!buf) {
+        return createFileError(path, buf.getError());
+    }
+    return load(move(*buf));
+}
+
+Expected<unique_ptr<DirectableIndex>> DirectableIndex::load(unique_ptr<MemoryBuffer> buf) {
+    StringRef path = buf->getBufferIdentifier();
+    StringRef data = buf->getBuffer();
+    if (data.size() < HeaderSize || !data.startswith(StringRef(Magic, sizeof(Magic)))) {
+        return createFileError(path, make_error<StringError>("not a directable index", inconvertibleErrorCode()));
+    }
+    uint32_t entryCount = support::endian::read32le(data.data() + sizeof(Magic));
+    uint32_t fileCount = support::endian::read32le(data.data() + sizeof(Magic) + sizeof(uint32_t));
+    uint64_t stringsStart = HeaderSize + uint64_t(entryCount) * (EntrySize + sizeof(uint32_t)) + uint64_t(fileCount) * FileSize;
+    if (data.size() < stringsStart) {
+        return createFileError(path, make_error<StringError>("truncated directable index", inconvertibleErrorCode()));
+    }
+
+    unique_ptr<DirectableIndex> index(new DirectableIndex(move(buf)));
+    index->entryCount = entryCount;
+    index->files = fileCount;
+    index->entries = data.data() + HeaderSize;
+    index->byName = index->entries + uint64_t(entryCount) * EntrySize;
+    index->fileTable = index->byName + uint64_t(entryCount) * sizeof(uint32_t);
+    index->strings = data.drop_front(stringsStart);
+    return index;
+}
+
+bool DirectableIndex::isIndex(StringRef content) {
+    return content.startswith(StringRef(Magic, sizeof(Magic)));
+}
+
+Expected<unique_ptr<DirectableIndex>> DirectableIndex::loadResult(StringRef path) {
+    auto buf = MemoryBuffer::getFile(path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (!buf) {
+        return createFileError(path, buf.getError());
+    }
+    if (isIndex((*buf)->getBuffer())) return load(move(*buf));
+
+    auto meths = readMergedResult((*buf)->getBuffer());
+    if (!meths) return createFileError(path, meths.takeError());
+    string content;
+    raw_string_ostream out(content);
+    write(out, *meths, {});
+    return load(MemoryBuffer::getMemBufferCopy(out.str(), path));
+}
+
+// an (offset, size) pair, out of range strings of a damaged file read as empty
+StringRef DirectableIndex::stringAt(const char *field) const {
+    uint32_t offset = support::endian::read32le(field);
+    uint32_t size = support::endian::read32le(field + sizeof(uint32_t));
+    if (uint64_t(offset) + size > strings.size()) return StringRef();
+    return strings.substr(offset, size);
+}
+
+DirectableIndex::Entry DirectableIndex::operator[](size_t i) const {
+    const char *record = entries + i * EntrySize;
+    Entry entry;
+    entry.loc = stringAt(record);
+    entry.name = stringAt(record + 2 * sizeof(uint32_t));
+    entry.sel = stringAt(record + 4 * sizeof(uint32_t));
+    uint32_t flags = support::endian::read32le(record + 6 * sizeof(uint32_t));
+    const char *estimates = record + 8 * sizeof(uint32_t);
+    entry.isPropertyAccessor = flags & PropertyAccessor;
+    if (flags & HasEstimatedDispatches) entry.estimates.estimatedDispatches = support::endian::read64le(estimates);
+    if (flags & HasEstimatedSavings) entry.estimates.estimatedSavings = support::endian::read64le(estimates + sizeof(uint64_t));
+    if (flags & HasStaticSends) entry.estimates.staticSends = support::endian::read64le(estimates + 2 * sizeof(uint64_t));
+    return entry;
+}
+
+StringRef DirectableIndex::nameAt(size_t i) const {
+    uint32_t entry = support::endian::read32le(byName + i * sizeof(uint32_t));
+    if (entry >= entryCount) return StringRef();
+    return stringAt(entries + entry * EntrySize + 2 * sizeof(uint32_t));
+}
+
+Optional<size_t> DirectableIndex::findLoc(StringRef loc) const {
+    size_t low = 0, high = entryCount;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        int order = stringAt(entries + mid * EntrySize).compare(loc);
+        if (order == 0) return mid;
+        if (order < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return None;
+}
+
+vector<size_t> DirectableIndex::findName(StringRef name) const {
+    // lower bound, then the run of equal names
+    size_t low = 0, high = entryCount;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (nameAt(mid) < name) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    vector<size_t> found;
+    for (; low < entryCount && nameAt(low) == name; low++) {
+        found.push_back(support::endian::read32le(byName + low * sizeof(uint32_t)));
+    }
+    return found;
+}
+
+StringRef DirectableIndex::file(size_t i) const {
+    return stringAt(fileTable + i * FileSize);
+}
+
+pair<size_t, size_t> DirectableIndex::findFile(StringRef path) const {
+    size_t low = 0, high = files;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        int order = file(mid).compare(path);
+        if (order == 0) {
+            const char *record = fileTable + mid * FileSize;
+            uint32_t first = support::endian::read32le(record + 2 * sizeof(uint32_t));
+            uint32_t count = support::endian::read32le(record + 3 * sizeof(uint32_t));
+            if (uint64_t(first) + count > entryCount) break;
+            return {first, first + count};
+        }
+        if (order < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return {0, 0};
+}
+
+void DirectableIndex::write(raw_ostream &out, const vector<DirectableMeth> &meths, const vector<MergedEstimates> &estimates) {
+    vector<uint32_t> byLoc(meths.size());
+    for (size_t i = 0; i < byLoc.size(); i++) {
+        byLoc[i] = i;
+    }
+    llvm::sort(byLoc, [&](uint32_t a, uint32_t b) {
+        return tie(meths[a].loc, meths[a].name) < tie(meths[b].loc, meths[b].name);
+    });
+    // positions in `byLoc` sorted by name, then loc
+    vector<uint32_t> byName(meths.size());
+    for (size_t i = 0; i < byName.size(); i++) {
+        byName[i] = i;
+    }
+    llvm::sort(byName, [&](uint32_t a, uint32_t b) {
+        auto &x = meths[byLoc[a]];
+        auto &y = meths[byLoc[b]];
+        return tie(x.name, x.loc) < tie(y.name, y.loc);
+    });
+
+    // selectors are interned, paths point into the loc of the file's first entry
+    string blob;
+    StringMap<uint32_t> interned;
+    auto intern = [&](StringRef str) {
+        auto inserted = interned.insert({str, blob.size()});
+        if (inserted.second) blob += str.str();
+        return inserted.first->second;
+    };
+    struct FileRecord {
+        StringRef path;
+        uint32_t pathOffset;
+        uint32_t firstEntry;
+        uint32_t entryCount;
+    };
+    vector<FileRecord> fileRecords;
+    vector<array<uint32_t, 3>> offsets;
+    for (size_t i = 0; i < byLoc.size(); i++) {
+        auto &meth = meths[byLoc[i]];
+        uint32_t locOffset = blob.size();
+        blob += meth.loc;
+        uint32_t nameOffset = blob.size();
+        blob += meth.name;
+        offsets.push_back({locOffset, nameOffset, intern(meth.sel)});
+
+        auto path = locFile(meth.loc);
+        if (!fileRecords.empty() && fileRecords.back().path == path) {
+            fileRecords.back().entryCount++;
+        } else {
+            fileRecords.push_back({path, locOffset, (uint32_t)i, 1});
+        }
+    }
+    // locs of a path share the "path:" prefix, but "a.h.in:1:1" < "a.h:1:1" while "a.h" < "a.h.in"
+    llvm::sort(fileRecords, [](const FileRecord &a, const FileRecord &b) {
+        return a.path < b.path;
+    });
+
+    out.write(Magic, sizeof(Magic));
+    support::endian::write<uint32_t>(out, meths.size(), support::little);
+    support::endian::write<uint32_t>(out, fileRecords.size(), support::little);
+    for (size_t i = 0; i < byLoc.size(); i++) {
+        auto &meth = meths[byLoc[i]];
+        MergedEstimates estimate;
+        if (!estimates.empty()) estimate = estimates[byLoc[i]];
+        uint32_t flags = 0;
+        if (meth.isPropertyAccessor) flags |= PropertyAccessor;
+        if (estimate.estimatedDispatches) flags |= HasEstimatedDispatches;
+        if (estimate.estimatedSavings) flags |= HasEstimatedSavings;
+        if (estimate.staticSends) flags |= HasStaticSends;
+        for (uint32_t field : {offsets[i][0], (uint32_t)meth.loc.size(), offsets[i][1], (uint32_t)meth.name.size(), offsets[i][2], (uint32_t)meth.sel.size(), flags, uint32_t(0)}) {
+            support::endian::write<uint32_t>(out, field, support::little);
+        }
+        for (auto value : {estimate.estimatedDispatches, estimate.estimatedSavings, estimate.staticSends}) {
+            support::endian::write<uint64_t>(out, value.getValueOr(0), support::little);
+        }
+    }
+    for (auto position : byName) {
+        support::endian::write<uint32_t>(out, position, support::little);
+    }
+    for (auto &record : fileRecords) {
+        for (uint32_t field : {record.pathOffset, (uint32_t)record.path.size(), record.firstEntry, record.entryCount}) {
+            support::endian::write<uint32_t>(out, field, support::little);
+        }
+    }
+    out << blob;
+}
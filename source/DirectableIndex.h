@@ -0,0 +1,89 @@
+//
+//  DirectableIndex.h
+//  DirectableFinder
+//
+
+#ifndef DIRECTABLE_INDEX_H
+#define DIRECTABLE_INDEX_H
+
+#include "DirectableMerge.h"
+#include "DirectableShard.h"
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <memory>
+#include <utility>
+#include <vector>
+
+// A merged result as sorted sections, queried in place from the mapped file.
+//
+// Layout (little endian):
+//   char     magic[8]                 "DFINDEX1"
+//   uint32_t entryCount
+//   uint32_t fileCount
+//   Entry    entries[entryCount]      sorted bytewise by loc
+//   uint32_t byName[entryCount]       entry indices sorted by name, then loc
+//   File     files[fileCount]         sorted bytewise by path
+//   char     strings[]
+//
+//   Entry: uint32_t locOffset, locSize, nameOffset, nameSize, selOffset, selSize, flags, reserved
+//          uint64_t estimatedDispatches, estimatedSavings, staticSends
+//   File:  uint32_t pathOffset, pathSize, firstEntry, entryCount
+//
+// String offsets are relative to `strings`. A file's path is the prefix of the
+// loc of its first entry, its entries are consecutive since they are sorted by loc.
+class DirectableIndex {
+public:
+    struct Entry {
+        llvm::StringRef loc;
+        llvm::StringRef name;
+        llvm::StringRef sel;
+        bool isPropertyAccessor = false;
+        MergedEstimates estimates;
+
+        DirectableMeth meth() const;
+    };
+
+    static llvm::Expected<std::unique_ptr<DirectableIndex>> load(llvm::StringRef path);
+    static llvm::Expected<std::unique_ptr<DirectableIndex>> load(std::unique_ptr<llvm::MemoryBuffer> buffer);
+    static bool isIndex(llvm::StringRef content);
+    // an index, or merge.py's json which is indexed in memory first
+    static llvm::Expected<std::unique_ptr<DirectableIndex>> loadResult(llvm::StringRef path);
+
+    // sorts `meths` into the sections, `estimates` is empty or parallel to `meths`
+    static void write(llvm::raw_ostream &out, const std::vector<DirectableMeth> &meths, const std::vector<MergedEstimates> &estimates);
+
+    // entries in loc order
+    size_t size() const { return entryCount; }
+    Entry operator[](size_t i) const;
+
+    llvm::Optional<size_t> findLoc(llvm::StringRef loc) const;
+    // indices of the entries named `name`, in loc order
+    std::vector<size_t> findName(llvm::StringRef name) const;
+    // [first, end) of the entries declared in `file`
+    std::pair<size_t, size_t> findFile(llvm::StringRef file) const;
+
+    size_t fileCount() const { return files; }
+    llvm::StringRef file(size_t i) const;
+
+private:
+    std::unique_ptr<llvm::MemoryBuffer> buffer;
+    uint32_t entryCount = 0;
+    uint32_t files = 0;
+    const char *entries = nullptr;
+    const char *byName = nullptr;
+    const char *fileTable = nullptr;
+    llvm::StringRef strings;
+
+    DirectableIndex(std::unique_ptr<llvm::MemoryBuffer> buf) : buffer(std::move(buf)) {}
+
+    llvm::StringRef stringAt(const char *field) const;
+    llvm::StringRef nameAt(size_t i) const;
+};
+
+// "path/Foo.h" of "path/Foo.h:12:1"
+llvm::StringRef locFile(llvm::StringRef loc);
+
+#endif
@@ -0,0 +1,586 @@
+//
+//  DirectableMerge.cpp
+//  DirectableFinder
+//
+
+#include "DirectableMerge.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/ConvertUTF.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/LEB128.h"
+#include "llvm/Support/xxhash.h"
+
+using namespace std;
+using namespace llvm;
+
+static void writeEscapedUnit(raw_ostream &out, uint32_t unit) {
+    out << "\\u" << format_hex_no_prefix(unit, 4, /*Upper=*/false);
+}
+
+void writePythonJSONString(raw_ostream &out, StringRef str) {
+    out << '"';
+    const char *cursor = str.begin(), *end = str.end();
+    while (cursor != end) {
+        unsigned char c = *cursor;
+        switch (c) {
+        case '"': out << "\\\""; cursor++; continue;
+        case '\\': out << "\\\\"; cursor++; continue;
+        case '\n': out << "\\n"; cursor++; continue;
+        case '\r': out << "\\r"; cursor++; continue;
+        case '\t': out << "\\t"; cursor++; continue;
+        case '\b': out << "\\b"; cursor++; continue;
+        case '\f': out << "\\f"; cursor++; continue;
+        }
+        if (c >= 0x20 && c < 0x7f) {
+            out << (char)c;
+            cursor++;
+            continue;
+        }
+        if (c < 0x80) {
+            writeEscapedUnit(out, c);
+            cursor++;
+            continue;
+        }
+
+        // everything outside printable ascii is \u escaped, astral code points as surrogate pairs
+        UTF32 codePoint;
+        const UTF8 *source = (const UTF8 *)cursor;
+        UTF32 *target = &codePoint;
+        if (ConvertUTF8toUTF32(&source, (const UTF8 *)end, &target, target + 1, strictConversion) != conversionOK && target == &codePoint) {
+            // shards come from llvm::json which only emits valid utf-8
+            writeEscapedUnit(out, 0xfffd);
+            cursor++;
+            continue;
+        }
+        cursor = (const char *)source;
+        if (codePoint >= 0x10000) {
+            codePoint -= 0x10000;
+            writeEscapedUnit(out, 0xd800 + (codePoint >> 10));
+            writeEscapedUnit(out, 0xdc00 + (codePoint & 0x3ff));
+        } else {
+            writeEscapedUnit(out, codePoint);
+        }
+    }
+    out << '"';
+}
+
+void MergedResultWriter::add(const DirectableMeth &meth) {
+    add(meth, MergedEstimates());
+}
+
+void MergedResultWriter::add(const DirectableMeth &meth, const MergedEstimates &estimates) {
+    out << (count++ ? ",\n    " : "{\n    ");
+    writePythonJSONString(out, meth.loc);
+    out << ": {";
+    if (estimates.estimatedDispatches) out << "\n        \"estimatedDispatches\": " << *estimates.estimatedDispatches << ",";
+    if (estimates.estimatedSavings) out << "\n        \"estimatedSavings\": " << *estimates.estimatedSavings << ",";
+    out << "\n        \"isPropertyAccessor\": " << (meth.isPropertyAccessor ? "true" : "false");
+    out << ",\n        \"loc\": ";
+    writePythonJSONString(out, meth.loc);
+    out << ",\n        \"name\": ";
+    writePythonJSONString(out, meth.name);
+    out << ",\n        \"sel\": ";
+    writePythonJSONString(out, meth.sel);
+    if (estimates.staticSends) out << ",\n        \"staticSends\": " << *estimates.staticSends;
+    out << "\n    }";
+}
+
+Expected<vector<DirectableMeth>> readMergedResult(StringRef content) {
+    auto value = json::parse(content);
+    if (!value) return value.takeError();
+    auto object = value->getAsObject();
+    if (!object) return make_error<StringError>("merged result is not a json object", inconvertibleErrorCode());
+
+    vector<DirectableMeth> meths;
+    meths.reserve(object->size());
+    for (auto &entry : *object) {
+        auto fields = entry.second.getAsObject();
+        auto name = fields ? fields->getString("name") : None;
+        auto sel = fields ? fields->getString("sel") : None;
+        auto isPropertyAccessor = fields ? fields->getBoolean("isPropertyAccessor") : None;
+        if (!name || !sel || !isPropertyAccessor) {
+            return make_error<StringError>("malformed merged result entry " + StringRef(entry.first), inconvertibleErrorCode());
+        }
+        DirectableMeth meth;
+        meth.name = name->str();
+        meth.sel = sel->str();
+        meth.loc = StringRef(entry.first).str();
+        meth.isPropertyAccessor = *isPropertyAccessor;
+        meths.push_back(move(meth));
+    }
+    return meths;
+}
+
+void MergedResultWriter::finish() {
+    out << (count ? "\n}" : "{}");
+}
+
+ConcurrentStringSet::Shard &ConcurrentStringSet::shardFor(StringRef str) {
+    return shards[xxHash64(str) % ShardCount];
+}
+
+const ConcurrentStringSet::Shard &ConcurrentStringSet::shardFor(StringRef str) const {
+    return shards[xxHash64(str) % ShardCount];
+}
+
+void ConcurrentStringSet::insert(StringRef str) {
+    auto &shard = shardFor(str);
+    lock_guard<mutex> guard(shard.lock);
+    shard.set.insert(str);
+}
+
+bool ConcurrentStringSet::contains(StringRef str) const {
+    return shardFor(str).set.count(str);
+}
+
+bool ConcurrentStringSet::lockedContains(StringRef str) {
+    auto &shard = shardFor(str);
+    lock_guard<mutex> guard(shard.lock);
+    return shard.set.count(str);
+}
+
+size_t ConcurrentStringSet::size() const {
+    size_t size = 0;
+    for (auto &shard : shards) {
+        size += shard.set.size();
+    }
+    return size;
+}
+
+void DirectableMerger::add(DirectableShard shard) {
+    for (auto &sel : shard.sels) {
+        undirectableSels.insert(sel);
+    }
+    for (auto &name : shard.undirectMeths) {
+        undirectableNames.insert(name);
+    }
+    for (auto &meth : shard.meths) {
+        meths.push_back(move(meth));
+    }
+}
+
+size_t DirectableMerger::write(raw_ostream &out) const {
+    vector<const DirectableMeth *> entries;
+    StringMap<size_t> positionByLoc;
+    for (auto &meth : meths) {
+        if (undirectableSels.count(meth.sel)) continue;
+        if (undirectableNames.count(meth.name)) continue;
+        auto inserted = positionByLoc.insert({meth.loc, entries.size()});
+        if (inserted.second) {
+            entries.push_back(&meth);
+        } else {
+            entries[inserted.first->second] = &meth;
+        }
+    }
+
+    MergedResultWriter writer(out);
+    for (auto meth : entries) {
+        writer.add(*meth);
+    }
+    writer.finish();
+    return writer.size();
+}
+
+static const char MergeStateMagic[] = "DFST";
+static const uint64_t MergeStateVersion = 1;
+
+static bool applyCount(uint64_t &count, int64_t delta) {
+    if (delta < 0 && count <= uint64_t(-delta)) return false;
+    count += delta;
+    return true;
+}
+
+static void applyCount(StringMap<uint64_t> &counts, StringRef key, int64_t delta) {
+    auto &count = counts[key];
+    if (!applyCount(count, delta)) counts.erase(key);
+}
+
+class MergeStateApplier : public ShardVisitor {
+    MergeState &state;
+    int64_t delta;
+public:
+    MergeStateApplier(MergeState &s, int64_t d) : state(s), delta(d) {}
+
+    void visitSel(StringRef sel) override { applyCount(state.sels, sel, delta); }
+    void visitUndirectMeth(StringRef name) override { applyCount(state.names, name, delta); }
+    void visitMeth(const DirectableMethRef &ref) override {
+        auto it = state.meths.find(ref.loc);
+        if (it == state.meths.end()) {
+            if (delta < 0) return;
+            it = state.meths.emplace(ref.loc.str(), map<MergeState::MethRecord, uint64_t>()).first;
+        }
+        auto &records = it->second;
+        MergeState::MethRecord record;
+        record.name = ref.name.str();
+        record.sel = ref.sel.str();
+        record.isPropertyAccessor = ref.isPropertyAccessor;
+        auto &count = records[record];
+        if (applyCount(count, delta)) return;
+        records.erase(record);
+        if (records.empty()) state.meths.erase(it);
+    }
+};
+
+Error MergeState::applyShard(StringRef content, int64_t delta) {
+    MergeStateApplier applier(*this, delta);
+    return scanShard(content, applier);
+}
+
+void MergeState::forEachSurvivor(function_ref<void(DirectableMeth &)> visit) const {
+    DirectableMeth meth;
+    for (auto &loc : meths) {
+        for (auto &record : loc.second) {
+            if (sels.count(record.first.sel)) continue;
+            if (names.count(record.first.name)) continue;
+            meth.name = record.first.name;
+            meth.sel = record.first.sel;
+            meth.loc = loc.first;
+            meth.isPropertyAccessor = record.first.isPropertyAccessor;
+            visit(meth);
+            break;
+        }
+    }
+}
+
+size_t MergeState::write(raw_ostream &out) const {
+    MergedResultWriter writer(out);
+    forEachSurvivor([&](DirectableMeth &meth) { writer.add(meth); });
+    writer.finish();
+    return writer.size();
+}
+
+static void writeStateString(raw_ostream &out, StringRef str) {
+    encodeULEB128(str.size(), out);
+    out << str;
+}
+
+// StringMap iterates in hash order, counts are written sorted so equal states save equal bytes
+static void writeStateCounts(raw_ostream &out, const StringMap<uint64_t> &counts) {
+    vector<StringRef> keys;
+    for (auto &entry : counts) {
+        keys.push_back(entry.getKey());
+    }
+    llvm::sort(keys);
+    encodeULEB128(keys.size(), out);
+    for (auto key : keys) {
+        writeStateString(out, key);
+        encodeULEB128(counts.lookup(key), out);
+    }
+}
+
+void MergeState::save(raw_ostream &out) const {
+    out << MergeStateMagic;
+    encodeULEB128(MergeStateVersion, out);
+    writeStateCounts(out, objects);
+    writeStateCounts(out, sels);
+    writeStateCounts(out, names);
+    encodeULEB128(meths.size(), out);
+    for (auto &loc : meths) {
+        writeStateString(out, loc.first);
+        encodeULEB128(loc.second.size(), out);
+        for (auto &record : loc.second) {
+            writeStateString(out, record.first.name);
+            writeStateString(out, record.first.sel);
+            encodeULEB128(record.first.isPropertyAccessor, out);
+            encodeULEB128(record.second, out);
+        }
+    }
+}
+
+namespace {
+class StateReader {
+    const uint8_t *cursor;
+    const uint8_t *end;
+public:
+    bool failed = false;
+    StateReader(StringRef content) : cursor(content.bytes_begin()), end(content.bytes_end()) {}
+
+    uint64_t uleb() {
+        if (failed) return 0;
+        unsigned size = 0;
+        const char *error = NULL;
+        uint64_t value = decodeULEB128(cursor, &size, end, &error);
+        if (error) {
+            failed = true;
+            return 0;
+        }
+        cursor += size;
+        return value;
+    }
+
+    StringRef string() {
+        uint64_t size = uleb();
+        if (failed || size > uint64_t(end - cursor)) {
+            failed = true;
+            return StringRef();
+        }
+        StringRef str((const char *)cursor, size);
+        cursor += size;
+        return str;
+    }
+
+    void counts(StringMap<uint64_t> &counts) {
+        for (uint64_t i = 0, e = uleb(); i < e && !failed; i++) {
+            auto key = string();
+            counts[key] = uleb();
+        }
+    }
+
+    bool atEnd() const { return cursor == end; }
+};
+}
+
+Expected<MergeState> MergeState::load(StringRef content) {
+    if (!content.consume_front(MergeStateMagic)) {
+        return make_error<StringError>("not a merge state file", inconvertibleErrorCode());
+    }
+    StateReader reader(content);
+    uint64_t version = reader.uleb();
+    if (version != MergeStateVersion) {
+        return make_error<StringError>("unsupported merge state version " + to_string(version), inconvertibleErrorCode());
+    }
+    MergeState state;
+    reader.counts(state.objects);
+    reader.counts(state.sels);
+    reader.counts(state.names);
+    for (uint64_t i = 0, e = reader.uleb(); i < e && !reader.failed; i++) {
+        auto &records = state.meths[reader.string().str()];
+        for (uint64_t j = 0, f = reader.uleb(); j < f && !reader.failed; j++) {
+            MethRecord record;
+            record.name = reader.string().str();
+            record.sel = reader.string().str();
+            record.isPropertyAccessor = reader.uleb();
+            records[record] = reader.uleb();
+        }
+    }
+    if (reader.failed || !reader.atEnd()) {
+        return make_error<StringError>("truncated merge state", inconvertibleErrorCode());
+    }
+    return state;
+}
+
+StringRef methodClassName(StringRef name) {
+    return name.drop_front(2).take_until([](char c) { return c == ' ' || c == '('; });
+}
+
+void PropertySetters::add(const DirectableSummary &summary) {
+    for (auto &clz : summary.classes) {
+        auto &classSetters = setters[clz.name];
+        for (StringRef property : clz.properties) {
+            // `getter` or `getter setter:`, a readwrite redeclaration wins
+            auto accessors = property.split(' ');
+            auto inserted = classSetters.insert({accessors.first, accessors.second.str()});
+            if (!inserted.second && inserted.first->second.empty()) inserted.first->second = accessors.second.str();
+        }
+    }
+}
+
+Optional<StringRef> PropertySetters::recorded(StringRef cls, StringRef getter) const {
+    auto classSetters = setters.find(cls);
+    if (classSetters == setters.end()) return None;
+    auto setter = classSetters->second.find(getter);
+    if (setter == classSetters->second.end()) return None;
+    return StringRef(setter->second);
+}
+
+string PropertySetters::setterSel(StringRef cls, StringRef getter) const {
+    if (auto setter = recorded(cls, getter)) return setter->str();
+    if (getter.empty()) return string();
+    return ("set" + getter.take_front(1).upper() + getter.drop_front(1) + ":").str();
+}
+
+void ProgramResolver::add(const DirectableShard &shard) {
+    for (auto &name : shard.undirectMeths) {
+        undirectableNames.insert(name);
+    }
+    for (auto &meth : shard.meths) {
+        MergeState::MethRecord record;
+        record.name = meth.name;
+        record.sel = meth.sel;
+        record.isPropertyAccessor = meth.isPropertyAccessor;
+        candidates[meth.loc].insert(move(record));
+    }
+    if (!shard.hasSummary) {
+        for (auto &sel : shard.sels) {
+            dynamicSels.insert(sel);
+        }
+        missingSummaries = true;
+        return;
+    }
+
+    auto &summary = shard.summary;
+    setters.add(summary);
+    for (auto &clz : summary.classes) {
+        auto &node = classes[clz.name];
+        if (node.super.empty()) node.super = clz.super;
+        for (auto &protocol : clz.protocols) {
+            adopters[protocol].insert(clz.name);
+        }
+        for (auto &meth : clz.declared) {
+            classesByMeth[meth].insert(clz.name);
+        }
+        for (auto &meth : clz.implemented) {
+            classesByMeth[meth].insert(clz.name);
+            implemented[clz.name].insert(meth);
+        }
+    }
+    for (auto &protocol : summary.protocols) {
+        for (auto &parent : protocol.inherits) {
+            inheritedBy[parent].insert(protocol.name);
+        }
+        for (auto &meth : protocol.meths) {
+            protocolsByMeth[meth].insert(protocol.name);
+        }
+    }
+    for (auto &sel : summary.selectorRefs) {
+        dynamicSels.insert(sel);
+    }
+    for (auto &sel : summary.dynamicSends) {
+        dynamicSels.insert(sel);
+    }
+    for (StringRef name : summary.staticRefs) {
+        // `-[Class sel]`
+        if (name.size() < 4 || !name.endswith("]")) continue;
+        auto classAndSel = name.drop_front(2).drop_back().split(' ');
+        staticRefs[(name.take_front() + classAndSel.second).str()].insert(classAndSel.first);
+    }
+}
+
+bool ProgramResolver::isAncestor(StringRef ancestor, StringRef cls) const {
+    // bounded, in case inconsistent shards describe a cycle
+    for (size_t depth = 0; depth <= classes.size(); depth++) {
+        auto node = classes.find(cls);
+        if (node == classes.end() || node->second.super.empty()) return false;
+        cls = node->second.super;
+        if (cls == ancestor) return true;
+    }
+    return false;
+}
+
+bool ProgramResolver::isRelated(StringRef a, StringRef b) const {
+    return a == b || isAncestor(a, b) || isAncestor(b, a);
+}
+
+// declared again up or down the hierarchy
+bool ProgramResolver::isRedeclared(StringRef cls, StringRef signedSel) const {
+    auto declaring = classesByMeth.find(signedSel);
+    if (declaring == classesByMeth.end()) return false;
+    for (auto &other : declaring->second) {
+        if (other.getKey() != cls && isRelated(other.getKey(), cls)) return true;
+    }
+    return false;
+}
+
+bool ProgramResolver::isMethodUndirectable(StringRef cls, StringRef signedSel) const {
+    if (isRedeclared(cls, signedSel)) return true;
+
+    auto requiring = protocolsByMeth.find(signedSel);
+    if (requiring == protocolsByMeth.end()) return false;
+    // a class no summary describes can't be checked for conformances
+    if (!classes.count(cls)) return true;
+
+    // required by a protocol, or one inheriting from it, that the hierarchy adopts
+    SmallVector<StringRef, 8> pending;
+    StringSet<> seen;
+    for (auto &protocol : requiring->second) {
+        pending.push_back(protocol.getKey());
+    }
+    while (!pending.empty()) {
+        auto protocol = pending.pop_back_val();
+        if (!seen.insert(protocol).second) continue;
+        auto adopting = adopters.find(protocol);
+        if (adopting != adopters.end()) {
+            for (auto &adopter : adopting->second) {
+                if (isRelated(adopter.getKey(), cls)) return true;
+            }
+        }
+        auto inheriting = inheritedBy.find(protocol);
+        if (inheriting != inheritedBy.end()) {
+            for (auto &child : inheriting->second) {
+                pending.push_back(child.getKey());
+            }
+        }
+    }
+    return false;
+}
+
+bool ProgramResolver::survives(const MergeState::MethRecord &record) const {
+    if (dynamicSels.count(record.sel)) return false;
+    if (undirectableNames.count(record.name)) return false;
+
+    // `-[Class(Category) sel]`
+    StringRef name = record.name;
+    if (name.size() < 4) return false;
+    StringRef sign = name.take_front();
+    StringRef cls = methodClassName(name);
+    if (isMethodUndirectable(cls, (sign + record.sel).str())) return false;
+    if (!record.isPropertyAccessor) return true;
+
+    // the property is made direct as a whole, its setter has to qualify too
+    auto setter = setters.recorded(cls, record.sel);
+    if (!setter || setter->empty()) return true;
+    if (dynamicSels.count(*setter)) return false;
+    return !isMethodUndirectable(cls, (sign + *setter).str());
+}
+
+bool ProgramResolver::isOverride(const DirectableMeth &meth) const {
+    StringRef name = meth.name;
+    if (name.size() < 4) return false;
+    StringRef sign = name.take_front();
+    StringRef cls = methodClassName(name);
+    if (isRedeclared(cls, (sign + meth.sel).str())) return true;
+    if (!meth.isPropertyAccessor) return false;
+    auto setter = setters.recorded(cls, meth.sel);
+    return setter && !setter->empty() && isRedeclared(cls, (sign + *setter).str());
+}
+
+bool ProgramResolver::isReferenced(StringRef cls, StringRef signedSel) const {
+    if (dynamicSels.count(signedSel.drop_front())) return true;
+    // sent to a superclass it inherits from, or to a subclass that overrides or inherits it
+    auto referencing = staticRefs.find(signedSel);
+    if (referencing == staticRefs.end()) return false;
+    for (auto &receiver : referencing->second) {
+        if (isRelated(receiver.getKey(), cls)) return true;
+    }
+    return false;
+}
+
+size_t ProgramResolver::writeUnreferenced(raw_ostream &out) const {
+    vector<string> names;
+    for (auto &clz : implemented) {
+        for (auto &meth : clz.second) {
+            StringRef signedSel = meth.getKey();
+            if (signedSel.empty() || isReferenced(clz.getKey(), signedSel)) continue;
+            names.push_back((signedSel.take_front() + "[" + clz.getKey() + " " + signedSel.drop_front() + "]").str());
+        }
+    }
+    llvm::sort(names);
+    for (auto &name : names) {
+        out << name << "\n";
+    }
+    return names.size();
+}
+
+void ProgramResolver::forEachSurvivor(function_ref<void(DirectableMeth &)> visit) const {
+    DirectableMeth meth;
+    for (auto &loc : candidates) {
+        for (auto &record : loc.second) {
+            if (!survives(record)) continue;
+            meth.name = record.name;
+            meth.sel = record.sel;
+            meth.loc = loc.first;
+            meth.isPropertyAccessor = record.isPropertyAccessor;
+            visit(meth);
+            break;
+        }
+    }
+}
+
+size_t ProgramResolver::write(raw_ostream &out) const {
+    MergedResultWriter writer(out);
+    forEachSurvivor([&](DirectableMeth &meth) { writer.add(meth); });
+    writer.finish();
+    return writer.size();
+}
@@ -0,0 +1,205 @@
+//
+//  DirectableMerge.h
+//  DirectableFinder
+//
+
+#ifndef DIRECTABLE_MERGE_H
+#define DIRECTABLE_MERGE_H
+
+#include "DirectableShard.h"
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/raw_ostream.h"
+#include <array>
+#include <map>
+#include <mutex>
+#include <set>
+#include <tuple>
+
+// Estimates attached to a merged entry, see --link-map and --dispatches
+struct MergedEstimates {
+    llvm::Optional<uint64_t> estimatedDispatches;
+    llvm::Optional<uint64_t> estimatedSavings;
+    llvm::Optional<uint64_t> staticSends;
+};
+
+// Writes merge.py's output, `json.dumps({loc: meth}, indent=4)`, byte for byte.
+class MergedResultWriter {
+    llvm::raw_ostream &out;
+    size_t count = 0;
+
+public:
+    MergedResultWriter(llvm::raw_ostream &os) : out(os) {}
+
+    void add(const DirectableMeth &meth);
+    // with a key for each estimate, in json.dumps(sort_keys=True) order
+    void add(const DirectableMeth &meth, const MergedEstimates &estimates);
+    void finish();
+    size_t size() const { return count; }
+};
+
+// entries of a merged result, in no particular order
+llvm::Expected<std::vector<DirectableMeth>> readMergedResult(llvm::StringRef content);
+
+// Python's json.dumps string encoding (ensure_ascii=True)
+void writePythonJSONString(llvm::raw_ostream &out, llvm::StringRef str);
+
+// String set split into independently locked shards so parallel readers of
+// different shard files rarely contend.
+class ConcurrentStringSet {
+    static const size_t ShardCount = 64;
+    struct Shard {
+        std::mutex lock;
+        llvm::StringSet<> set;
+    };
+    std::array<Shard, ShardCount> shards;
+
+    Shard &shardFor(llvm::StringRef str);
+    const Shard &shardFor(llvm::StringRef str) const;
+public:
+    void insert(llvm::StringRef str);
+    // doesn't lock, only call once every insert has finished
+    bool contains(llvm::StringRef str) const;
+    // locks the string's shard, safe while other threads insert
+    bool lockedContains(llvm::StringRef str);
+    size_t size() const;
+};
+
+// merge.py's semantics in memory: a candidate survives unless any shard marked its
+// selector or its name undirectable, candidates are keyed by "loc" and a later
+// candidate replaces an earlier one but keeps its position.
+class DirectableMerger {
+    llvm::StringSet<> undirectableSels;
+    llvm::StringSet<> undirectableNames;
+    std::vector<DirectableMeth> meths;
+public:
+    // shards are merged in the order they are added
+    void add(DirectableShard shard);
+
+    // returns the number of entries written
+    size_t write(llvm::raw_ostream &out) const;
+};
+
+// Reference counted merge inputs, persisted between merges of a shard store so
+// only shards added or removed since the last merge are read. Every selector,
+// name and candidate counts the shards it came from, a candidate survives while
+// neither its selector nor its name is counted. Entries are written sorted by
+// loc, a loc with several candidates writes the smallest (name, sel).
+class MergeState {
+public:
+    struct MethRecord {
+        std::string name;
+        std::string sel;
+        bool isPropertyAccessor = false;
+        bool operator<(const MethRecord &other) const {
+            return std::tie(name, sel, isPropertyAccessor) < std::tie(other.name, other.sel, other.isPropertyAccessor);
+        }
+    };
+
+    // shards applied to the state, with the number of TUs referencing each
+    llvm::StringMap<uint64_t> objects;
+
+    // `delta` is +1 for a shard to add and -1 for one to remove
+    llvm::Error applyShard(llvm::StringRef content, int64_t delta);
+
+    // returns the number of entries written
+    size_t write(llvm::raw_ostream &out) const;
+    // the entries write() writes, in the same order
+    void forEachSurvivor(llvm::function_ref<void(DirectableMeth &)> visit) const;
+
+    // "DFST", uleb128 version, then objects, sels, names and candidates grouped by loc
+    void save(llvm::raw_ostream &out) const;
+    static llvm::Expected<MergeState> load(llvm::StringRef content);
+
+private:
+    friend class MergeStateApplier;
+    llvm::StringMap<uint64_t> sels;
+    llvm::StringMap<uint64_t> names;
+    std::map<std::string, std::map<MethRecord, uint64_t>, std::less<>> meths;
+};
+
+// `Foo` of `-[Foo(Category) sel]`
+llvm::StringRef methodClassName(llvm::StringRef name);
+
+// Setters of the properties described by -summary shards, so accessors with a
+// custom `setter=` are paired with the right method.
+class PropertySetters {
+    // class : getter : setter, empty for readonly properties
+    llvm::StringMap<llvm::StringMap<std::string>> setters;
+public:
+    void add(const DirectableSummary &summary);
+
+    // the setter selector of `cls`'s property `getter`, empty when it is
+    // readonly, None when no summary describes the property
+    llvm::Optional<llvm::StringRef> recorded(llvm::StringRef cls, llvm::StringRef getter) const;
+    // the recorded setter, or `setFoo:` for properties no summary describes
+    std::string setterSel(llvm::StringRef cls, llvm::StringRef getter) const;
+};
+
+// Whole-program merge of shards written with -summary (--resolve). The class
+// hierarchies and protocol conformances of every TU are joined into one graph
+// and each candidate is resolved against it once. A candidate can't be direct
+// when its selector is used dynamically anywhere (`@selector`, sends to `id`,
+// `Class` or `id<Protocol>`), when a superclass or subclass declares or
+// implements the same method, when a class of its hierarchy adopts a protocol
+// requiring it, or when a TU marked its name undirectable. Selectors a TU only
+// marked because some protocol declares them no longer count, so candidates
+// whose hierarchy adopts none of those protocols survive. Shards without a
+// summary fall back to their selector sets. Written like MergeState.
+//
+// The same graph tells which implemented methods are never referenced: no
+// `@selector` or dynamic send of their selector, and no static reference to
+// the selector on a class of their hierarchy.
+class ProgramResolver {
+    struct ClassNode {
+        std::string super;
+    };
+    llvm::StringMap<ClassNode> classes;
+    PropertySetters setters;
+    // signed selector : classes declaring or implementing it
+    llvm::StringMap<llvm::StringSet<>> classesByMeth;
+    // signed selector : protocols requiring it
+    llvm::StringMap<llvm::StringSet<>> protocolsByMeth;
+    // protocol : protocols inheriting from it
+    llvm::StringMap<llvm::StringSet<>> inheritedBy;
+    // protocol : classes adopting it
+    llvm::StringMap<llvm::StringSet<>> adopters;
+    llvm::StringSet<> dynamicSels;
+    llvm::StringSet<> undirectableNames;
+    std::map<std::string, std::set<MergeState::MethRecord>, std::less<>> candidates;
+    // class : signed selectors implemented
+    llvm::StringMap<llvm::StringSet<>> implemented;
+    // signed selector : classes it is statically referenced on
+    llvm::StringMap<llvm::StringSet<>> staticRefs;
+    // a shard without summary, whose references are unknown
+    bool missingSummaries = false;
+
+    bool isAncestor(llvm::StringRef ancestor, llvm::StringRef cls) const;
+    bool isRelated(llvm::StringRef a, llvm::StringRef b) const;
+    bool isRedeclared(llvm::StringRef cls, llvm::StringRef signedSel) const;
+    bool isMethodUndirectable(llvm::StringRef cls, llvm::StringRef signedSel) const;
+    bool survives(const MergeState::MethRecord &record) const;
+    bool isReferenced(llvm::StringRef cls, llvm::StringRef signedSel) const;
+public:
+    // shards can be added in any order
+    void add(const DirectableShard &shard);
+
+    // returns the number of entries written
+    size_t write(llvm::raw_ostream &out) const;
+    // the entries write() writes, in the same order
+    void forEachSurvivor(llvm::function_ref<void(DirectableMeth &)> visit) const;
+    const PropertySetters &propertySetters() const { return setters; }
+    // a superclass or subclass declares the method, or the setter of its property, too
+    bool isOverride(const DirectableMeth &meth) const;
+
+    // `-[Class sel]` of every unreferenced method, one per line in name order,
+    // returns their number
+    size_t writeUnreferenced(llvm::raw_ostream &out) const;
+    // only complete when every shard has a summary
+    bool hasMissingSummaries() const { return missingSummaries; }
+};
+
+#endif
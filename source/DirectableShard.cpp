@@ -0,0 +1,885 @@
+//
+//  DirectableShard.cpp
+//  DirectableFinder
+//
+
+#include "DirectableShard.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Compression.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/LEB128.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace std;
+using namespace llvm::json;
+
+static Array stringsToJSON(const vector<string> &strings) {
+    Array array;
+    for (auto &str : strings) {
+        array.push_back(Value(str));
+    }
+    return array;
+}
+
+static Object summaryToJSON(const DirectableSummary &summary) {
+    Array classes;
+    for (auto &clz : summary.classes) {
+        Object obj;
+        obj.insert({"name", clz.name});
+        obj.insert({"super", clz.super});
+        obj.insert({"protocols", stringsToJSON(clz.protocols)});
+        obj.insert({"categories", stringsToJSON(clz.categories)});
+        obj.insert({"properties", stringsToJSON(clz.properties)});
+        obj.insert({"declared", stringsToJSON(clz.declared)});
+        obj.insert({"implemented", stringsToJSON(clz.implemented)});
+        classes.push_back(Value(move(obj)));
+    }
+
+    Array protocols;
+    for (auto &protocol : summary.protocols) {
+        Object obj;
+        obj.insert({"name", protocol.name});
+        obj.insert({"inherits", stringsToJSON(protocol.inherits)});
+        obj.insert({"meths", stringsToJSON(protocol.meths)});
+        protocols.push_back(Value(move(obj)));
+    }
+
+    Object root;
+    root.insert({"classes", move(classes)});
+    root.insert({"protocols", move(protocols)});
+    root.insert({"selector_refs", stringsToJSON(summary.selectorRefs)});
+    root.insert({"dynamic_sends", stringsToJSON(summary.dynamicSends)});
+    root.insert({"static_refs", stringsToJSON(summary.staticRefs)});
+    return root;
+}
+
+static bool stringsFromJSON(const Object &obj, llvm::StringRef key, vector<string> &out) {
+    auto array = obj.getArray(key);
+    if (!array) return false;
+    for (auto &value : *array) {
+        auto str = value.getAsString();
+        if (!str) return false;
+        out.push_back(str->str());
+    }
+    return true;
+}
+
+static bool summaryFromJSON(const Value &value, DirectableSummary &summary) {
+    auto root = value.getAsObject();
+    if (!root) return false;
+    auto classes = root->getArray("classes");
+    auto protocols = root->getArray("protocols");
+    if (!classes || !protocols) return false;
+
+    for (auto &element : *classes) {
+        auto obj = element.getAsObject();
+        if (!obj) return false;
+        SummaryClass clz;
+        auto name = obj->getString("name");
+        auto super = obj->getString("super");
+        if (!name || !super) return false;
+        clz.name = name->str();
+        clz.super = super->str();
+        if (!stringsFromJSON(*obj, "protocols", clz.protocols) || !stringsFromJSON(*obj, "categories", clz.categories)
+            || !stringsFromJSON(*obj, "properties", clz.properties) || !stringsFromJSON(*obj, "declared", clz.declared)
+            || !stringsFromJSON(*obj, "implemented", clz.implemented)) return false;
+        summary.classes.push_back(move(clz));
+    }
+
+    for (auto &element : *protocols) {
+        auto obj = element.getAsObject();
+        if (!obj) return false;
+        SummaryProtocol protocol;
+        auto name = obj->getString("name");
+        if (!name) return false;
+        protocol.name = name->str();
+        if (!stringsFromJSON(*obj, "inherits", protocol.inherits) || !stringsFromJSON(*obj, "meths", protocol.meths)) return false;
+        summary.protocols.push_back(move(protocol));
+    }
+    if (!stringsFromJSON(*root, "selector_refs", summary.selectorRefs) || !stringsFromJSON(*root, "dynamic_sends", summary.dynamicSends)) return false;
+    // missing in shards written before it was recorded
+    return !root->get("static_refs") || stringsFromJSON(*root, "static_refs", summary.staticRefs);
+}
+
+static bool sendsFromJSON(const Value &value, ShardVisitor &visitor) {
+    auto sends = value.getAsArray();
+    if (!sends) return false;
+    vector<llvm::StringRef> sites;
+    for (auto &element : *sends) {
+        auto obj = element.getAsObject();
+        auto name = obj ? obj->getString("name") : llvm::None;
+        auto siteArray = obj ? obj->getArray("sites") : nullptr;
+        if (!name || !siteArray) return false;
+        sites.clear();
+        for (auto &site : *siteArray) {
+            auto str = site.getAsString();
+            if (!str) return false;
+            sites.push_back(*str);
+        }
+        visitor.visitSends(*name, sites);
+    }
+    return true;
+}
+
+string shardToJSON(const DirectableShard &shard) {
+    Array selArray = Array();
+    for (auto &sel : shard.sels) {
+        selArray.push_back(Value(sel));
+    }
+
+    Array overrideArray = Array();
+    for (auto &name : shard.undirectMeths) {
+        overrideArray.push_back(Value(name));
+    }
+
+    Array methArray = Array();
+    for (auto &meth : shard.meths) {
+        Object methInfoObj = Object();
+        methInfoObj.insert({"name", meth.name});
+        methInfoObj.insert({"sel", meth.sel});
+        methInfoObj.insert({"loc", meth.loc});
+        methInfoObj.insert({"isPropertyAccessor", meth.isPropertyAccessor});
+        methArray.push_back(Value(Object(methInfoObj)));
+    }
+
+    Object root = Object();
+    root.insert({"sels", Array(selArray)});
+    root.insert({"meths", Array(methArray)});
+    root.insert({"undirect_meths", Array(overrideArray)});
+    if (shard.hasSummary) {
+        root.insert({"summary", summaryToJSON(shard.summary)});
+    }
+    if (!shard.sends.empty()) {
+        Array sends;
+        for (auto &send : shard.sends) {
+            Object obj;
+            obj.insert({"name", send.name});
+            obj.insert({"sites", stringsToJSON(send.sites)});
+            sends.push_back(Value(move(obj)));
+        }
+        root.insert({"sends", move(sends)});
+    }
+    return llvm::formatv("{0:2}", Value(Object(root)));
+}
+
+static llvm::Error shardError(const llvm::Twine &message) {
+    return llvm::make_error<llvm::StringError>(message, llvm::inconvertibleErrorCode());
+}
+
+namespace {
+
+// Minimal JSON reader for the shard layout. Strings are decoded only when a
+// visitor asks for them, everything else is skipped.
+class ShardScanner {
+    const char *cursor;
+    const char *end;
+    llvm::StringRef failure;
+
+    bool fail(llvm::StringRef message) {
+        if (failure.empty()) failure = message;
+        cursor = end;
+        return false;
+    }
+
+    void skipSpace() {
+        while (cursor != end && (*cursor == ' ' || *cursor == '\n' || *cursor == '\r' || *cursor == '\t')) cursor++;
+    }
+
+    bool consume(char c) {
+        skipSpace();
+        if (cursor == end || *cursor != c) return false;
+        cursor++;
+        return true;
+    }
+
+    bool expect(char c) {
+        if (consume(c)) return true;
+        return fail("unexpected character");
+    }
+
+    bool consumeLiteral(llvm::StringRef literal) {
+        if (llvm::StringRef(cursor, end - cursor).startswith(literal)) {
+            cursor += literal.size();
+            return true;
+        }
+        return false;
+    }
+
+    static void appendUTF8(string &out, uint32_t codePoint) {
+        if (codePoint < 0x80) {
+            out += (char)codePoint;
+        } else if (codePoint < 0x800) {
+            out += (char)(0xc0 | (codePoint >> 6));
+            out += (char)(0x80 | (codePoint & 0x3f));
+        } else if (codePoint < 0x10000) {
+            out += (char)(0xe0 | (codePoint >> 12));
+            out += (char)(0x80 | ((codePoint >> 6) & 0x3f));
+            out += (char)(0x80 | (codePoint & 0x3f));
+        } else {
+            out += (char)(0xf0 | (codePoint >> 18));
+            out += (char)(0x80 | ((codePoint >> 12) & 0x3f));
+            out += (char)(0x80 | ((codePoint >> 6) & 0x3f));
+            out += (char)(0x80 | (codePoint & 0x3f));
+        }
+    }
+
+    bool readHex4(uint32_t &value) {
+        if (end - cursor < 4) return fail("truncated \\u escape");
+        value = 0;
+        for (int i = 0; i < 4; i++) {
+            char c = *cursor++;
+            unsigned digit;
+            if (c >= '0' && c <= '9') digit = c - '0';
+            else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+            else return fail("invalid \\u escape");
+            value = value * 16 + digit;
+        }
+        return true;
+    }
+
+public:
+    ShardScanner(llvm::StringRef content) : cursor(content.begin()), end(content.end()) {}
+
+    llvm::Error error() const {
+        if (failure.empty()) return llvm::Error::success();
+        return shardError(failure);
+    }
+
+    // `out` points into the content or, for escaped strings, into `scratch`
+    bool readString(llvm::StringRef &out, string &scratch) {
+        if (!expect('"')) return false;
+        const char *begin = cursor;
+        while (cursor != end && *cursor != '"' && *cursor != '\\') cursor++;
+        if (cursor == end) return fail("unterminated string");
+        if (*cursor == '"') {
+            out = llvm::StringRef(begin, cursor - begin);
+            cursor++;
+            return true;
+        }
+
+        scratch.assign(begin, cursor - begin);
+        while (cursor != end && *cursor != '"') {
+            if (*cursor != '\\') {
+                scratch += *cursor++;
+                continue;
+            }
+            if (++cursor == end) break;
+            char c = *cursor++;
+            switch (c) {
+            case '"': scratch += '"'; break;
+            case '\\': scratch += '\\'; break;
+            case '/': scratch += '/'; break;
+            case 'b': scratch += '\b'; break;
+            case 'f': scratch += '\f'; break;
+            case 'n': scratch += '\n'; break;
+            case 'r': scratch += '\r'; break;
+            case 't': scratch += '\t'; break;
+            case 'u': {
+                uint32_t unit;
+                if (!readHex4(unit)) return false;
+                if (unit >= 0xd800 && unit < 0xdc00 && consumeLiteral("\\u")) {
+                    uint32_t low;
+                    if (!readHex4(low)) return false;
+                    if (low >= 0xdc00 && low < 0xe000) {
+                        unit = 0x10000 + ((unit - 0xd800) << 10) + (low - 0xdc00);
+                    } else {
+                        appendUTF8(scratch, unit);
+                        unit = low;
+                    }
+                }
+                appendUTF8(scratch, unit);
+                break;
+            }
+            default:
+                return fail("invalid escape");
+            }
+        }
+        if (cursor == end) return fail("unterminated string");
+        cursor++;
+        out = scratch;
+        return true;
+    }
+
+    bool skipString() {
+        if (!expect('"')) return false;
+        while (cursor != end && *cursor != '"') {
+            if (*cursor == '\\' && cursor + 1 != end) cursor++;
+            cursor++;
+        }
+        if (cursor == end) return fail("unterminated string");
+        cursor++;
+        return true;
+    }
+
+    bool readBool(bool &value) {
+        skipSpace();
+        if (consumeLiteral("true")) {
+            value = true;
+            return true;
+        }
+        if (consumeLiteral("false")) {
+            value = false;
+            return true;
+        }
+        return fail("expected a boolean");
+    }
+
+    bool skipValue() {
+        skipSpace();
+        if (cursor == end) return fail("unexpected end");
+        switch (*cursor) {
+        case '"':
+            return skipString();
+        case '{':
+        case '[': {
+            // strings are skipped as a whole, so brackets inside them don't count
+            int depth = 0;
+            do {
+                skipSpace();
+                if (cursor == end) return fail("unexpected end");
+                char c = *cursor;
+                if (c == '"') {
+                    if (!skipString()) return false;
+                    continue;
+                }
+                if (c == '{' || c == '[') depth++;
+                if (c == '}' || c == ']') depth--;
+                cursor++;
+            } while (depth > 0);
+            return true;
+        }
+        default:
+            while (cursor != end && *cursor != ',' && *cursor != '}' && *cursor != ']' && *cursor != ' ' && *cursor != '\n') cursor++;
+            return true;
+        }
+    }
+
+    // the text of the next value, for the parts handed to llvm::json
+    bool readRawValue(llvm::StringRef &raw) {
+        skipSpace();
+        const char *begin = cursor;
+        if (!skipValue()) return false;
+        raw = llvm::StringRef(begin, cursor - begin);
+        return true;
+    }
+
+    // calls `element` once per element, the callback consumes it
+    template <typename Fn> bool forEachElement(Fn element) {
+        if (!expect('[')) return false;
+        if (consume(']')) return true;
+        do {
+            if (!element()) return false;
+        } while (consume(','));
+        return expect(']');
+    }
+
+    template <typename Fn> bool forEachMember(Fn member) {
+        if (!expect('{')) return false;
+        if (consume('}')) return true;
+        string keyScratch;
+        do {
+            llvm::StringRef key;
+            if (!readString(key, keyScratch) || !expect(':')) return false;
+            if (!member(key)) return false;
+        } while (consume(','));
+        return expect('}');
+    }
+
+    bool atEnd() {
+        skipSpace();
+        return cursor == end;
+    }
+};
+
+} // end anonymous namespace
+
+llvm::Error scanShardJSON(llvm::StringRef content, ShardVisitor &visitor) {
+    ShardScanner scanner(content);
+    string scratch;
+    auto strings = [&](void (ShardVisitor::*visit)(llvm::StringRef)) {
+        return scanner.forEachElement([&] {
+            llvm::StringRef str;
+            if (!scanner.readString(str, scratch)) return false;
+            (visitor.*visit)(str);
+            return true;
+        });
+    };
+
+    string nameScratch, selScratch, locScratch;
+    auto meth = [&] {
+        DirectableMethRef ref;
+        bool hasName = false, hasSel = false, hasLoc = false, hasAccessor = false;
+        bool ok = scanner.forEachMember([&](llvm::StringRef key) {
+            if (key == "name") return hasName = scanner.readString(ref.name, nameScratch);
+            if (key == "sel") return hasSel = scanner.readString(ref.sel, selScratch);
+            if (key == "loc") return hasLoc = scanner.readString(ref.loc, locScratch);
+            if (key == "isPropertyAccessor") return hasAccessor = scanner.readBool(ref.isPropertyAccessor);
+            return scanner.skipValue();
+        });
+        if (!ok) return false;
+        if (!hasName || !hasSel || !hasLoc || !hasAccessor) return false;
+        visitor.visitMeth(ref);
+        return true;
+    };
+
+    bool hasSels = false, hasMeths = false, hasUndirectMeths = false;
+    llvm::Error sectionError = llvm::Error::success();
+    bool ok = scanner.forEachMember([&](llvm::StringRef key) {
+        if (key == "sels") {
+            hasSels = true;
+            return visitor.wantsUndirectables() ? strings(&ShardVisitor::visitSel) : scanner.skipValue();
+        }
+        if (key == "undirect_meths") {
+            hasUndirectMeths = true;
+            return visitor.wantsUndirectables() ? strings(&ShardVisitor::visitUndirectMeth) : scanner.skipValue();
+        }
+        if (key == "meths") {
+            hasMeths = true;
+            return visitor.wantsMeths() ? scanner.forEachElement(meth) : scanner.skipValue();
+        }
+        if (key == "summary" && visitor.wantsSummary()) {
+            llvm::StringRef raw;
+            if (!scanner.readRawValue(raw)) return false;
+            auto value = llvm::json::parse(raw);
+            if (!value) {
+                sectionError = value.takeError();
+                return false;
+            }
+            DirectableSummary summary;
+            if (!summaryFromJSON(*value, summary)) {
+                sectionError = shardError("malformed \"summary\"");
+                return false;
+            }
+            visitor.visitSummary(summary);
+            return true;
+        }
+        if (key == "sends" && visitor.wantsSends()) {
+            llvm::StringRef raw;
+            if (!scanner.readRawValue(raw)) return false;
+            auto value = llvm::json::parse(raw);
+            if (!value) {
+                sectionError = value.takeError();
+                return false;
+            }
+            if (!sendsFromJSON(*value, visitor)) {
+                sectionError = shardError("malformed \"sends\"");
+                return false;
+            }
+            return true;
+        }
+        return scanner.skipValue();
+    });
+    if (sectionError) return sectionError;
+    if (auto err = scanner.error()) return err;
+    if (!ok) return shardError("incomplete element in \"meths\"");
+    if (!scanner.atEnd()) return shardError("trailing data");
+    if (!hasSels || !hasMeths || !hasUndirectMeths) return shardError("missing \"sels\", \"meths\" or \"undirect_meths\"");
+    return llvm::Error::success();
+}
+
+llvm::Error scanMergedResultJSON(llvm::StringRef content, llvm::function_ref<void(const DirectableMethRef &)> visit) {
+    ShardScanner scanner(content);
+    string nameScratch, selScratch, locScratch;
+    bool ok = scanner.forEachMember([&](llvm::StringRef key) {
+        DirectableMethRef ref;
+        ref.loc = key;
+        bool hasName = false, hasSel = false, hasAccessor = false;
+        bool ok = scanner.forEachMember([&](llvm::StringRef field) {
+            if (field == "name") return hasName = scanner.readString(ref.name, nameScratch);
+            if (field == "sel") return hasSel = scanner.readString(ref.sel, selScratch);
+            if (field == "loc") return scanner.readString(ref.loc, locScratch);
+            if (field == "isPropertyAccessor") return hasAccessor = scanner.readBool(ref.isPropertyAccessor);
+            return scanner.skipValue();
+        });
+        if (!ok || !hasName || !hasSel || !hasAccessor) return false;
+        visit(ref);
+        return true;
+    });
+    if (auto err = scanner.error()) return err;
+    if (!ok) return shardError("malformed merged result entry");
+    if (!scanner.atEnd()) return shardError("trailing data");
+    return llvm::Error::success();
+}
+
+namespace {
+
+class ShardCollector : public ShardVisitor {
+public:
+    DirectableShard shard;
+
+    void visitSel(llvm::StringRef sel) override {
+        shard.sels.push_back(sel.str());
+    }
+
+    void visitUndirectMeth(llvm::StringRef name) override {
+        shard.undirectMeths.push_back(name.str());
+    }
+
+    void visitMeth(const DirectableMethRef &ref) override {
+        DirectableMeth meth;
+        meth.name = ref.name.str();
+        meth.sel = ref.sel.str();
+        meth.loc = ref.loc.str();
+        meth.isPropertyAccessor = ref.isPropertyAccessor;
+        shard.meths.push_back(move(meth));
+    }
+
+    bool wantsSummary() const override { return true; }
+    void visitSummary(const DirectableSummary &summary) override {
+        shard.hasSummary = true;
+        shard.summary = summary;
+    }
+
+    bool wantsSends() const override { return true; }
+    void visitSends(llvm::StringRef name, llvm::ArrayRef<llvm::StringRef> sites) override {
+        DirectableSends sends;
+        sends.name = name.str();
+        for (auto site : sites) {
+            sends.sites.push_back(site.str());
+        }
+        shard.sends.push_back(move(sends));
+    }
+};
+
+} // end anonymous namespace
+
+llvm::Expected<DirectableShard> shardFromJSON(llvm::StringRef content) {
+    ShardCollector collector;
+    if (auto err = scanShardJSON(content, collector)) return {move(err)};
+    return move(collector.shard);
+}
+
+llvm::Expected<DirectableShard> readShard(llvm::StringRef content) {
+    ShardCollector collector;
+    if (auto err = scanShard(content, collector)) return {move(err)};
+    return move(collector.shard);
+}
+
+static const llvm::StringRef ShardMagic("DFSH", 4);
+
+bool isBinaryShard(llvm::StringRef content) {
+    return content.startswith(ShardMagic);
+}
+
+namespace {
+
+// interns strings in first-use order
+class ShardStringTable {
+    llvm::StringMap<uint64_t> ids;
+    vector<llvm::StringRef> strings;
+public:
+    uint64_t operator()(llvm::StringRef str) {
+        auto inserted = ids.insert({str, strings.size()});
+        if (inserted.second) strings.push_back(inserted.first->first());
+        return inserted.first->second;
+    }
+    const vector<llvm::StringRef> &all() const { return strings; }
+};
+
+void writeSection(llvm::raw_ostream &out, ShardSection tag, llvm::StringRef body) {
+    llvm::encodeULEB128(tag, out);
+    llvm::encodeULEB128(body.size(), out);
+    out << body;
+}
+
+class ByteReader {
+    const uint8_t *cursor;
+    const uint8_t *end;
+public:
+    bool failed = false;
+
+    ByteReader(llvm::StringRef bytes) : cursor(bytes.bytes_begin()), end(bytes.bytes_end()) {}
+
+    bool atEnd() const { return cursor == end; }
+    llvm::StringRef rest() const { return llvm::StringRef((const char *)cursor, end - cursor); }
+
+    uint64_t uleb() {
+        unsigned size = 0;
+        const char *error = nullptr;
+        uint64_t value = llvm::decodeULEB128(cursor, &size, end, &error);
+        if (error) {
+            failed = true;
+            cursor = end;
+            return 0;
+        }
+        cursor += size;
+        return value;
+    }
+
+    llvm::StringRef bytes(uint64_t size) {
+        if (size > uint64_t(end - cursor)) {
+            failed = true;
+            cursor = end;
+            return llvm::StringRef();
+        }
+        llvm::StringRef result((const char *)cursor, size);
+        cursor += size;
+        return result;
+    }
+};
+
+} // end anonymous namespace
+
+string shardToBinary(const DirectableShard &shard, bool compress) {
+    ShardStringTable table;
+    string sels, undirectMeths, meths;
+    {
+        llvm::raw_string_ostream out(sels);
+        llvm::encodeULEB128(shard.sels.size(), out);
+        for (auto &sel : shard.sels) {
+            llvm::encodeULEB128(table(sel), out);
+        }
+    }
+    {
+        llvm::raw_string_ostream out(undirectMeths);
+        llvm::encodeULEB128(shard.undirectMeths.size(), out);
+        for (auto &name : shard.undirectMeths) {
+            llvm::encodeULEB128(table(name), out);
+        }
+    }
+    {
+        llvm::raw_string_ostream out(meths);
+        llvm::encodeULEB128(shard.meths.size(), out);
+        for (auto &meth : shard.meths) {
+            llvm::encodeULEB128(table(meth.name), out);
+            llvm::encodeULEB128(table(meth.sel), out);
+            llvm::encodeULEB128(table(meth.loc), out);
+            llvm::encodeULEB128(meth.isPropertyAccessor, out);
+        }
+    }
+
+    string summary;
+    if (shard.hasSummary) {
+        llvm::raw_string_ostream out(summary);
+        auto list = [&](const vector<string> &strs) {
+            llvm::encodeULEB128(strs.size(), out);
+            for (auto &str : strs) {
+                llvm::encodeULEB128(table(str), out);
+            }
+        };
+        llvm::encodeULEB128(shard.summary.classes.size(), out);
+        for (auto &clz : shard.summary.classes) {
+            llvm::encodeULEB128(table(clz.name), out);
+            llvm::encodeULEB128(table(clz.super), out);
+            list(clz.protocols);
+            list(clz.categories);
+            list(clz.properties);
+            list(clz.declared);
+            list(clz.implemented);
+        }
+        llvm::encodeULEB128(shard.summary.protocols.size(), out);
+        for (auto &protocol : shard.summary.protocols) {
+            llvm::encodeULEB128(table(protocol.name), out);
+            list(protocol.inherits);
+            list(protocol.meths);
+        }
+        list(shard.summary.selectorRefs);
+        list(shard.summary.dynamicSends);
+        list(shard.summary.staticRefs);
+    }
+
+    string sends;
+    if (!shard.sends.empty()) {
+        llvm::raw_string_ostream out(sends);
+        llvm::encodeULEB128(shard.sends.size(), out);
+        for (auto &send : shard.sends) {
+            llvm::encodeULEB128(table(send.name), out);
+            llvm::encodeULEB128(send.sites.size(), out);
+            for (auto &site : send.sites) {
+                llvm::encodeULEB128(table(site), out);
+            }
+        }
+    }
+
+    string strings;
+    {
+        llvm::raw_string_ostream out(strings);
+        llvm::encodeULEB128(table.all().size(), out);
+        for (auto str : table.all()) {
+            llvm::encodeULEB128(str.size(), out);
+            out << str;
+        }
+    }
+
+    string payload;
+    {
+        llvm::raw_string_ostream out(payload);
+        writeSection(out, ShardStringsSection, strings);
+        writeSection(out, ShardSelsSection, sels);
+        writeSection(out, ShardUndirectMethsSection, undirectMeths);
+        writeSection(out, ShardMethsSection, meths);
+        if (shard.hasSummary) {
+            writeSection(out, ShardSummarySection, summary);
+        }
+        if (!shard.sends.empty()) {
+            writeSection(out, ShardSendsSection, sends);
+        }
+    }
+
+    uint64_t flags = 0;
+    llvm::SmallVector<char, 0> compressed;
+    if (compress && llvm::zlib::isAvailable()) {
+        if (auto err = llvm::zlib::compress(payload, compressed)) {
+            llvm::consumeError(move(err));
+        } else {
+            flags |= ShardCompressedZlib;
+        }
+    }
+
+    string content;
+    llvm::raw_string_ostream out(content);
+    out << ShardMagic;
+    llvm::encodeULEB128(ShardBinaryVersion, out);
+    llvm::encodeULEB128(flags, out);
+    llvm::encodeULEB128(payload.size(), out);
+    if (flags & ShardCompressedZlib) {
+        out << llvm::StringRef(compressed.data(), compressed.size());
+    } else {
+        out << payload;
+    }
+    out.flush();
+    return content;
+}
+
+llvm::Error scanShardBinary(llvm::StringRef content, ShardVisitor &visitor) {
+    if (!isBinaryShard(content)) return shardError("not a binary shard");
+    ByteReader header(content.drop_front(ShardMagic.size()));
+    uint64_t version = header.uleb();
+    uint64_t flags = header.uleb();
+    uint64_t payloadSize = header.uleb();
+    if (header.failed) return shardError("truncated shard header");
+    if (version > ShardBinaryVersion) return shardError("unsupported shard version " + llvm::Twine(version));
+
+    llvm::StringRef payload = header.rest();
+    llvm::SmallVector<char, 0> inflated;
+    if (flags & ShardCompressedZlib) {
+        if (!llvm::zlib::isAvailable()) return shardError("zlib compressed shard, but zlib isn't available");
+        if (auto err = llvm::zlib::uncompress(payload, inflated, payloadSize)) return err;
+        payload = llvm::StringRef(inflated.data(), inflated.size());
+    }
+
+    vector<llvm::StringRef> strings;
+    bool failed = false;
+    auto stringAt = [&](ByteReader &reader) {
+        uint64_t id = reader.uleb();
+        if (id >= strings.size()) {
+            failed = true;
+            return llvm::StringRef();
+        }
+        return strings[id];
+    };
+
+    ByteReader sections(payload);
+    while (!sections.atEnd() && !sections.failed && !failed) {
+        uint64_t tag = sections.uleb();
+        ByteReader body(sections.bytes(sections.uleb()));
+        if (sections.failed) break;
+
+        switch (tag) {
+        case ShardStringsSection: {
+            uint64_t count = body.uleb();
+            for (uint64_t i = 0; i < count && !body.failed; i++) {
+                strings.push_back(body.bytes(body.uleb()));
+            }
+            break;
+        }
+        case ShardSelsSection:
+        case ShardUndirectMethsSection: {
+            if (!visitor.wantsUndirectables()) break;
+            uint64_t count = body.uleb();
+            for (uint64_t i = 0; i < count && !body.failed && !failed; i++) {
+                auto str = stringAt(body);
+                if (failed || body.failed) break;
+                if (tag == ShardSelsSection) {
+                    visitor.visitSel(str);
+                } else {
+                    visitor.visitUndirectMeth(str);
+                }
+            }
+            break;
+        }
+        case ShardMethsSection: {
+            if (!visitor.wantsMeths()) break;
+            uint64_t count = body.uleb();
+            for (uint64_t i = 0; i < count && !body.failed && !failed; i++) {
+                DirectableMethRef meth;
+                meth.name = stringAt(body);
+                meth.sel = stringAt(body);
+                meth.loc = stringAt(body);
+                meth.isPropertyAccessor = body.uleb();
+                if (failed || body.failed) break;
+                visitor.visitMeth(meth);
+            }
+            break;
+        }
+        case ShardSummarySection: {
+            if (!visitor.wantsSummary()) break;
+            DirectableSummary summary;
+            auto list = [&](vector<string> &strs) {
+                uint64_t count = body.uleb();
+                for (uint64_t i = 0; i < count && !body.failed && !failed; i++) {
+                    strs.push_back(stringAt(body).str());
+                }
+            };
+            uint64_t classCount = body.uleb();
+            for (uint64_t i = 0; i < classCount && !body.failed && !failed; i++) {
+                SummaryClass clz;
+                clz.name = stringAt(body).str();
+                clz.super = stringAt(body).str();
+                list(clz.protocols);
+                list(clz.categories);
+                list(clz.properties);
+                list(clz.declared);
+                list(clz.implemented);
+                summary.classes.push_back(move(clz));
+            }
+            uint64_t protocolCount = body.uleb();
+            for (uint64_t i = 0; i < protocolCount && !body.failed && !failed; i++) {
+                SummaryProtocol protocol;
+                protocol.name = stringAt(body).str();
+                list(protocol.inherits);
+                list(protocol.meths);
+                summary.protocols.push_back(move(protocol));
+            }
+            list(summary.selectorRefs);
+            list(summary.dynamicSends);
+            // missing in shards written before it was recorded
+            if (!body.atEnd()) list(summary.staticRefs);
+            if (failed || body.failed) break;
+            visitor.visitSummary(summary);
+            break;
+        }
+        case ShardSendsSection: {
+            if (!visitor.wantsSends()) break;
+            vector<llvm::StringRef> sites;
+            uint64_t count = body.uleb();
+            for (uint64_t i = 0; i < count && !body.failed && !failed; i++) {
+                auto name = stringAt(body);
+                uint64_t siteCount = body.uleb();
+                sites.clear();
+                for (uint64_t j = 0; j < siteCount && !body.failed && !failed; j++) {
+                    sites.push_back(stringAt(body));
+                }
+                if (failed || body.failed) break;
+                visitor.visitSends(name, sites);
+            }
+            break;
+        }
+        default:
+            // newer section, skipped
+            break;
+        }
+        failed = failed || body.failed;
+    }
+    if (sections.failed || failed) return shardError("corrupt binary shard");
+    return llvm::Error::success();
+}
+
+llvm::Error scanShard(llvm::StringRef content, ShardVisitor &visitor) {
+    if (isBinaryShard(content)) return scanShardBinary(content, visitor);
+    return scanShardJSON(content, visitor);
+}
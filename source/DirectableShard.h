@@ -0,0 +1,154 @@
+//
+//  DirectableShard.h
+//  DirectableFinder
+//
+
+#ifndef DIRECTABLE_SHARD_H
+#define DIRECTABLE_SHARD_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include <string>
+#include <vector>
+
+struct DirectableMeth {
+    std::string name;
+    std::string sel;
+    std::string loc;
+    bool isPropertyAccessor = false;
+};
+
+// Program facts a TU saw, written with -summary and resolved across the whole
+// program by `objc-direct-merge --resolve`. Methods are signed selectors,
+// `-sel` or `+sel`.
+struct SummaryClass {
+    std::string name;
+    // empty for root classes
+    std::string super;
+    // adopted by the class, its extensions and categories
+    std::vector<std::string> protocols;
+    std::vector<std::string> categories;
+    // `getter` or `getter setter:` of every property
+    std::vector<std::string> properties;
+    // declared by the interface, its extensions and categories
+    std::vector<std::string> declared;
+    // implemented by the TU
+    std::vector<std::string> implemented;
+};
+
+struct SummaryProtocol {
+    std::string name;
+    std::vector<std::string> inherits;
+    std::vector<std::string> meths;
+};
+
+struct DirectableSummary {
+    std::vector<SummaryClass> classes;
+    std::vector<SummaryProtocol> protocols;
+    // `@selector(sel)`
+    std::vector<std::string> selectorRefs;
+    // selectors sent to `id`, `Class` and `id<Protocol>` receivers
+    std::vector<std::string> dynamicSends;
+    // `-[Class sel]` of sends to receivers of a known class, and of implemented
+    // methods something outside the sources calls: overrides of system
+    // declarations, IBActions, synthesized accessors
+    std::vector<std::string> staticRefs;
+};
+
+// Static send sites of a method, written with -send-counts. Sends to a
+// property's setter count for its getter, the name candidates have.
+struct DirectableSends {
+    // `-[Class(Category) sel]`
+    std::string name;
+    // loc of every send
+    std::vector<std::string> sites;
+};
+
+// Analysis result of a single TU, what used to be one json file
+struct DirectableShard {
+    // selectors that can't be direct
+    std::vector<std::string> sels;
+    // candidates
+    std::vector<DirectableMeth> meths;
+    // readable names, `-[Class(Category) sel]`, that can't be direct
+    std::vector<std::string> undirectMeths;
+    // only with -summary
+    bool hasSummary = false;
+    DirectableSummary summary;
+    // only with -send-counts
+    std::vector<DirectableSends> sends;
+};
+
+// A candidate read from a shard, only valid during the visitor call
+struct DirectableMethRef {
+    llvm::StringRef name;
+    llvm::StringRef sel;
+    llvm::StringRef loc;
+    bool isPropertyAccessor = false;
+};
+
+// Receives a shard's records while it is scanned, without building the shard
+class ShardVisitor {
+public:
+    virtual ~ShardVisitor() = default;
+    // sections the visitor doesn't want are skipped without decoding
+    virtual bool wantsUndirectables() const { return true; }
+    virtual bool wantsMeths() const { return true; }
+    virtual bool wantsSummary() const { return false; }
+    virtual bool wantsSends() const { return false; }
+
+    virtual void visitSel(llvm::StringRef) {}
+    virtual void visitUndirectMeth(llvm::StringRef) {}
+    virtual void visitMeth(const DirectableMethRef &) {}
+    // only called for shards that have one
+    virtual void visitSummary(const DirectableSummary &) {}
+    virtual void visitSends(llvm::StringRef, llvm::ArrayRef<llvm::StringRef>) {}
+};
+
+// {"sels": [...], "meths": [...], "undirect_meths": [...]}, the format merge.py reads,
+// plus "summary": {"classes": [...], "protocols": [...], "selector_refs": [...],
+// "dynamic_sends": [...]} when the shard has one and "sends": [{"name": ...,
+// "sites": [...]}, ...] when it has send sites
+std::string shardToJSON(const DirectableShard &shard);
+
+// strings without escapes are handed out zero-copy from `content`
+llvm::Error scanShardJSON(llvm::StringRef content, ShardVisitor &visitor);
+llvm::Expected<DirectableShard> shardFromJSON(llvm::StringRef content);
+
+// merge.py's output, {loc: meth, ...}, scanned like a shard's "meths"
+llvm::Error scanMergedResultJSON(llvm::StringRef content, llvm::function_ref<void(const DirectableMethRef &)> visit);
+
+// Binary shard, `.dfshard`:
+//   "DFSH", uleb128 version, uleb128 flags, uleb128 payload size, payload
+// The payload is zlib compressed when flags has ShardCompressedZlib, and is a
+// sequence of sections, each `uleb128 tag, uleb128 byte size, bytes`, so
+// readers skip sections they don't know. The string table section comes
+// first, every other string is a uleb128 index into it.
+const uint64_t ShardBinaryVersion = 1;
+enum ShardBinaryFlags : uint64_t {
+    ShardCompressedZlib = 1,
+};
+enum ShardSection : uint64_t {
+    ShardStringsSection = 1,       // count, (size, bytes)...
+    ShardSelsSection = 2,          // count, string...
+    ShardUndirectMethsSection = 3, // count, string...
+    ShardMethsSection = 4,         // count, (name, sel, loc, uleb128 isPropertyAccessor)...
+    ShardSummarySection = 5,       // count, (name, super, protocols, categories, properties, declared, implemented)...,
+                                   // count, (name, inherits, meths)..., selectorRefs, dynamicSends[, staticRefs]
+                                   // where every list is count, string...
+    ShardSendsSection = 6,         // count, (name, count, site...)...
+};
+
+bool isBinaryShard(llvm::StringRef content);
+// falls back to an uncompressed shard when zlib isn't available
+std::string shardToBinary(const DirectableShard &shard, bool compress);
+// strings point into `content`, or into the inflated payload of a compressed shard
+llvm::Error scanShardBinary(llvm::StringRef content, ShardVisitor &visitor);
+
+// either format
+llvm::Error scanShard(llvm::StringRef content, ShardVisitor &visitor);
+llvm::Expected<DirectableShard> readShard(llvm::StringRef content);
+
+#endif
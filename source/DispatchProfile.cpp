@@ -0,0 +1,81 @@
+//
+//  DispatchProfile.cpp
+//  DirectableFinder
+//
+
+#include "DispatchProfile.h"
+
+using namespace std;
+using namespace llvm;
+
+// "Foo.m:-[Foo bar]" -> "-[Foo bar]", plain C functions are kept as they are
+static StringRef methodName(StringRef function) {
+    auto start = min(function.find("-["), function.find("+["));
+    if (start == StringRef::npos || !function.endswith("]")) return function;
+    return function.drop_front(start);
+}
+
+static bool isMethodName(StringRef key) {
+    return (key.startswith("-[") || key.startswith("+[")) && key.endswith("]");
+}
+
+Expected<DispatchProfile> DispatchProfile::load(StringRef content) {
+    DispatchProfile profile;
+    // the function of the llvm-profdata block being read
+    StringRef function;
+    unsigned lineNumber = 0;
+    while (!content.empty()) {
+        StringRef line;
+        tie(line, content) = content.split('\n');
+        lineNumber++;
+        line = line.rtrim();
+        auto trimmed = line.ltrim();
+        if (trimmed.empty() || trimmed.startswith("#")) continue;
+
+        // llvm-profdata: "  -[Foo bar]:" then "    Function count: 123"
+        if (trimmed.consume_front("Function count:")) {
+            uint64_t count;
+            if (function.empty() || trimmed.trim().getAsInteger(10, count)) {
+                return make_error<StringError>("malformed profile line " + Twine(lineNumber), inconvertibleErrorCode());
+            }
+            profile.methods[methodName(function)] += count;
+            function = StringRef();
+            continue;
+        }
+        if (line.startswith("  ") && !line.startswith("   ") && line.endswith(":")) {
+            function = trimmed.drop_back();
+            continue;
+        }
+
+        // text: "<count> <name or loc>"
+        StringRef countText, key;
+        tie(countText, key) = trimmed.split(' ');
+        key = key.trim();
+        uint64_t count;
+        if (countText.getAsInteger(10, count)) {
+            // the rest of llvm-profdata's output, "Counters:", "Hash: ..." and the totals
+            continue;
+        }
+        if (key.empty()) {
+            return make_error<StringError>("malformed profile line " + Twine(lineNumber), inconvertibleErrorCode());
+        }
+        if (isMethodName(key)) {
+            profile.methods[key] += count;
+        } else {
+            profile.sites[key] += count;
+        }
+    }
+    return profile;
+}
+
+Optional<uint64_t> DispatchProfile::methodCount(StringRef name) const {
+    auto found = methods.find(name);
+    if (found == methods.end()) return None;
+    return found->second;
+}
+
+Optional<uint64_t> DispatchProfile::siteCount(StringRef loc) const {
+    auto found = sites.find(loc);
+    if (found == sites.end()) return None;
+    return found->second;
+}
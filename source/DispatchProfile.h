@@ -0,0 +1,33 @@
+//
+//  DispatchProfile.h
+//  DirectableFinder
+//
+
+#ifndef DISPATCH_PROFILE_H
+#define DISPATCH_PROFILE_H
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Error.h"
+
+// Execution counts of methods or send sites, from either
+//   llvm-profdata show --all-functions --counts <profdata>
+// whose "  <function>:" blocks carry a "Function count: N" line, or a text
+// file of "<count> <method name or send site loc>" lines, `#` comments.
+// Method names are "-[Foo(Cat) sel]", the file prefix profiles put in front of
+// internal functions ("Foo.m:-[Foo sel]") is dropped; counts of the same name
+// are added up.
+class DispatchProfile {
+public:
+    static llvm::Expected<DispatchProfile> load(llvm::StringRef content);
+
+    // none when the profile doesn't know it
+    llvm::Optional<uint64_t> methodCount(llvm::StringRef name) const;
+    llvm::Optional<uint64_t> siteCount(llvm::StringRef loc) const;
+
+private:
+    llvm::StringMap<uint64_t> methods;
+    llvm::StringMap<uint64_t> sites;
+};
+
+#endif
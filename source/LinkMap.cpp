@@ -0,0 +1,181 @@
+//
+//  LinkMap.cpp
+//  DirectableFinder
+//
+//  ld64 link maps look like
+//
+//    # Arch: arm64
+//    # Sections:
+//    # Address	Size    	Segment	Section
+//    0x100004000	0x00123456	__TEXT	__text
+//    0x1002A0000	0x00004321	__TEXT	__objc_methname
+//    # Symbols:
+//    # Address	Size    	File  Name
+//    0x100004000	0x00000028	[  1] -[Foo bar]
+//    0x1002A0000	0x00000004	[  1] literal string: bar
+//    # Dead Stripped Symbols:
+//    #        	Size    	File  Name
+//    <<dead>> 	0x00000018	[  1] CIE
+//
+
+#include "LinkMap.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+
+using namespace std;
+using namespace llvm;
+
+string linkedMethodName(StringRef name) {
+    auto extension = name.find("() ");
+    if (extension == StringRef::npos) return name.str();
+    return (name.take_front(extension) + name.drop_front(extension + 2)).str();
+}
+
+string setterMethodName(StringRef getterSymbol, StringRef setterSel) {
+    auto selStart = getterSymbol.rfind(' ');
+    if (selStart == StringRef::npos || setterSel.empty()) return string();
+    return (getterSymbol.take_front(selStart + 1) + setterSel + "]").str();
+}
+
+// selector of a "-[Foo(Cat) sel]" symbol
+static StringRef symbolSel(StringRef symbol) {
+    if (!symbol.endswith("]")) return StringRef();
+    auto selStart = symbol.rfind(' ');
+    if (selStart == StringRef::npos) return StringRef();
+    return symbol.slice(selStart + 1, symbol.size() - 1);
+}
+
+string LinkMapEstimator::setterSymbol(const DirectableMeth &candidate, StringRef symbol) const {
+    return setterMethodName(symbol, setters.setterSel(methodClassName(candidate.name), candidate.sel));
+}
+
+LinkMapEstimator::LinkMapEstimator(const vector<DirectableMeth> &candidates, const PropertySetters &s) : setters(s) {
+    for (auto &candidate : candidates) {
+        auto symbol = linkedMethodName(candidate.name);
+        wantedSymbols.insert(symbol);
+        implementations.insert({candidate.sel, 0});
+        if (candidate.isPropertyAccessor) {
+            auto setter = setterSymbol(candidate, symbol);
+            if (setter.empty()) continue;
+            wantedSymbols.insert(setter);
+            implementations.insert({symbolSel(setter), 0});
+        }
+    }
+}
+
+static bool parseHex(StringRef token, uint64_t &value) {
+    return token.consume_front("0x") && !token.getAsInteger(16, value);
+}
+
+void LinkMapEstimator::scanLine(StringRef line) {
+    line = line.rtrim("\r");
+    if (line.startswith("#")) {
+        if (line.startswith("# Arch:")) {
+            auto arch = line.drop_front(strlen("# Arch:")).trim();
+            linkLayout.pointerSize = (arch == "armv7" || arch == "armv7s" || arch == "armv7k" || arch == "i386" || arch == "arm64_32") ? 4 : 8;
+        } else if (line.startswith("# Sections:")) {
+            part = Part::Sections;
+        } else if (line.startswith("# Symbols:")) {
+            part = Part::Symbols;
+        } else if (line.startswith("# Dead Stripped Symbols:")) {
+            part = Part::DeadSymbols;
+        }
+        return;
+    }
+
+    StringRef address, size, rest;
+    tie(address, rest) = line.split('\t');
+    tie(size, rest) = rest.ltrim().split('\t');
+    uint64_t addressValue, sizeValue;
+    if (part == Part::Sections) {
+        // 0x1002A0000	0x00004321	__TEXT	__objc_methname
+        StringRef segment, section;
+        tie(segment, section) = rest.split('\t');
+        if (section.trim() == "__objc_methname" && parseHex(address, addressValue) && parseHex(size.trim(), sizeValue)) {
+            methodNameRanges.push_back({addressValue, addressValue + sizeValue});
+        }
+        return;
+    }
+    if (part != Part::Symbols) return;
+
+    // 0x100004000	0x00000028	[  1] -[Foo bar]
+    auto fileEnd = rest.find("] ");
+    if (fileEnd == StringRef::npos) return;
+    auto symbol = rest.drop_front(fileEnd + 2);
+    if (symbol.startswith("-[") || symbol.startswith("+[")) {
+        auto sel = symbolSel(symbol);
+        auto found = implementations.find(sel);
+        if (found != implementations.end()) found->second++;
+        if (wantedSymbols.count(symbol)) linkedSymbols.insert(symbol);
+        return;
+    }
+
+    if (!symbol.consume_front("literal string: ")) return;
+    auto found = implementations.find(symbol);
+    if (found == implementations.end() || !parseHex(address, addressValue) || !parseHex(size.trim(), sizeValue)) return;
+    for (auto &range : methodNameRanges) {
+        if (addressValue >= range.first && addressValue < range.second) {
+            methodNames[symbol] = sizeValue;
+            return;
+        }
+    }
+}
+
+Error LinkMapEstimator::scan(StringRef path, bool relativeMethodLists) {
+    linkLayout.relativeMethodLists = relativeMethodLists;
+    auto file = sys::fs::openNativeFileForRead(path);
+    if (!file) return createFileError(path, file.takeError());
+
+    // lines are cut at the chunk boundary, the tail is carried over
+    SmallString<0> pending;
+    vector<char> chunk(4 << 20);
+    while (true) {
+        auto read = sys::fs::readNativeFile(*file, MutableArrayRef<char>(chunk));
+        if (!read) {
+            sys::fs::closeFile(*file);
+            return createFileError(path, read.takeError());
+        }
+        if (*read == 0) break;
+        StringRef data(chunk.data(), *read);
+        auto lineEnd = data.find('\n');
+        if (lineEnd == StringRef::npos) {
+            pending += data;
+            continue;
+        }
+        pending += data.take_front(lineEnd);
+        scanLine(pending);
+        pending.clear();
+        data = data.drop_front(lineEnd + 1);
+        while ((lineEnd = data.find('\n')) != StringRef::npos) {
+            scanLine(data.take_front(lineEnd));
+            data = data.drop_front(lineEnd + 1);
+        }
+        pending += data;
+    }
+    if (!pending.empty()) scanLine(pending);
+    sys::fs::closeFile(*file);
+    return Error::success();
+}
+
+uint64_t LinkMapEstimator::methodSavings(StringRef symbol, StringRef sel) const {
+    if (!linkedSymbols.count(symbol)) return 0;
+    uint64_t savings = linkLayout.relativeMethodLists ? 12 : 3 * linkLayout.pointerSize;
+    // no msgSend to the selector is left
+    if (implementations.lookup(sel) == 1) {
+        savings += linkLayout.pointerSize + methodNames.lookup(sel);
+    }
+    return savings;
+}
+
+uint64_t LinkMapEstimator::estimate(const DirectableMeth &candidate) const {
+    auto symbol = linkedMethodName(candidate.name);
+    uint64_t savings = methodSavings(symbol, candidate.sel);
+    if (!candidate.isPropertyAccessor || !savings) return savings;
+
+    // property_t: name and attributes
+    savings += 2 * linkLayout.pointerSize;
+    auto setter = setterSymbol(candidate, symbol);
+    if (!setter.empty()) savings += methodSavings(setter, symbolSel(setter));
+    return savings;
+}
@@ -0,0 +1,70 @@
+//
+//  LinkMap.h
+//  DirectableFinder
+//
+
+#ifndef LINK_MAP_H
+#define LINK_MAP_H
+
+#include "DirectableMerge.h"
+#include "DirectableShard.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/Error.h"
+#include <vector>
+
+// "-[Foo(Cat) sel]" of a candidate as the linker and profiles name it, methods
+// of class extensions "-[Foo() sel]" become "-[Foo sel]"
+std::string linkedMethodName(llvm::StringRef name);
+// "-[Foo(Cat) setBar:]" for the getter "-[Foo(Cat) bar]" and the setter
+// selector "setBar:", empty without a setter
+std::string setterMethodName(llvm::StringRef getterName, llvm::StringRef setterSel);
+
+// Estimated bytes a linked image loses when candidates become direct, read from
+// an ld64 link map (-Wl,-map,<path>). A linked method loses its method list
+// entry; when no other linked method implements its selector, the selector
+// reference and the selector name literal go too. Property accessors also lose
+// their property list entry and, when linked, the setter of the same property.
+// Method bodies are kept by direct methods and not counted. Setters are the
+// ones summaries record, `setFoo:` for properties no summary describes.
+class LinkMapEstimator {
+public:
+    struct Layout {
+        // 4 or 8, from the "# Arch:" line
+        unsigned pointerSize = 8;
+        // method_t entries are 12 bytes with relative method lists
+        bool relativeMethodLists = false;
+    };
+
+    // only records of these candidates' methods and selectors are kept
+    LinkMapEstimator(const std::vector<DirectableMeth> &candidates, const PropertySetters &setters);
+
+    // Reads the link map in fixed size chunks, maps of big apps are hundreds of MB.
+    llvm::Error scan(llvm::StringRef path, bool relativeMethodLists);
+
+    uint64_t estimate(const DirectableMeth &candidate) const;
+
+    const Layout &layout() const { return linkLayout; }
+
+private:
+    Layout linkLayout;
+    const PropertySetters &setters;
+    // "-[Class(Category) sel]" symbols of candidates and their setters
+    llvm::StringSet<> wantedSymbols;
+    llvm::StringSet<> linkedSymbols;
+    // selector : linked methods implementing it, candidate selectors only
+    llvm::StringMap<unsigned> implementations;
+    // selector : size of its __objc_methname literal
+    llvm::StringMap<uint64_t> methodNames;
+
+    void scanLine(llvm::StringRef line);
+    uint64_t methodSavings(llvm::StringRef symbol, llvm::StringRef sel) const;
+    std::string setterSymbol(const DirectableMeth &candidate, llvm::StringRef symbol) const;
+
+    enum class Part { Header, Sections, Symbols, DeadSymbols } part = Part::Header;
+    // [begin, end) of __objc_methname sections
+    std::vector<std::pair<uint64_t, uint64_t>> methodNameRanges;
+};
+
+#endif
@@ -0,0 +1,302 @@
+//
+//  ObjCDirectAggregator.cpp
+//  DirectableFinder
+//
+//  Build-time aggregator: plugin instances started with -aggregator=<socket>
+//  stream their records here instead of writing shard files, and the merged
+//  result is written as soon as the build asks for it, without a merge pass.
+//
+//    objc-direct-aggregator --socket=<path> &             before the build
+//    objc-direct-aggregator --socket=<path> --finish -o <merged.json> [--fallback-dir=<dir>]
+//
+
+#include "Aggregator.h"
+#include "DirectableMerge.h"
+#include "DirectableShard.h"
+#include "ShardStore.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/LEB128.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/xxhash.h"
+#include <array>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+
+using namespace std;
+using namespace llvm;
+
+static cl::opt<string> SocketPath("socket", cl::desc("Unix domain socket the plugins connect to"), cl::value_desc("path"), cl::Required);
+
+static cl::opt<bool> Finish("finish", cl::desc("Ask the running aggregator to write the merged result and exit"));
+
+static cl::opt<string> Output("output", cl::desc("merged result, with --finish"), cl::value_desc("path"));
+static cl::alias OutputAlias("o", cl::desc("Alias for --output"), cl::aliasopt(Output));
+
+static cl::opt<string> FallbackDir("fallback-dir", cl::desc("Shards written by plugins that couldn't reach the aggregator, with --finish"), cl::value_desc("dir"));
+
+static cl::opt<unsigned> Jobs("j", cl::desc("Number of connections served in parallel, 0 uses all cores"), cl::init(0));
+
+// Everything received so far. Candidates are kept with the undirectable mark of
+// their selector in a table sharded by selector, so an undirectable selector
+// drops the candidates already received for it while holding a single lock.
+// Undirectable names only filter candidates on arrival and when writing.
+// The result is written like a store merge: sorted by loc, the smallest
+// (name, sel) of a loc wins.
+class Aggregation {
+    static const size_t ShardCount = 64;
+    using Records = set<MergeState::MethRecord>;
+    struct Shard {
+        mutex lock;
+        StringSet<> undirectable;
+        // selector : (loc : candidates)
+        StringMap<map<string, Records>> candidates;
+    };
+    array<Shard, ShardCount> shards;
+    ConcurrentStringSet undirectableNames;
+
+    Shard &shardFor(StringRef sel) { return shards[xxHash64(sel) % ShardCount]; }
+
+public:
+    void addSel(StringRef sel) {
+        auto &shard = shardFor(sel);
+        lock_guard<mutex> guard(shard.lock);
+        shard.undirectable.insert(sel);
+        shard.candidates.erase(sel);
+    }
+
+    void addUndirectName(StringRef name) {
+        undirectableNames.insert(name);
+    }
+
+    void addMeth(const DirectableMethRef &ref) {
+        if (undirectableNames.lockedContains(ref.name)) return;
+        auto &shard = shardFor(ref.sel);
+        lock_guard<mutex> guard(shard.lock);
+        if (shard.undirectable.count(ref.sel)) return;
+        MergeState::MethRecord record;
+        record.name = ref.name.str();
+        record.sel = ref.sel.str();
+        record.isPropertyAccessor = ref.isPropertyAccessor;
+        shard.candidates[ref.sel][ref.loc.str()].insert(move(record));
+    }
+
+    // only once every connection is done, nothing is locked
+    size_t write(raw_ostream &out) {
+        vector<pair<StringRef, const MergeState::MethRecord *>> entries;
+        for (auto &shard : shards) {
+            for (auto &sel : shard.candidates) {
+                for (auto &loc : sel.second) {
+                    for (auto &record : loc.second) {
+                        entries.push_back({loc.first, &record});
+                    }
+                }
+            }
+        }
+        llvm::sort(entries, [](const pair<StringRef, const MergeState::MethRecord *> &a, const pair<StringRef, const MergeState::MethRecord *> &b) {
+            if (a.first != b.first) return a.first < b.first;
+            return *a.second < *b.second;
+        });
+
+        MergedResultWriter writer(out);
+        DirectableMeth meth;
+        StringRef written;
+        for (auto &entry : entries) {
+            if (!written.empty() && entry.first == written) continue;
+            if (undirectableNames.contains(entry.second->name)) continue;
+            meth.name = entry.second->name;
+            meth.sel = entry.second->sel;
+            meth.loc = entry.first.str();
+            meth.isPropertyAccessor = entry.second->isPropertyAccessor;
+            writer.add(meth);
+            written = entry.first;
+        }
+        writer.finish();
+        return writer.size();
+    }
+};
+
+class AggregatingVisitor : public ShardVisitor {
+    Aggregation &aggregation;
+public:
+    AggregatingVisitor(Aggregation &a) : aggregation(a) {}
+
+    void visitSel(StringRef sel) override { aggregation.addSel(sel); }
+    void visitUndirectMeth(StringRef name) override { aggregation.addUndirectName(name); }
+    void visitMeth(const DirectableMethRef &ref) override { aggregation.addMeth(ref); }
+};
+
+static Error addFallbackShards(Aggregation &aggregation, StringRef dir) {
+    if (dir.empty() || !sys::fs::is_directory(dir)) return Error::success();
+    AggregatingVisitor visitor(aggregation);
+    error_code ec;
+    for (sys::fs::directory_iterator it(dir, ec), end; it != end && !ec; it.increment(ec)) {
+        StringRef path = it->path();
+        if (!path.endswith(".json") && !path.endswith(".dfshard")) continue;
+        auto buf = MemoryBuffer::getFile(path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+        if (!buf) return createFileError(path, buf.getError());
+        if (auto err = scanShard((*buf)->getBuffer(), visitor)) return createFileError(path, move(err));
+    }
+    if (ec) return createFileError(dir, ec);
+    return Error::success();
+}
+
+static StringRef readString(StringRef &body) {
+    unsigned size = 0;
+    const char *error = nullptr;
+    uint64_t length = decodeULEB128(body.bytes_begin(), &size, body.bytes_end(), &error);
+    if (error || length > body.size() - size) {
+        body = StringRef();
+        return StringRef();
+    }
+    StringRef str = body.substr(size, length);
+    body = body.drop_front(size + length);
+    return str;
+}
+
+// The --finish request. The connection that sent it is answered by the main
+// thread once every other connection is done, so nothing adds records while
+// the result is written.
+struct FinishRequest {
+    mutex lock;
+    shared_ptr<AggregatorConnection> connection;
+    string body;
+};
+
+static Expected<uint64_t> writeAggregation(Aggregation &aggregation, StringRef body) {
+    auto outputPath = readString(body);
+    auto fallbackDir = readString(body);
+    if (outputPath.empty()) return make_error<StringError>("missing output path", inconvertibleErrorCode());
+    if (auto err = addFallbackShards(aggregation, fallbackDir)) return {move(err)};
+
+    size_t count = 0;
+    if (auto err = writeFileAtomically(outputPath, [&](raw_ostream &out) { count = aggregation.write(out); })) return {move(err)};
+    return count;
+}
+
+static Error replyToFinish(Aggregation &aggregation, FinishRequest &request) {
+    string reply;
+    raw_string_ostream out(reply);
+    auto count = writeAggregation(aggregation, request.body);
+    if (count) {
+        encodeULEB128(*count, out);
+        outs() << *count << "\n";
+    } else {
+        encodeULEB128(0, out);
+        out << toString(count.takeError());
+    }
+    return request.connection->writeFrame(AggregatorResult, out.str());
+}
+
+// false when the connection is handed over to the main thread
+static Expected<bool> handleFrame(const shared_ptr<AggregatorConnection> &connection, Aggregation &aggregation, StringRef frame, FinishRequest &finish, atomic<bool> &finished) {
+    AggregatingVisitor visitor(aggregation);
+    StringRef body = frame.drop_front();
+    switch (frame[0]) {
+    case AggregatorBatch:
+        if (auto err = scanShardBinary(body, visitor)) return {move(err)};
+        return true;
+    case AggregatorEnd:
+        if (auto err = connection->writeFrame(AggregatorAck, "")) return {move(err)};
+        return true;
+    case AggregatorFinish: {
+        lock_guard<mutex> guard(finish.lock);
+        if (finish.connection) {
+            string reply;
+            raw_string_ostream out(reply);
+            encodeULEB128(0, out);
+            out << "the aggregator is already finishing";
+            if (auto err = connection->writeFrame(AggregatorResult, out.str())) return {move(err)};
+            return false;
+        }
+        finish.connection = connection;
+        finish.body = body.str();
+        finished = true;
+        return false;
+    }
+    default:
+        return make_error<StringError>("unknown aggregator message", inconvertibleErrorCode());
+    }
+}
+
+static void serve(const shared_ptr<AggregatorConnection> &connection, Aggregation &aggregation, FinishRequest &finish, atomic<bool> &finished) {
+    string frame;
+    while (true) {
+        auto received = connection->readFrame(frame);
+        if (!received) {
+            logAllUnhandledErrors(received.takeError(), errs(), "objc-direct-aggregator: ");
+            return;
+        }
+        if (!*received) return;
+        auto handled = handleFrame(connection, aggregation, frame, finish, finished);
+        if (!handled) {
+            logAllUnhandledErrors(handled.takeError(), errs(), "objc-direct-aggregator: ");
+            return;
+        }
+        if (!*handled) return;
+    }
+}
+
+int main(int argc, const char **argv) {
+    InitLLVM X(argc, argv);
+    cl::ParseCommandLineOptions(argc, argv, "collect plugin results streamed over a Unix domain socket\n");
+
+    if (Finish) {
+        if (Output.empty()) {
+            errs() << "objc-direct-aggregator: --finish needs -o <output path>\n";
+            return 1;
+        }
+        // the daemon may run in another directory
+        SmallString<256> output(Output), fallback(FallbackDir);
+        sys::fs::make_absolute(output);
+        if (!fallback.empty()) sys::fs::make_absolute(fallback);
+        auto count = finishAggregation(SocketPath, output, fallback);
+        if (!count) {
+            logAllUnhandledErrors(count.takeError(), errs(), "objc-direct-aggregator: ");
+            return 1;
+        }
+        outs() << *count << "\n";
+        return 0;
+    }
+
+    auto listener = AggregatorListener::listen(SocketPath);
+    if (!listener) {
+        logAllUnhandledErrors(listener.takeError(), errs(), "objc-direct-aggregator: ");
+        return 1;
+    }
+
+    Aggregation aggregation;
+    FinishRequest finish;
+    atomic<bool> finished(false);
+    ThreadPool pool(hardware_concurrency(Jobs));
+    while (!finished) {
+        auto connection = listener->accept(/*timeoutMs=*/200);
+        if (!connection) {
+            logAllUnhandledErrors(connection.takeError(), errs(), "objc-direct-aggregator: ");
+            pool.wait();
+            return 1;
+        }
+        if (!*connection) continue;
+        // ThreadPool tasks have to be copyable
+        shared_ptr<AggregatorConnection> shared(move(*connection));
+        pool.async([shared, &aggregation, &finish, &finished] {
+            serve(shared, aggregation, finish, finished);
+        });
+    }
+    // no connection is accepted anymore, the TUs still streaming are drained
+    pool.wait();
+    if (auto err = replyToFinish(aggregation, finish)) {
+        logAllUnhandledErrors(move(err), errs(), "objc-direct-aggregator: ");
+        return 1;
+    }
+    return 0;
+}
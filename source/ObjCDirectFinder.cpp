@@ -5,115 +5,292 @@
 //  Created by Kam on 2021/10/23.
 //
 
+#include "ObjCDirectFinder.h"
+#include "Aggregator.h"
+#include "ShardStore.h"
+
 #include "clang/Frontend/FrontendPluginRegistry.h"
 
 #include "clang/AST/AST.h"
 #include "clang/AST/ASTConsumer.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/AST/RecursiveASTVisitor.h"
-#include "llvm/Support/JSON.h"
+#include "clang/Lex/Lexer.h"
+#include "clang/Lex/Preprocessor.h"
+#include "clang/Sema/Sema.h"
+#include "clang/Serialization/ASTReader.h"
+#include "clang/Serialization/ModuleManager.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/MD5.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/TimeProfiler.h"
+#include "llvm/Support/xxhash.h"
 
 #include "clang/Tooling/CommonOptionsParser.h"
 #include "clang/Tooling/Tooling.h"
 #include <map>
+#include <mutex>
 #include <type_traits>
 
 
 using namespace clang::tooling;
 using namespace clang;
 using namespace std;
-using namespace llvm::json;
 
-class Tool {
-public:
-    static string generateReadableName(const ObjCInterfaceDecl *interfaceDecl, ObjCMethodDecl *meth) {
-        if (!interfaceDecl || !meth) return "";
-        auto sign = meth->isInstanceMethod() ? "-" : "+";
-        auto clzName = interfaceDecl->getNameAsString();
-        auto methName = meth->getNameAsString();
-        return sign + string("[") + clzName + string(" ") + methName + string("]");
-    }
-
-    static string generateReadableName(const ObjCCategoryDecl *categoryDecl, ObjCMethodDecl *meth) {
-        if (!categoryDecl || !meth) return "";
-        auto sign = meth->isInstanceMethod() ? "-" : "+";
-        auto clzName = categoryDecl->getClassInterface()->getNameAsString();
-        auto categoryName = categoryDecl->getNameAsString();
-        auto methName = meth->getNameAsString();
-        return sign + string("[") + clzName + string("(") + categoryName + string(")") + string(" ") + methName + string("]");
+#define DEBUG_TYPE "directable-finder"
+
+// always counted, printed by `-Xclang -print-stats` or written by `-Xclang -stats-file=<path>`
+ALWAYS_ENABLED_STATISTIC(NumMethodsVisited, "Number of methods visited");
+ALWAYS_ENABLED_STATISTIC(NumHierarchySteps, "Number of hierarchy levels walked by first declaration lookups");
+ALWAYS_ENABLED_STATISTIC(NumCandidatesInserted, "Number of directable candidates inserted");
+ALWAYS_ENABLED_STATISTIC(NumCandidatesErased, "Number of directable candidates erased");
+ALWAYS_ENABLED_STATISTIC(NumUndirectableSelectors, "Number of selectors marked undirectable");
+ALWAYS_ENABLED_STATISTIC(NumUndirectableNames, "Number of method names marked undirectable");
+ALWAYS_ENABLED_STATISTIC(NumHierarchyLookups, "Number of first declaration lookups");
+ALWAYS_ENABLED_STATISTIC(NumShardBytesWritten, "Number of shard bytes written");
+ALWAYS_ENABLED_STATISTIC(NumSendsNarrowed, "Number of id/Class sends narrowed to their inferred receiver classes");
+ALWAYS_ENABLED_STATISTIC(NumFunctionsPruned, "Number of C and C++ function bodies skipped without ObjC tokens");
+ALWAYS_ENABLED_STATISTIC(NumSubscriptChecks, "Number of C and C++ function bodies searched for ObjC subscripts");
+ALWAYS_ENABLED_STATISTIC(NumDynamicSelectorsDropped, "Number of candidates dropped by the prescanned dynamic selectors");
+ALWAYS_ENABLED_STATISTIC(NumHeaderRecordsReused, "Number of header records whose selectors were left out of the shard");
+ALWAYS_ENABLED_STATISTIC(NumHeaderRecordsWritten, "Number of header records written");
+ALWAYS_ENABLED_STATISTIC(NumModuleRecordsReused, "Number of module files whose protocol selectors were already recorded");
+ALWAYS_ENABLED_STATISTIC(NumModuleRecordsWritten, "Number of module records written");
+
+// Readable name of a method, `-[Class(Category) sel]`, as handles. Identifiers
+// and selectors are uniqued per TU, so two keys are equal exactly when their
+// rendered names are; the string is only built for names that reach a shard.
+struct MethodNameKey {
+    const IdentifierInfo *classIdentifier = NULL;
+    const IdentifierInfo *categoryIdentifier = NULL;
+    bool inCategory = false;
+    bool isInstance = false;
+    Selector sel;
+    
+    static MethodNameKey make(const ObjCInterfaceDecl *interfaceDecl, const ObjCMethodDecl *meth) {
+        MethodNameKey key;
+        if (!interfaceDecl || !meth) return key;
+        key.classIdentifier = interfaceDecl->getIdentifier();
+        key.isInstance = meth->isInstanceMethod();
+        key.sel = meth->getSelector();
+        return key;
+    }
+    
+    static MethodNameKey make(const ObjCCategoryDecl *categoryDecl, const ObjCMethodDecl *meth) {
+        MethodNameKey key;
+        if (!categoryDecl || !meth) return key;
+        key.classIdentifier = categoryDecl->getClassInterface()->getIdentifier();
+        // NULL for class extensions, `Class()`
+        key.categoryIdentifier = categoryDecl->getIdentifier();
+        key.inCategory = true;
+        key.isInstance = meth->isInstanceMethod();
+        key.sel = meth->getSelector();
+        return key;
+    }
+    
+    bool valid() const { return classIdentifier != NULL; }
+    
+    string render() const {
+        string name;
+        llvm::raw_string_ostream out(name);
+        out << (isInstance ? "-[" : "+[") << classIdentifier->getName();
+        if (inCategory) {
+            out << "(" << (categoryIdentifier ? categoryIdentifier->getName() : "") << ")";
+        }
+        out << " ";
+        sel.print(out);
+        out << "]";
+        return out.str();
     }
 };
-class DirectableEntry {
-    string fullName;
-    string selectorName;
-    string firstDeclLocation;
-public:
+
+namespace llvm {
+template <> struct DenseMapInfo<MethodNameKey> {
+    static MethodNameKey getEmptyKey() {
+        MethodNameKey key;
+        key.classIdentifier = DenseMapInfo<const IdentifierInfo *>::getEmptyKey();
+        return key;
+    }
+    static MethodNameKey getTombstoneKey() {
+        MethodNameKey key;
+        key.classIdentifier = DenseMapInfo<const IdentifierInfo *>::getTombstoneKey();
+        return key;
+    }
+    static unsigned getHashValue(const MethodNameKey &key) {
+        return hash_combine(key.classIdentifier, key.categoryIdentifier, key.inCategory, key.isInstance, key.sel.getAsOpaquePtr());
+    }
+    static bool isEqual(const MethodNameKey &a, const MethodNameKey &b) {
+        return a.classIdentifier == b.classIdentifier && a.categoryIdentifier == b.categoryIdentifier
+            && a.inCategory == b.inCategory && a.isInstance == b.isInstance && a.sel == b.sel;
+    }
+};
+}
+
+// Candidate record, lives in the recorder's arena so it is never deleted.
+// Name and location stay handles until the entry survives to dump().
+struct DirectableEntry {
+    MethodNameKey name;
+    SourceLocation firstDeclLocation;
     bool isPropertyAccessor;
-    string getFullName() { return fullName; }
-    string getSelectorName() { return selectorName; }
-    string getFirstDeclLocation() { return firstDeclLocation; }
-    
-    DirectableEntry(ObjCInterfaceDecl *interfaceDecl, ObjCMethodDecl *meth, string firstDeclLoc)
-    : DirectableEntry(Tool::generateReadableName(interfaceDecl, meth), meth->getSelector().getAsString(), firstDeclLoc, meth->isPropertyAccessor()) {}
-    DirectableEntry(ObjCCategoryDecl *categoryDecl, ObjCMethodDecl *meth, string firstDeclLoc)
-    : DirectableEntry(Tool::generateReadableName(categoryDecl, meth), meth->getSelector().getAsString(), firstDeclLoc, meth->isPropertyAccessor()) {}
-    DirectableEntry(string f, string sel, string firstDecl, bool isPropertyAccessor)
-    :fullName(f), selectorName(sel), firstDeclLocation(firstDecl), isPropertyAccessor(isPropertyAccessor) {}
+    
+    DirectableEntry(const MethodNameKey &n, SourceLocation firstDecl, bool isPropertyAccessor)
+    :name(n), firstDeclLocation(firstDecl), isPropertyAccessor(isPropertyAccessor) {}
 };
+
+// A selector snapshot looked up by string, once per selector.
+class CachedSelectorSnapshot {
+    const SelectorSnapshot *snapshot = NULL;
+    llvm::DenseMap<Selector, bool> hits;
+public:
+    void reset(const SelectorSnapshot *s) {
+        snapshot = s;
+        hits.clear();
+    }
+    
+    explicit operator bool() const {
+        return snapshot;
+    }
+    
+    bool contains(Selector sel) {
+        if (!snapshot) return false;
+        auto cached = hits.find(sel);
+        if (cached != hits.end()) return cached->second;
+        bool hit = snapshot->contains(sel.getAsString());
+        hits[sel] = hit;
+        return hit;
+    }
+};
+
 class DirectableRecorder {
     
+    // entries, released together with the recorder
+    llvm::BumpPtrAllocator arena;
+    
     // selector : [meth_name]
-    map<string, list<DirectableEntry *> *> storage;
+    llvm::DenseMap<Selector, llvm::SmallVector<DirectableEntry *, 1>> storage;
+    // meth_name : entry
+    llvm::DenseMap<MethodNameKey, DirectableEntry *> entryByName;
     
     // undirectable record
-    map<string, Selector> undirectableSeletorRefList;
-    set<string> undirectableReadableList;
+    llvm::DenseSet<Selector> undirectableSelectors;
+    llvm::DenseSet<MethodNameKey> undirectableNames;
+    // -summary: selectors only declared by protocols, they don't erase candidates
+    llvm::DenseSet<Selector> protocolSelectors;
     
-    void insert(DirectableEntry *entry) {
-        string key = entry->getSelectorName();
-        if (undirectableSeletorRefList.find(key) != undirectableSeletorRefList.end()) {
+    // -summary: classes with implementations in the TU and their superclasses,
+    // whether they come from user sources, and what the TU implements
+    llvm::MapVector<const ObjCInterfaceDecl *, bool> summaryClasses;
+    llvm::DenseMap<const ObjCInterfaceDecl *, llvm::SmallVector<const ObjCMethodDecl *, 8>> implementedMeths;
+    llvm::DenseSet<Selector> selectorRefs;
+    llvm::DenseSet<Selector> dynamicSends;
+    // `-[Class sel]` with the class the message is sent to, no category
+    llvm::DenseSet<MethodNameKey> staticRefs;
+    
+    // -send-counts: method : locations of the sends to it
+    llvm::MapVector<MethodNameKey, llvm::SmallVector<SourceLocation, 2>> sendSites;
+    
+    // -header-cache: protocol selectors each header declares, and the selectors
+    // header records already hold, which the shard leaves out
+    llvm::MapVector<FileID, llvm::SmallVector<Selector, 8>> headerProtocolSels;
+    llvm::StringSet<> sharedSels;
+    
+    // -local-decls-only: protocol selectors of module files no record holds
+    vector<string> moduleSels;
+    static mutex processModuleSelsLock;
+    static llvm::StringMap<vector<string>> processModuleSels;
+    
+    void insert(const MethodNameKey &name, ObjCMethodDecl *meth, SourceLocation firstDeclLoc) {
+        if (!name.valid()) return;
+        auto sel = meth->getSelector();
+        if (isSDKSelector(sel)) {
             return;
         }
-        
-        if (undirectableReadableList.find(entry->getFullName()) != undirectableReadableList.end()) {
+        if (dynamicSelectors.contains(sel)) {
+            // recorded, shards of TUs without the snapshot are erased by the merge
+            ++NumDynamicSelectorsDropped;
+            insertToUndirectableSel(sel);
+            // --resolve only reads the dynamic uses of the summary
+            if (options.summary) noteSelectorRef(sel);
             return;
         }
-
-        auto listTarget = storage.find(key);
-        list<DirectableEntry *> *mList;
-        if (listTarget != storage.end()) {
-            mList = listTarget->second;
-        } else {
-            mList = new list<DirectableEntry *>();
-            storage.insert(pair<string, list<DirectableEntry *> *>(key, mList));
+        if (isDeclaredInExternalProtocol(sel)) {
+            insertProtocolSel(sel);
+            // -summary resolves it against the conformances of the whole program
+            if (!options.summary) return;
+        }
+        if (undirectableSelectors.count(sel)) {
+            return;
+        }
+        if (undirectableNames.count(name)) {
+            return;
+        }
+        if (entryByName.count(name)) {
+            return;
         }
         
-        const auto name = entry->getFullName();
-        bool exist = false;
-        for (auto j = mList->begin(), k = mList->end(); j != k; j++) {
-            auto methPtr = *j;
-            if (methPtr->getFullName() == name) {
-                exist = true;
-                break;
-            }
+        auto entry = new (arena.Allocate<DirectableEntry>()) DirectableEntry(name, firstDeclLoc, meth->isPropertyAccessor());
+        storage[sel].push_back(entry);
+        entryByName[name] = entry;
+        ++NumCandidatesInserted;
+    }
+    
+    CachedSelectorSnapshot sdkSelectors;
+    CachedSelectorSnapshot dynamicSelectors;
+    
+    bool isSDKSelector(Selector sel) {
+        return sdkSelectors.contains(sel);
+    }
+    
+    // protocols that were not traversed (modules/PCH) are looked up per selector
+    // through Sema's global method pool, which only deserializes that selector
+    Sema *externalProtocolSource = NULL;
+    llvm::DenseMap<Selector, bool> externalProtocolSelectors;
+    
+    bool isDeclaredInExternalProtocol(Selector sel) {
+        if (!externalProtocolSource) return false;
+        auto cached = externalProtocolSelectors.find(sel);
+        if (cached != externalProtocolSelectors.end()) return cached->second;
+        
+        Sema &sema = *externalProtocolSource;
+        if (sema.getExternalSource()) {
+            sema.ReadMethodPool(sel);
         }
         
-        if (!exist) {
-            mList->push_back(entry);
-        } else {
-            delete entry;
+        bool declared = false;
+        auto pool = sema.MethodPool.find(sel);
+        if (pool != sema.MethodPool.end()) {
+            for (const ObjCMethodList *list : {&pool->second.first, &pool->second.second}) {
+                for (; list && list->getMethod(); list = list->getNext()) {
+                    auto protocolDecl = dyn_cast<ObjCProtocolDecl>(list->getMethod()->getDeclContext());
+                    if (protocolDecl && !isCoveredBySDKSelectors(protocolDecl)) {
+                        declared = true;
+                        break;
+                    }
+                }
+                if (declared) break;
+            }
         }
+        externalProtocolSelectors[sel] = declared;
+        return declared;
     }
 
 public:
     string name;
     CompilerInstance &compilerInstance;
-    DirectableRecorder(CompilerInstance &CI) : compilerInstance(CI) {
-        storage = map<string, list<DirectableEntry *> *>();
-        undirectableSeletorRefList = map<string, Selector>();
-        undirectableReadableList = set<string>();
-    }
+    DFOptions options;
+    ShardSink *sink = NULL;
+    DirectableRecorder(CompilerInstance &CI) : compilerInstance(CI) {}
     
     ~DirectableRecorder() {
         dump();
@@ -123,153 +300,1094 @@ public:
         return compilerInstance;
     }
     
+    void setExternalProtocolSource(Sema *sema) {
+        externalProtocolSource = sema;
+    }
+    
+    // -local-decls-only: protocols of modules/PCH aren't traversed, yet their
+    // selectors have to reach the merge for the candidates of other TUs. They
+    // are written once per module file, as a record like a header's, and only
+    // the TU writing it looks up every selector the module knows. Without an
+    // output directory (objc-direct-finder), or with -aggregator, which never
+    // sees the records, a module is looked up once per process.
+    // the module file, keyed like the store keys it, and -summary
+    string moduleRecordKey(const serialization::ModuleFile &module) {
+        llvm::MD5 hash;
+        hash.update("module-record-1");
+        hash.update(module.FileName);
+        hash.update(llvm::StringRef("\0", 1));
+        hash.update(to_string(module.Size) + ":" + to_string(module.ModTime) + ":");
+        hash.update(llvm::toHex(llvm::ArrayRef<uint8_t>(module.Signature.data(), module.Signature.size())));
+        hash.update(options.summary ? "summary" : "");
+        llvm::MD5::MD5Result digest;
+        hash.final(digest);
+        return digest.digest().str().str();
+    }
+    
+    // deserializes the methods of every selector the module knows
+    vector<string> moduleProtocolSels(ASTReader &reader, serialization::ModuleFile &module) {
+        vector<string> sels;
+        for (unsigned i = 0; i < module.LocalNumSelectors; i++) {
+            auto sel = reader.DecodeSelector(module.BaseSelectorID + serialization::NUM_PREDEF_SELECTOR_IDS + i);
+            if (sel.isNull() || isSDKSelector(sel)) continue;
+            if (isDeclaredInExternalProtocol(sel)) sels.push_back(sel.getAsString());
+        }
+        sortUnique(sels);
+        return sels;
+    }
+    
+    void insertExternalProtocolSels(ASTReader &reader) {
+        llvm::TimeTraceScope timeScope("DirectableFinder external protocols");
+        bool binary = options.format == DFOptions::ShardFormat::Binary;
+        llvm::StringRef extension = binary ? ".dfshard" : ".json";
+        for (auto &module : reader.getModuleManager()) {
+            string key = moduleRecordKey(module);
+            if (options.outputDir.empty() || !options.aggregatorSocket.empty()) {
+                lock_guard<mutex> guard(processModuleSelsLock);
+                auto cached = processModuleSels.find(key);
+                if (cached == processModuleSels.end()) cached = processModuleSels.insert({key, moduleProtocolSels(reader, module)}).first;
+                moduleSels.insert(moduleSels.end(), cached->second.begin(), cached->second.end());
+                continue;
+            }
+            
+            auto existing = readHeaderRecord(options.outputDir, options.store, key, extension);
+            if (!existing) {
+                llvm::errs() << "directable-finder: " << llvm::toString(existing.takeError()) << "\n";
+            } else if (*existing) {
+                ++NumModuleRecordsReused;
+                continue;
+            }
+            
+            DirectableShard record;
+            record.sels = moduleProtocolSels(reader, module);
+            record.hasSummary = options.summary;
+            string recordContent = binary ? shardToBinary(record, options.compress) : shardToJSON(record);
+            auto written = commitHeaderRecord(options.outputDir, options.store, key, module.FileName, recordContent, extension);
+            if (written && *written) {
+                ++NumModuleRecordsWritten;
+                NumShardBytesWritten += recordContent.size();
+                continue;
+            }
+            if (!written) llvm::errs() << "directable-finder: " << llvm::toString(written.takeError()) << "\n";
+            // a concurrent job won the race, or the record can't be written
+            moduleSels.insert(moduleSels.end(), record.sels.begin(), record.sels.end());
+        }
+    }
+    
+    void setSDKSelectors(const SelectorSnapshot *snapshot) {
+        sdkSelectors.reset(snapshot);
+    }
+    
+    void setDynamicSelectors(const SelectorSnapshot *snapshot) {
+        dynamicSelectors.reset(snapshot);
+    }
+    
+    // selectors of system protocols are already in the SDK snapshot
+    bool isCoveredBySDKSelectors(const ObjCProtocolDecl *D) {
+        return sdkSelectors && compilerInstance.getSourceManager().isInSystemHeader(D->getLocation());
+    }
+    
     // for class interface
     void insertDirectablePropertyGetterMethod(ObjCInterfaceDecl *interfaceDecl, const ObjCPropertyDecl *pro) {
-        string firstDeclLoc = pro->getLocation().printToString(compilerInstance.getSourceManager());
-        auto entry = new DirectableEntry(interfaceDecl, pro->getGetterMethodDecl(), firstDeclLoc);
-        insert(entry);
+        auto getter = pro->getGetterMethodDecl();
+        insert(MethodNameKey::make(interfaceDecl, getter), getter, pro->getLocation());
     }
     
     void insertDirectableMethod(ObjCInterfaceDecl *interfaceDecl, ObjCMethodDecl *meth) {
-        string firstDeclLoc = meth->getLocation().printToString(compilerInstance.getSourceManager());
-        auto entry = new DirectableEntry(interfaceDecl, meth, firstDeclLoc);
-        insert(entry);
+        insert(MethodNameKey::make(interfaceDecl, meth), meth, meth->getLocation());
     }
     
     // for category
     void insertDirectablePropertyGetterMethod(ObjCCategoryDecl *categoryDecl, const ObjCPropertyDecl *pro) {
-        string firstDeclLoc = pro->getLocation().printToString(compilerInstance.getSourceManager());
-        auto entry = new DirectableEntry(categoryDecl, pro->getGetterMethodDecl(), firstDeclLoc);
-        insert(entry);
+        auto getter = pro->getGetterMethodDecl();
+        insert(MethodNameKey::make(categoryDecl, getter), getter, pro->getLocation());
     }
     
     void insertDirectableMethod(ObjCCategoryDecl *categoryDecl, ObjCMethodDecl *meth) {
-        string firstDeclLoc = meth->getLocation().printToString(compilerInstance.getSourceManager());
-        auto entry = new DirectableEntry(categoryDecl, meth, firstDeclLoc);
-        insert(entry);
+        insert(MethodNameKey::make(categoryDecl, meth), meth, meth->getLocation());
     }
 
-    void insertUndirectableMethodName(string name) {
-        if (name.empty()) return;
-        undirectableReadableList.insert(name);
+    void insertUndirectableMethodName(const MethodNameKey &name) {
+        if (!name.valid()) return;
+        if (undirectableNames.insert(name).second) ++NumUndirectableNames;
         earseMarkedDirectMethodName(name);
     }
 
+    // protocol selectors can't be direct in classes adopting the protocol,
+    // without -summary that is every class
+    void insertProtocolSel(Selector sel) {
+        if (options.summary) {
+            protocolSelectors.insert(sel);
+            return;
+        }
+        insertToUndirectableSel(sel);
+    }
+    
+    void noteHeaderProtocol(const ObjCProtocolDecl *protocolDecl) {
+        auto &sm = compilerInstance.getSourceManager();
+        auto file = sm.getFileID(sm.getExpansionLoc(protocolDecl->getLocation()));
+        if (file.isInvalid() || file == sm.getMainFileID()) return;
+        auto &sels = headerProtocolSels[file];
+        for (auto meth : protocolDecl->methods()) {
+            sels.push_back(meth->getSelector());
+        }
+    }
+    
+    void noteClass(const ObjCInterfaceDecl *interfaceDecl, bool isUserSource) {
+        summaryClasses.insert({interfaceDecl->getCanonicalDecl(), isUserSource});
+    }
+    
+    bool hasNotedClass(const ObjCInterfaceDecl *interfaceDecl) {
+        return summaryClasses.count(interfaceDecl->getCanonicalDecl());
+    }
+    
+    void noteImplemented(const ObjCInterfaceDecl *interfaceDecl, const ObjCMethodDecl *meth) {
+        implementedMeths[interfaceDecl->getCanonicalDecl()].push_back(meth);
+    }
+    
+    void noteSelectorRef(Selector sel) {
+        selectorRefs.insert(sel);
+    }
+    
+    void noteDynamicSend(Selector sel) {
+        dynamicSends.insert(sel);
+    }
+    
+    void noteStaticRef(const ObjCInterfaceDecl *interfaceDecl, Selector sel, bool isInstance) {
+        if (!interfaceDecl) return;
+        MethodNameKey name;
+        name.classIdentifier = interfaceDecl->getIdentifier();
+        name.isInstance = isInstance;
+        name.sel = sel;
+        staticRefs.insert(name);
+    }
+    
+    void noteSend(const MethodNameKey &name, SourceLocation loc) {
+        if (!name.valid()) return;
+        sendSites[name].push_back(loc);
+    }
+
     void insertToUndirectableSel(Selector sel) {
-        string selName = sel.getAsString();
-        earseMarkedDirectMethodNBySel(selName);
-        undirectableSeletorRefList.insert(pair<string, Selector>(selName, sel));
+        earseMarkedDirectMethodNBySel(sel);
+        if (undirectableSelectors.insert(sel).second) ++NumUndirectableSelectors;
     }
     
-    void earseMarkedDirectMethodNBySel(string selName) {
-        auto listTarget = storage.find(selName);
+    void earseMarkedDirectMethodNBySel(Selector sel) {
+        auto listTarget = storage.find(sel);
         if (listTarget != storage.end()) {
-            list<DirectableEntry *> *mList = listTarget->second;
-            for (auto i = mList->begin(), e = mList->end(); i != e ; i++) {
-                delete *i;
+            for (auto entry : listTarget->second) {
+                entryByName.erase(entry->name);
             }
-            delete mList;
-            storage.erase(selName);
+            NumCandidatesErased += listTarget->second.size();
+            storage.erase(listTarget);
         }
     }
     
-    void earseMarkedDirectMethodName(string name) {
-        size_t pos = name.find(" ") + 1;
-        size_t len = name.length() - pos;
-        auto selectorName = name.substr(pos, len - 1);
-        auto listTarget = storage.find(selectorName);
-        if (listTarget != storage.end()) {
-            list<DirectableEntry *> *mList = listTarget->second;
-            for (auto j = mList->begin(), k = mList->end(); j != k ; j++) {
-                auto methPtr = *j;
-                if (methPtr->getFullName() == name) {
-                    delete methPtr;
-                    mList->erase(j);
-                    break;
+    void earseMarkedDirectMethodName(const MethodNameKey &name) {
+        auto entryTarget = entryByName.find(name);
+        if (entryTarget == entryByName.end()) return;
+        
+        auto entry = entryTarget->second;
+        entryByName.erase(entryTarget);
+        auto &mList = storage[entry->name.sel];
+        mList.erase(std::find(mList.begin(), mList.end(), entry));
+        ++NumCandidatesErased;
+    }
+    
+    // names and locations are only rendered here, for what survived the TU
+    DirectableShard materialize() {
+        llvm::TimeTraceScope timeScope("DirectableFinder materialize");
+        auto &sm = compilerInstance.getSourceManager();
+        DirectableShard shard;
+        
+        for (auto sel : undirectableSelectors) {
+            auto str = sel.getAsString();
+            if (!sharedSels.count(str)) shard.sels.push_back(move(str));
+        }
+        // still undirectable for merges that don't resolve the summary
+        for (auto sel : protocolSelectors) {
+            auto str = sel.getAsString();
+            if (!undirectableSelectors.count(sel) && !sharedSels.count(str)) shard.sels.push_back(move(str));
+        }
+        for (auto &str : moduleSels) {
+            if (!sharedSels.count(str)) shard.sels.push_back(str);
+        }
+        sortUnique(shard.sels);
+        
+        for (auto &name : undirectableNames) {
+            shard.undirectMeths.push_back(name.render());
+        }
+        llvm::sort(shard.undirectMeths);
+
+        // keep the selector order stable so identical TUs produce identical shards
+        vector<pair<string, Selector>> candidateSels;
+        for (auto &i : storage) {
+            if (!i.second.empty()) candidateSels.push_back({i.first.getAsString(), i.first});
+        }
+        llvm::sort(candidateSels, [](const pair<string, Selector> &a, const pair<string, Selector> &b) { return a.first < b.first; });
+        for (auto &sel : candidateSels) {
+            for (auto meth : storage[sel.second]) {
+                DirectableMeth methInfo;
+                methInfo.name = meth->name.render();
+                methInfo.sel = sel.first;
+                methInfo.loc = meth->firstDeclLocation.printToString(sm);
+                methInfo.isPropertyAccessor = meth->isPropertyAccessor;
+                shard.meths.push_back(move(methInfo));
+            }
+        }
+        
+        if (options.summary) {
+            shard.hasSummary = true;
+            materializeSummary(shard.summary);
+        }
+        
+        for (auto &sends : sendSites) {
+            DirectableSends methSends;
+            methSends.name = sends.first.render();
+            for (auto loc : sends.second) {
+                methSends.sites.push_back(loc.printToString(sm));
+            }
+            sortUnique(methSends.sites);
+            shard.sends.push_back(move(methSends));
+        }
+        llvm::sort(shard.sends, [](const DirectableSends &a, const DirectableSends &b) { return a.name < b.name; });
+        return shard;
+    }
+    
+    static string signedSelector(const ObjCMethodDecl *meth) {
+        return (meth->isInstanceMethod() ? "-" : "+") + meth->getSelector().getAsString();
+    }
+    
+    static void sortUnique(vector<string> &strings) {
+        llvm::sort(strings);
+        strings.erase(std::unique(strings.begin(), strings.end()), strings.end());
+    }
+    
+    static void addSelectors(vector<string> &out, const llvm::DenseSet<Selector> &sels) {
+        for (auto sel : sels) {
+            out.push_back(sel.getAsString());
+        }
+        llvm::sort(out);
+    }
+    
+    void materializeSummary(DirectableSummary &summary) {
+        // adopted protocols and, as they are rendered, the ones they inherit from
+        llvm::SetVector<const ObjCProtocolDecl *> protocols;
+        for (auto &noted : summaryClasses) {
+            auto interfaceDecl = noted.first->getDefinition();
+            if (!interfaceDecl) continue;
+            SummaryClass clz;
+            clz.name = interfaceDecl->getNameAsString();
+            if (auto superClass = interfaceDecl->getSuperClass()) {
+                clz.super = superClass->getNameAsString();
+            }
+            for (auto protocol : interfaceDecl->all_referenced_protocols()) {
+                clz.protocols.push_back(protocol->getNameAsString());
+                protocols.insert(protocol);
+            }
+            for (auto category : interfaceDecl->visible_categories()) {
+                if (!category->IsClassExtension()) {
+                    clz.categories.push_back(category->getNameAsString());
+                }
+                for (auto protocol : category->protocols()) {
+                    clz.protocols.push_back(protocol->getNameAsString());
+                    protocols.insert(protocol);
                 }
             }
+            
+            // methods of system classes are never candidates, overriding them is
+            // already marked by the TU
+            auto addContainer = [&](const ObjCContainerDecl *container) {
+                for (auto meth : container->methods()) {
+                    clz.declared.push_back(signedSelector(meth));
+                }
+                for (auto property : container->properties()) {
+                    string accessors = property->getGetterName().getAsString();
+                    if (!property->isReadOnly()) {
+                        accessors += " " + property->getSetterName().getAsString();
+                    }
+                    clz.properties.push_back(move(accessors));
+                }
+            };
+            if (noted.second) {
+                addContainer(interfaceDecl);
+                for (auto category : interfaceDecl->visible_categories()) {
+                    addContainer(category);
+                }
+            }
+            auto implemented = implementedMeths.find(noted.first);
+            if (implemented != implementedMeths.end()) {
+                for (auto meth : implemented->second) {
+                    clz.implemented.push_back(signedSelector(meth));
+                }
+            }
+            
+            sortUnique(clz.protocols);
+            sortUnique(clz.categories);
+            sortUnique(clz.properties);
+            sortUnique(clz.declared);
+            sortUnique(clz.implemented);
+            summary.classes.push_back(move(clz));
         }
+        
+        for (size_t i = 0; i < protocols.size(); i++) {
+            // forward declared only, a TU that sees the definition records it
+            auto protocolDecl = protocols[i]->getDefinition();
+            if (!protocolDecl) continue;
+            SummaryProtocol protocol;
+            protocol.name = protocolDecl->getNameAsString();
+            for (auto parent : protocolDecl->protocols()) {
+                protocol.inherits.push_back(parent->getNameAsString());
+                protocols.insert(parent);
+            }
+            for (auto meth : protocolDecl->methods()) {
+                protocol.meths.push_back(signedSelector(meth));
+            }
+            sortUnique(protocol.inherits);
+            sortUnique(protocol.meths);
+            summary.protocols.push_back(move(protocol));
+        }
+        
+        llvm::sort(summary.classes, [](const SummaryClass &a, const SummaryClass &b) { return a.name < b.name; });
+        llvm::sort(summary.protocols, [](const SummaryProtocol &a, const SummaryProtocol &b) { return a.name < b.name; });
+        addSelectors(summary.selectorRefs, selectorRefs);
+        addSelectors(summary.dynamicSends, dynamicSends);
+        for (auto &name : staticRefs) {
+            summary.staticRefs.push_back(name.render());
+        }
+        llvm::sort(summary.staticRefs);
+    }
+    
+    // The header's path and content and everything that changes what is
+    // recorded from it. `--gc` drops the record once its header is gone, so a
+    // copy of the header at another path can't share it.
+    string headerRecordKey(llvm::StringRef path, llvm::StringRef content) {
+        llvm::MD5 hash;
+        hash.update("header-record-2");
+        hash.update(path);
+        hash.update(llvm::StringRef("\0", 1));
+        hash.update(to_string(llvm::xxHash64(content)));
+        hash.update(compilerInstance.getInvocation().getModuleHash());
+        hash.update(options.summary ? "summary" : "");
+        llvm::MD5::MD5Result digest;
+        hash.final(digest);
+        return digest.digest().str().str();
     }
     
-    string locationForMeth(ObjCMethodDecl *meth) {
+    string headerName(FileID file) {
         auto &sm = compilerInstance.getSourceManager();
-        string loc = meth->getLocation().printToString(sm);
-        return loc;
+        if (auto fileEntry = sm.getFileEntryForID(file)) {
+            auto realPath = fileEntry->tryGetRealPathName();
+            return (realPath.empty() ? fileEntry->getName() : realPath).str();
+        }
+        return sm.getBufferOrFake(file).getBufferIdentifier().str();
+    }
+    
+    // -header-cache: the protocol selectors of a header are written once, as
+    // its record, TUs finding the record leave them out of their shards. The
+    // TU writing a record keeps them, a concurrent job may have won the race.
+    void shareHeaderRecords() {
+        llvm::TimeTraceScope timeScope("DirectableFinder header records");
+        auto &sm = compilerInstance.getSourceManager();
+        bool binary = options.format == DFOptions::ShardFormat::Binary;
+        llvm::StringRef extension = binary ? ".dfshard" : ".json";
+        for (auto &header : headerProtocolSels) {
+            auto content = sm.getBufferDataIfLoaded(header.first);
+            if (!content) continue;
+            string source = headerName(header.first);
+            string key = headerRecordKey(source, *content);
+            
+            auto existing = readHeaderRecord(options.outputDir, options.store, key, extension);
+            if (!existing) {
+                llvm::errs() << "directable-finder: " << llvm::toString(existing.takeError()) << "\n";
+                continue;
+            }
+            if (*existing) {
+                auto record = readShard(**existing);
+                if (!record) {
+                    llvm::errs() << "directable-finder: header record " << key << ": " << llvm::toString(record.takeError()) << "\n";
+                    continue;
+                }
+                for (auto &sel : record->sels) {
+                    sharedSels.insert(sel);
+                }
+                ++NumHeaderRecordsReused;
+                continue;
+            }
+            
+            DirectableShard record;
+            for (auto sel : header.second) {
+                record.sels.push_back(sel.getAsString());
+            }
+            sortUnique(record.sels);
+            record.hasSummary = options.summary;
+            string recordContent = binary ? shardToBinary(record, options.compress) : shardToJSON(record);
+            auto written = commitHeaderRecord(options.outputDir, options.store, key, source, recordContent, extension);
+            if (!written) {
+                llvm::errs() << "directable-finder: " << llvm::toString(written.takeError()) << "\n";
+                continue;
+            }
+            if (*written) {
+                ++NumHeaderRecordsWritten;
+                NumShardBytesWritten += recordContent.size();
+            }
+        }
     }
     
     void dump() {
-        Array selArray = Array();
-        for (auto i = undirectableSeletorRefList.begin(), e = undirectableSeletorRefList.end(); i != e ; i++) {
-            selArray.push_back(Value(i->first));
-        }
-        
-        Array overrideArray = Array();
-        for (auto i = undirectableReadableList.begin(), e = undirectableReadableList.end(); i != e ; i++) {
-            overrideArray.push_back(Value(*i));
-        }
-
-        Array methArray = Array();
-        for (auto i = storage.begin(), e = storage.end(); i != e ; i++) {
-            auto list = i->second;
-            for (auto j = list->begin(), k = list->end(); j != k ; j++) {
-                auto meth = *j;
-                Object methInfoObj = Object();
-                methInfoObj.insert({"name", meth->getFullName()});
-                methInfoObj.insert({"sel", meth->getSelectorName()});
-                methInfoObj.insert({"loc", meth->getFirstDeclLocation()});
-                methInfoObj.insert({"isPropertyAccessor", meth->isPropertyAccessor});
-                methArray.push_back(Value(Object(methInfoObj)));
-            }
-        }
-         
-        Object root = Object();
-        root.insert({"sels", Array(selArray)});
-        root.insert({"meths", Array(methArray)});
-        root.insert({"undirect_meths", Array(overrideArray)});
-        string content = llvm::formatv("{0:2}", Value(Object(root)));
-        string path = string(<#give me a directory path to store results#>) + name + to_string(llvm::MD5Hash(content)) + string(".json");
-        error_code ec = error_code();
-        llvm::raw_fd_ostream *out = new llvm::raw_fd_stream(path, ec);
-        
-        *out << content;
-        out->flush();
+        llvm::TimeTraceScope timeScope("DirectableFinder dump");
+        if (options.headerCache) shareHeaderRecords();
+        auto shard = materialize();
+        if (sink) {
+            sink->consume(move(shard));
+            return;
+        }
+        
+        // a shard file is written when the aggregator isn't running
+        if (!options.aggregatorSocket.empty()) {
+            auto err = sendShardToAggregator(options.aggregatorSocket, shard);
+            if (!err) return;
+            auto &diags = compilerInstance.getDiagnostics();
+            unsigned diagID = diags.getCustomDiagID(DiagnosticsEngine::Remark, "directable-finder: %0, writing a shard file instead");
+            diags.Report(diagID) << llvm::toString(move(err));
+        }
+        
+        bool binary = options.format == DFOptions::ShardFormat::Binary;
+        string content = binary ? shardToBinary(shard, options.compress) : shardToJSON(shard);
+        llvm::SmallString<256> path(options.outputDir);
+        llvm::sys::path::append(path, name + to_string(llvm::MD5Hash(content)) + string(binary ? ".dfshard" : ".json"));
+        if (auto err = writeFileAtomically(path, content)) {
+            llvm::errs() << "directable-finder: " << llvm::toString(move(err)) << "\n";
+            return;
+        }
+        NumShardBytesWritten += content.size();
+    }
+};
+
+mutex DirectableRecorder::processModuleSelsLock;
+llvm::StringMap<vector<string>> DirectableRecorder::processModuleSels;
+
+// Per-TU memo of hierarchy lookups. Every answer is computed once per
+// (interface, selector, isInstance) and reused by all later methods that ask.
+class DeclPositionIndex {
+public:
+    struct Position {
+        ObjCInterfaceDecl *interfaceDecl = NULL;
+        ObjCCategoryDecl *categoryDecl = NULL;
+        bool found() const { return interfaceDecl || categoryDecl; }
+    };
+    
+    struct AccessorHit {
+        ObjCPropertyDecl *propertyDecl = NULL;
+        ObjCCategoryDecl *categoryDecl = NULL;
+    };
+    
+private:
+    using Key = pair<const ObjCInterfaceDecl *, Selector>;
+    
+    SourceManager &sourceManager;
+    // [isInstance] (interface, selector) : topmost declaration from interface upward
+    llvm::DenseMap<Key, Position> chainPositions[2];
+    // interface : (accessor selector : first category property declaring it)
+    llvm::DenseMap<const ObjCInterfaceDecl *, llvm::DenseMap<Selector, AccessorHit>> categoryAccessors;
+    llvm::DenseMap<FileID, bool> userSourceFiles;
+    
+    // declaration on a single level of the chain, primary class wins over its categories
+    Position levelPosition(ObjCInterfaceDecl *cls, Selector sel, bool isInstance, bool searchImp) {
+        ++NumHierarchySteps;
+        Position position;
+        if (cls->getMethod(sel, isInstance)) { // class inherited chain
+            position.interfaceDecl = cls;
+            return position;
+        }
+        
+        if (searchImp) { // class inherited chain's implementation
+            auto clzImp = cls->getImplementation();
+            if (clzImp && clzImp->getMethod(sel, isInstance)) {
+                position.interfaceDecl = cls;
+                return position;
+            }
+        }
+        
+        // class inherited chain's category
+        for (auto category : cls->visible_categories()) {
+            if (category->getMethod(sel, isInstance)) {
+                position.categoryDecl = category;
+                break;
+            }
+        }
+        return position;
+    }
+    
+    // the very first declaration from `cls` up to the root class
+    Position chainPosition(ObjCInterfaceDecl *cls, Selector sel, bool isInstance) {
+        if (!cls) return Position();
+        
+        auto &positions = chainPositions[isInstance];
+        auto cached = positions.find(Key(cls, sel));
+        if (cached != positions.end()) return cached->second;
+        
+        auto position = chainPosition(cls->getSuperClass(), sel, isInstance);
+        if (!position.found()) {
+            position = levelPosition(cls, sel, isInstance, true);
+        }
+        positions[Key(cls, sel)] = position;
+        return position;
+    }
+    
+public:
+    DeclPositionIndex(SourceManager &SM) : sourceManager(SM) {}
+    
+    // the very first declaration of `sel` from `cls` up to the root class
+    Position topmostPosition(ObjCInterfaceDecl *cls, Selector sel, bool isInstance) {
+        return chainPosition(cls, sel, isInstance);
+    }
+    
+    // find the very first declaration postion
+    Position firstDeclPosition(const ObjCMethodDecl *methodDecl) {
+        ++NumHierarchyLookups;
+        auto interfaceDecl = (ObjCInterfaceDecl *)methodDecl->getClassInterface();
+        if (!interfaceDecl) return Position();
+        
+        Selector sel = methodDecl->getSelector();
+        bool isInstance = methodDecl->isInstanceMethod();
+        auto position = chainPosition(interfaceDecl->getSuperClass(), sel, isInstance);
+        if (position.found()) return position;
+        
+        // the method's own implementation doesn't count as a declaration
+        return levelPosition(interfaceDecl, sel, isInstance, false);
+    }
+    
+    // first property in a visible category whose getter or setter is `sel`
+    AccessorHit categoryAccessor(ObjCInterfaceDecl *interfaceDecl, Selector sel) {
+        auto accessors = categoryAccessors.find(interfaceDecl);
+        if (accessors == categoryAccessors.end()) {
+            llvm::TimeTraceScope timeScope("DirectableFinder category accessors", [&] { return interfaceDecl->getNameAsString(); });
+            auto &table = categoryAccessors[interfaceDecl];
+            for (auto category : interfaceDecl->visible_categories()) {
+                for (auto proDecl : category->properties()) {
+                    AccessorHit hit;
+                    hit.propertyDecl = proDecl;
+                    hit.categoryDecl = category;
+                    if (auto getter = proDecl->getGetterMethodDecl()) {
+                        table.insert({getter->getSelector(), hit});
+                    }
+                    if (auto setter = proDecl->getSetterMethodDecl()) {
+                        table.insert({setter->getSelector(), hit});
+                    }
+                }
+            }
+            accessors = categoryAccessors.find(interfaceDecl);
+        }
+        
+        auto hit = accessors->second.find(sel);
+        if (hit == accessors->second.end()) return AccessorHit();
+        return hit->second;
+    }
+    
+    bool isUserSourceDecl(const Decl *decl) {
+        if (!decl) return false;
+        auto fileID = sourceManager.getFileID(decl->getLocation());
+        auto cached = userSourceFiles.find(fileID);
+        if (cached != userSourceFiles.end()) return cached->second;
+        
+        bool isUserSource = false;
+        auto fileEntry = sourceManager.getFileEntryForID(fileID);
+        if (fileEntry) {
+            llvm::StringRef filename = fileEntry->getName();
+            isUserSource = !filename.empty() && !filename.startswith("/Applications/Xcode");
+        }
+        userSourceFiles[fileID] = isUserSource;
+        return isUserSource;
+    }
+};
+
+// Tells from the tokens of a C or C++ function whether its statements can hold
+// anything the visitor records: message sends, `@` expressions, blocks and,
+// when sends to typed receivers are recorded, property dot syntax. Raw lexing
+// a body is much cheaper than walking its statements, and most of an ObjC++ TU
+// is such code. Macros are looked into, one whose expansion isn't known counts
+// as ObjC. `[` only starts a send where an operand can start, subscripts of
+// names come after one; lambdas and attributes are taken as sends. Subscripts
+// are sends too when the operand is an object (`array[i]`, `dict[key]`), only
+// the AST tells, bodies with subscripts are reported as such.
+class ObjCTokenFilter {
+public:
+    enum class BodyTokens { None, Subscripts, ObjC };
+    
+private:
+    struct MacroTokens {
+        bool objC;
+        bool subscripts;
+    };
+    
+    SourceManager &sourceManager;
+    Preprocessor &preprocessor;
+    bool dotSyntax;
+    llvm::DenseMap<const IdentifierInfo *, MacroTokens> macros;
+    
+    // the token before the current one, raw tokens only live while lexed
+    struct ScanState {
+        bool previousEndsOperand = false;
+        bool subscripts = false;
+    };
+    
+    const IdentifierInfo *identifierOf(const Token &token) {
+        if (token.is(tok::raw_identifier)) return preprocessor.getIdentifierInfo(token.getRawIdentifier());
+        return token.getIdentifierInfo();
+    }
+    
+    bool isObjCToken(ScanState &state, const Token &token, unsigned depth) {
+        auto identifier = identifierOf(token);
+        if (token.isOneOf(tok::at, tok::caret)) return true;
+        if (dotSyntax && token.is(tok::period)) return true;
+        if (token.is(tok::l_square)) {
+            if (!state.previousEndsOperand) return true;
+            state.subscripts = true;
+        }
+        if (identifier && identifier->hadMacroDefinition()) {
+            auto macro = macroTokens(identifier, depth);
+            if (macro.objC) return true;
+            state.subscripts |= macro.subscripts;
+        }
+        // keywords such as `return` precede operands, `for (x in [...])` too, and
+        // a `)` may close a cast or an if condition
+        state.previousEndsOperand = token.is(tok::r_square) || tok::isLiteral(token.getKind())
+            || (identifier && identifier->getTokenID() == tok::identifier && !identifier->isStr("in"));
+        return false;
+    }
+    
+    MacroTokens macroTokens(const IdentifierInfo *identifier, unsigned depth) {
+        auto cached = macros.find(identifier);
+        if (cached != macros.end()) return cached->second;
+        // also ends self referencing macros
+        macros[identifier] = {true, false};
+        auto info = preprocessor.getMacroInfo(identifier);
+        bool objC = !info || depth > 8;
+        ScanState state;
+        for (auto &token : info ? info->tokens() : llvm::ArrayRef<Token>()) {
+            if (objC) break;
+            objC = isObjCToken(state, token, depth + 1);
+        }
+        MacroTokens result = {objC, state.subscripts};
+        macros[identifier] = result;
+        return result;
+    }
+    
+public:
+    ObjCTokenFilter(SourceManager &sm, Preprocessor &pp, bool recordsTypedSends) : sourceManager(sm), preprocessor(pp), dotSyntax(recordsTypedSends) {}
+    
+    BodyTokens scan(const FunctionDecl *function) {
+        auto range = function->getSourceRange();
+        if (range.getBegin().isMacroID() || range.getEnd().isMacroID()) return BodyTokens::ObjC;
+        auto begin = sourceManager.getDecomposedLoc(range.getBegin());
+        auto end = sourceManager.getDecomposedLoc(range.getEnd());
+        if (begin.first != end.first || begin.second > end.second) return BodyTokens::ObjC;
+        bool invalid = false;
+        auto buffer = sourceManager.getBufferData(begin.first, &invalid);
+        if (invalid || end.second >= buffer.size()) return BodyTokens::ObjC;
+        
+        // up to the token at the end of the range, the closing brace
+        Lexer lexer(sourceManager.getLocForStartOfFile(begin.first), preprocessor.getLangOpts(), buffer.begin(), buffer.begin() + begin.second, buffer.end());
+        const char *last = buffer.begin() + end.second;
+        ScanState state;
+        Token token;
+        while (lexer.getBufferLocation() <= last) {
+            lexer.LexFromRawLexer(token);
+            if (token.is(tok::eof)) break;
+            if (isObjCToken(state, token, 0)) return BodyTokens::ObjC;
+        }
+        return state.subscripts ? BodyTokens::Subscripts : BodyTokens::None;
+    }
+};
+
+// `array[i]` and `dict[key]` on objects, implicit sends of objectAtIndexedSubscript:,
+// objectForKeyedSubscript: and their setters
+class ObjCSubscriptFinder : public RecursiveASTVisitor<ObjCSubscriptFinder> {
+public:
+    bool found = false;
+    
+    bool shouldWalkTypesOfTypeLocs() const { return false; }
+    
+    bool VisitObjCSubscriptRefExpr(ObjCSubscriptRefExpr *E) {
+        found = true;
+        return false;
+    }
+};
+
+// Receiver classes of `id` and `Class` sends, inferred from the enclosing body.
+// A local variable holds whatever its initializer and every assignment in the
+// body store, allocations, `[Foo class]`, `self` of class methods and casts
+// from typed pointers tell the class. `isKindOfClass:` guards narrow variables
+// that are never reassigned. Anything else (other parameters, ivars,
+// properties, calls, __block variables, variables whose address is taken or
+// that a for-in loop assigns) is unknown.
+class ReceiverInference {
+public:
+    struct ReceiverClass {
+        ObjCInterfaceDecl *interfaceDecl;
+        // the class object, so its class methods are called
+        bool isClassObject;
+    };
+    using ReceiverClasses = llvm::SmallVector<ReceiverClass, 2>;
+    
+private:
+    struct VarFacts {
+        llvm::SmallVector<const Expr *, 2> assignments;
+        bool opaque = false;
+    };
+    
+    // Assignments of the `id` and `Class` variables of a body. Every other use
+    // has to be a load, a variable bound to a C++ reference (`id &r = x`, an
+    // `id &` parameter, std::swap) or otherwise used as an lvalue can be written
+    // where the body doesn't show it and is opaque.
+    class AssignmentCollector : public RecursiveASTVisitor<AssignmentCollector> {
+        llvm::DenseMap<const VarDecl *, VarFacts> &facts;
+        llvm::SmallVector<const DeclRefExpr *, 16> refs;
+        llvm::DenseSet<const DeclRefExpr *> accounted;
+        
+        static const DeclRefExpr *trackedRef(const Expr *E) {
+            auto ref = dyn_cast<DeclRefExpr>(E->IgnoreParens());
+            return ref && trackedVar(ref) ? ref : NULL;
+        }
+        
+        static const VarDecl *trackedVar(const Expr *E) {
+            auto ref = dyn_cast<DeclRefExpr>(E->IgnoreParenImpCasts());
+            if (!ref) return NULL;
+            auto var = dyn_cast<VarDecl>(ref->getDecl());
+            if (!var || !(var->getType()->isObjCIdType() || var->getType()->isObjCClassType())) return NULL;
+            return var;
+        }
+    public:
+        AssignmentCollector(llvm::DenseMap<const VarDecl *, VarFacts> &f) : facts(f) {}
+        
+        // once the body is traversed
+        void finish() {
+            for (auto ref : refs) {
+                if (!accounted.count(ref)) facts[cast<VarDecl>(ref->getDecl())].opaque = true;
+            }
+        }
+        
+        bool VisitDeclRefExpr(DeclRefExpr *E) {
+            if (trackedVar(E)) refs.push_back(E);
+            return true;
+        }
+        
+        bool VisitImplicitCastExpr(ImplicitCastExpr *E) {
+            if (E->getCastKind() != CK_LValueToRValue) return true;
+            if (auto ref = trackedRef(E->getSubExpr())) accounted.insert(ref);
+            return true;
+        }
+        
+        bool VisitBinaryOperator(BinaryOperator *E) {
+            if (!E->isAssignmentOp()) return true;
+            if (auto ref = trackedRef(E->getLHS())) {
+                accounted.insert(ref);
+                facts[cast<VarDecl>(ref->getDecl())].assignments.push_back(E->getRHS());
+            }
+            return true;
+        }
+        
+        bool VisitUnaryOperator(UnaryOperator *E) {
+            if (E->getOpcode() != UO_AddrOf) return true;
+            if (auto var = trackedVar(E->getSubExpr())) {
+                facts[var].opaque = true;
+            }
+            return true;
+        }
+        
+        bool VisitObjCForCollectionStmt(ObjCForCollectionStmt *S) {
+            const VarDecl *var = NULL;
+            if (auto declStmt = dyn_cast<DeclStmt>(S->getElement())) {
+                if (declStmt->isSingleDecl()) var = dyn_cast<VarDecl>(declStmt->getSingleDecl());
+            } else if (auto element = dyn_cast<Expr>(S->getElement())) {
+                var = trackedVar(element);
+            }
+            if (var) facts[var].opaque = true;
+            return true;
+        }
+    };
+    
+    ASTContext &context;
+    llvm::DenseMap<const VarDecl *, VarFacts> facts;
+    llvm::DenseSet<const Stmt *> scannedBodies;
+    // variable : its classes, `None` when unknown
+    llvm::DenseMap<const VarDecl *, llvm::Optional<ReceiverClasses>> resolved;
+    llvm::DenseSet<const VarDecl *> resolving;
+    // `if ([var isKindOfClass:[Foo class]])` whose then branch is being traversed
+    llvm::SmallVector<pair<const VarDecl *, ObjCInterfaceDecl *>, 4> guards;
+    
+    static bool isSelector(Selector sel, llvm::StringRef name, unsigned args) {
+        return sel.getNumArgs() == args && sel.getNameForSlot(0) == name;
+    }
+    
+    const VarFacts &factsFor(const VarDecl *var) {
+        auto owner = dyn_cast<Decl>(var->getDeclContext());
+        auto body = owner ? owner->getBody() : NULL;
+        if (body && scannedBodies.insert(body).second) {
+            AssignmentCollector collector(facts);
+            collector.TraverseStmt(body);
+            collector.finish();
+        }
+        auto &varFacts = facts[var];
+        if (!body) varFacts.opaque = true;
+        return varFacts;
+    }
+    
+    // `self` of a class method
+    static const ObjCMethodDecl *classMethodOfSelf(const VarDecl *var) {
+        auto method = dyn_cast<ObjCMethodDecl>(var->getDeclContext());
+        if (!method || method->getSelfDecl() != var || !method->isClassMethod()) return NULL;
+        return method;
+    }
+    
+    bool inferVar(const VarDecl *var, ReceiverClasses &classes, unsigned depth) {
+        // copied, inferring the assignments scans more bodies into `facts`
+        auto varFacts = factsFor(var);
+        if (varFacts.opaque || var->hasAttr<BlocksAttr>()) return false;
+        if (varFacts.assignments.empty()) {
+            for (auto guard = guards.rbegin(); guard != guards.rend(); ++guard) {
+                if (guard->first != var) continue;
+                classes.push_back({guard->second, false});
+                return true;
+            }
+        }
+        
+        auto selfMethod = classMethodOfSelf(var);
+        if (!selfMethod && !var->isLocalVarDecl()) return false;
+        auto cached = resolved.find(var);
+        if (cached == resolved.end()) {
+            // `x = x` and the like
+            if (!resolving.insert(var).second) return false;
+            ReceiverClasses varClasses;
+            bool known = true;
+            if (selfMethod) {
+                auto interfaceDecl = (ObjCInterfaceDecl *)selfMethod->getClassInterface();
+                known = interfaceDecl != NULL;
+                if (known) varClasses.push_back({interfaceDecl, true});
+            } else if (var->getInit()) {
+                known = infer(var->getInit(), varClasses, depth + 1);
+            } else {
+                // declared without a value, assigned later or nil
+                known = !varFacts.assignments.empty();
+            }
+            for (auto assignment : varFacts.assignments) {
+                if (!known) break;
+                known = infer(assignment, varClasses, depth + 1);
+            }
+            resolving.erase(var);
+            cached = resolved.insert({var, known ? llvm::Optional<ReceiverClasses>(varClasses) : llvm::None}).first;
+        }
+        if (!cached->second) return false;
+        classes.append(cached->second->begin(), cached->second->end());
+        return true;
+    }
+    
+public:
+    ReceiverInference(ASTContext &C) : context(C) {}
+    
+    // adds the classes `expr` can be an instance or the class object of, false when unknown
+    bool infer(const Expr *expr, ReceiverClasses &classes, unsigned depth = 0) {
+        if (!expr || depth > 8) return false;
+        expr = expr->IgnoreParenImpCasts();
+        if (expr->isNullPointerConstant(context, Expr::NPC_ValueDependentIsNotNull)) return true;
+        
+        if (auto pointer = expr->getType()->getAs<ObjCObjectPointerType>()) {
+            if (auto interfaceDecl = pointer->getInterfaceDecl()) {
+                classes.push_back({interfaceDecl, false});
+                return true;
+            }
+        }
+        
+        // (id)typedObject
+        if (auto cast = dyn_cast<ExplicitCastExpr>(expr)) {
+            return infer(cast->getSubExpr(), classes, depth + 1);
+        }
+        
+        if (auto ternary = dyn_cast<ConditionalOperator>(expr)) {
+            return infer(ternary->getTrueExpr(), classes, depth + 1) && infer(ternary->getFalseExpr(), classes, depth + 1);
+        }
+        
+        if (auto ref = dyn_cast<DeclRefExpr>(expr)) {
+            auto var = dyn_cast<VarDecl>(ref->getDecl());
+            return var && inferVar(var, classes, depth);
+        }
+        
+        auto message = dyn_cast<ObjCMessageExpr>(expr);
+        if (!message) return false;
+        ReceiverClasses receivers;
+        if (message->getReceiverKind() == ObjCMessageExpr::Class) {
+            auto interfaceDecl = message->getReceiverInterface();
+            if (!interfaceDecl) return false;
+            receivers.push_back({interfaceDecl, true});
+        } else if (message->getReceiverKind() != ObjCMessageExpr::Instance || !infer(message->getInstanceReceiver(), receivers, depth + 1)) {
+            return false;
+        }
+        
+        // [Foo class], [obj class]
+        if (isSelector(message->getSelector(), "class", 0)) {
+            for (auto &receiver : receivers) {
+                classes.push_back({receiver.interfaceDecl, true});
+            }
+            return true;
+        }
+        
+        // alloc, new, init and instancetype returns typed as id
+        auto family = message->getMethodFamily();
+        auto method = message->getMethodDecl();
+        if (family == OMF_alloc || family == OMF_new || family == OMF_init || (method && method->hasRelatedResultType())) {
+            for (auto &receiver : receivers) {
+                classes.push_back({receiver.interfaceDecl, false});
+            }
+            return true;
+        }
+        return false;
+    }
+    
+    // `[var isKindOfClass:[Foo class]]` or `[var isMemberOfClass:[Foo class]]`,
+    // on its own or as a conjunct of `cond`
+    pair<const VarDecl *, ObjCInterfaceDecl *> kindOfGuard(const Expr *cond) {
+        if (!cond) return {NULL, NULL};
+        cond = cond->IgnoreParenImpCasts();
+        if (auto binary = dyn_cast<BinaryOperator>(cond)) {
+            if (binary->getOpcode() != BO_LAnd) return {NULL, NULL};
+            auto guard = kindOfGuard(binary->getLHS());
+            return guard.first ? guard : kindOfGuard(binary->getRHS());
+        }
+        
+        auto message = dyn_cast<ObjCMessageExpr>(cond);
+        if (!message || message->getReceiverKind() != ObjCMessageExpr::Instance) return {NULL, NULL};
+        auto sel = message->getSelector();
+        if (!isSelector(sel, "isKindOfClass", 1) && !isSelector(sel, "isMemberOfClass", 1)) return {NULL, NULL};
+        auto ref = dyn_cast<DeclRefExpr>(message->getInstanceReceiver()->IgnoreParenImpCasts());
+        auto var = ref ? dyn_cast<VarDecl>(ref->getDecl()) : NULL;
+        auto argument = dyn_cast<ObjCMessageExpr>(message->getArg(0)->IgnoreParenImpCasts());
+        if (!var || !argument || argument->getReceiverKind() != ObjCMessageExpr::Class || !isSelector(argument->getSelector(), "class", 0)) return {NULL, NULL};
+        auto interfaceDecl = argument->getReceiverInterface();
+        if (!interfaceDecl) return {NULL, NULL};
+        return {var, interfaceDecl};
+    }
+    
+    void pushGuard(pair<const VarDecl *, ObjCInterfaceDecl *> guard) {
+        guards.push_back(guard);
+    }
+    
+    void popGuard() {
+        guards.pop_back();
     }
 };
 
 class MethVisitor : public RecursiveASTVisitor<MethVisitor> {
     DirectableRecorder &recorder;
+    DeclPositionIndex index;
+    ReceiverInference inference;
+    ObjCTokenFilter tokenFilter;
+    // -verbose log, written in one piece once the TU is done
+    string verboseLog;
+    llvm::raw_string_ostream verboseOut;
 public:
-    MethVisitor(DirectableRecorder &m) : recorder(m) {}
+    MethVisitor(DirectableRecorder &m) : recorder(m), index(m.getCompilerInstance().getSourceManager()), inference(m.getCompilerInstance().getASTContext()), tokenFilter(m.getCompilerInstance().getSourceManager(), m.getCompilerInstance().getPreprocessor(), m.options.summary || m.options.sendCounts), verboseOut(verboseLog) {}
+    
+    void writeVerboseLog(llvm::raw_ostream &out) {
+        out << verboseOut.str();
+    }
+    
+    // nothing is recorded from the types spelled in declarations
+    bool shouldWalkTypesOfTypeLocs() const { return false; }
     
+    // tokens first, a body with subscripts is searched for ObjC ones
+    bool mayContainObjC(FunctionDecl *function) {
+        switch (tokenFilter.scan(function)) {
+        case ObjCTokenFilter::BodyTokens::None:
+            return false;
+        case ObjCTokenFilter::BodyTokens::Subscripts: {
+            ++NumSubscriptChecks;
+            ObjCSubscriptFinder finder;
+            finder.TraverseDecl(function);
+            return finder.found;
+        }
+        case ObjCTokenFilter::BodyTokens::ObjC:
+            return true;
+        }
+        return true;
+    }
+    
+    // C and C++ bodies without ObjC tokens send no messages, common in ObjC++ TUs
+    bool TraverseDecl(Decl *D) {
+        auto function = dyn_cast_or_null<FunctionDecl>(D);
+        if (recorder.options.pruneBodies && function && function->doesThisDeclarationHaveABody() && !mayContainObjC(function)) {
+            ++NumFunctionsPruned;
+            return true;
+        }
+        return RecursiveASTVisitor<MethVisitor>::TraverseDecl(D);
+    }
     
     // @selector(meth),
     // meth can't be marked as direct since msg reciver is undetermined
     bool VisitObjCSelectorExpr(ObjCSelectorExpr *E) {
         recorder.insertToUndirectableSel(E->getSelector());
+        if (recorder.options.summary) recorder.noteSelectorRef(E->getSelector());
         return true;
     }
     
     // protocl selector can't be direct
     // 'objc_direct' attribute cannot be applied to methods declared in an Objective-C protocol
     bool VisitObjCProtocolDecl(const ObjCProtocolDecl *D) {
+        if (recorder.isCoveredBySDKSelectors(D)) return true;
         for (auto method = D->meth_begin(), methodEnd = D->meth_end(); method != methodEnd; method++) {
-            recorder.insertToUndirectableSel(method->getSelector());
+            recorder.insertProtocolSel(method->getSelector());
         }
+        if (recorder.options.headerCache) recorder.noteHeaderProtocol(D);
         return true;
     }
     
+    // -summary: conformances a user category adds, also when no TU implementing
+    // the class sees the category, the merge only finds adopters among the
+    // classes of the summaries
+    bool VisitObjCCategoryDecl(const ObjCCategoryDecl *D) {
+        if (!recorder.options.summary || D->protocol_empty() || !isUserSourceDecl(D)) return true;
+        noteHierarchy(D->getClassInterface());
+        return true;
+    }
+    
+    // `isKindOfClass:` guards hold in the then branch
+    bool TraverseIfStmt(IfStmt *S) {
+        auto guard = inference.kindOfGuard(S->getCond());
+        if (!guard.first) return RecursiveASTVisitor<MethVisitor>::TraverseIfStmt(S);
+        if (!TraverseStmt(S->getInit()) || !TraverseStmt(S->getConditionVariableDeclStmt()) || !TraverseStmt(S->getCond())) return false;
+        inference.pushGuard(guard);
+        bool result = TraverseStmt(S->getThen());
+        inference.popGuard();
+        return result && TraverseStmt(S->getElse());
+    }
+    
     bool VisitObjCMessageExpr(const ObjCMessageExpr *OME) {
         // [(id)obj message];
         // [clz message];
-        if (OME->getReceiverType()->isObjCIdType() || OME->getReceiverType()->isObjCClassType()) {
+        auto receiverType = OME->getReceiverType();
+        if (receiverType->isObjCIdType() || receiverType->isObjCClassType()) {
+            // only the methods the inferred receiver classes reach can't be direct
+            if (markReachableMethods(OME)) return true;
             recorder.insertToUndirectableSel(OME->getSelector());
+            if (recorder.options.summary) recorder.noteDynamicSend(OME->getSelector());
+            return true;
+        }
+        // [(id<Protocol>)obj message]; the protocol declares the selector, which
+        // only -summary resolves per class
+        if (receiverType->isObjCQualifiedIdType() || receiverType->isObjCQualifiedClassType()) {
+            if (recorder.options.summary) recorder.noteDynamicSend(OME->getSelector());
             return true;
         }
+        if (recorder.options.summary) {
+            recorder.noteStaticRef(OME->getReceiverInterface(), OME->getSelector(), OME->isInstanceMessage());
+        }
+        if (recorder.options.sendCounts) noteSend(OME);
         return true;
     }
     
     bool VisitObjCImplementationDecl(ObjCImplementationDecl *impDecl) {
         auto impClassInterface = impDecl->getClassInterface();
+        llvm::TimeTraceScope timeScope("DirectableFinder implementation", [&] { return impClassInterface->getNameAsString(); });
         recorder.name = impClassInterface->getNameAsString();
         
         // some override property that getter and setter is provider by superclass,
@@ -284,6 +1402,10 @@ public:
             auto methodDecl = *method;
             handleMeth(methodDecl, impClassInterface);
         }
+        
+        if (recorder.options.summary) {
+            noteImplementation(impClassInterface, impDecl);
+        }
         return true;
     }
     
@@ -291,9 +1413,14 @@ public:
         auto categoryDecl = D->getCategoryDecl();
         auto impClassInterface = D->getClassInterface();
         auto name = impClassInterface->getNameAsString();
+        llvm::TimeTraceScope timeScope("DirectableFinder category implementation", [&] { return name + "+" + categoryDecl->getNameAsString(); });
         recorder.name = name + "+" + categoryDecl->getNameAsString();
+        if (recorder.options.summary) {
+            noteImplementation(impClassInterface, D);
+        }
         
         for (auto method = D->meth_begin(), methodEnd = D->meth_end(); method != methodEnd; method++) {
+            ++NumMethodsVisited;
             if (method->isDirectMethod()) continue;
             if (method->isOverriding()) continue;
             
@@ -308,7 +1435,7 @@ public:
                 
                 if (metThisError) {
                     // this property can't be direct
-                    auto getterName = Tool::generateReadableName(categoryDeclHit, propertyDeclHit->getGetterMethodDecl());
+                    auto getterName = MethodNameKey::make(categoryDeclHit, propertyDeclHit->getGetterMethodDecl());
                     recorder.insertUndirectableMethodName(getterName);
                 } else {
                     // otherwise, it can
@@ -328,7 +1455,7 @@ public:
                         
                         // not exist in the category header but primary class/superclass' header, it's undirectable
                         if (interfaceDecl || categoryDecll) {
-                            string name = generateName(*method, interfaceDecl, categoryDecl);
+                            auto name = generateName(*method, interfaceDecl, categoryDecl);
                             recorder.insertUndirectableMethodName(name);
                         } else {
                             recorder.insertDirectableMethod(categoryDecl, *method);
@@ -341,52 +1468,96 @@ public:
     }
     
 private:
-    bool findDeclInExtButImpInDiffCategory(ObjCMethodDecl *method,  ObjCInterfaceDecl *impClassInterface, ObjCPropertyDecl **propertyDeclHitPtr, ObjCCategoryDecl **categoryDeclHitPtr) {
-        bool metThisError = false;
-        auto methName = method->getNameAsString();
-        auto category = impClassInterface->visible_categories().begin();
-        auto categoryEnd = impClassInterface->visible_categories().end();
-        while (category != categoryEnd) {
-            auto categoryName = category->getNameAsString();
-            auto cat = *category;
-            for (auto pro = cat->prop_begin(), proEnd = cat->prop_end(); pro != proEnd; pro++) {
-                auto proDecl = *pro;
-                auto getter = proDecl->getGetterMethodDecl();
-                if (!metThisError && getter) {
-                    auto getterName = getter->getNameAsString();
-                    if (methName == getterName) {
-                        *propertyDeclHitPtr = proDecl;
-                        *categoryDeclHitPtr = cat;
-                        metThisError = true;
-                        break;
-                    }
-                }
-            
-                auto setter = proDecl->getSetterMethodDecl();
-                if (!metThisError && setter) {
-                    auto setterName = setter->getNameAsString();
-                    if (metThisError == false && methName == setterName) {
-                        *propertyDeclHitPtr = proDecl;
-                        *categoryDeclHitPtr = cat;
-                        metThisError = true;
-                        break;
-                    }
-                }
+    // -send-counts: a send the method of which is known, under the name of its
+    // candidate; accessors through their getter
+    void noteSend(const ObjCMessageExpr *OME) {
+        auto methodDecl = OME->getMethodDecl();
+        if (!methodDecl || methodDecl->isDirectMethod()) return;
+        auto position = index.firstDeclPosition(methodDecl);
+        if (!position.found()) return;
+        auto &sm = recorder.getCompilerInstance().getSourceManager();
+        recorder.noteSend(generateName(methodDecl, position.interfaceDecl, position.categoryDecl), sm.getExpansionLoc(OME->getBeginLoc()));
+    }
+    
+    bool markReachableMethods(const ObjCMessageExpr *OME) {
+        if (OME->getReceiverKind() != ObjCMessageExpr::Instance) return false;
+        ReceiverInference::ReceiverClasses receivers;
+        if (!inference.infer(OME->getInstanceReceiver(), receivers) || receivers.empty()) return false;
+        
+        auto sel = OME->getSelector();
+        llvm::SmallVector<MethodNameKey, 2> names;
+        for (auto &receiver : receivers) {
+            auto interfaceDecl = receiver.interfaceDecl->getDefinition();
+            if (!interfaceDecl) return false;
+            bool isInstance = !receiver.isClassObject;
+            // overrides in subclasses are undirectable anyway, but a method a
+            // subclass declares first can't be told apart from here
+            auto position = index.topmostPosition(interfaceDecl, sel, isInstance);
+            if (!position.found()) return false;
+            names.push_back(generateName(sel, isInstance, position.interfaceDecl, position.categoryDecl));
+        }
+        for (auto &name : names) {
+            recorder.insertUndirectableMethodName(name);
+        }
+        if (recorder.options.summary) {
+            for (auto &receiver : receivers) {
+                recorder.noteStaticRef(receiver.interfaceDecl, sel, !receiver.isClassObject);
             }
-            if (metThisError) break;
-            category++;
         }
-        return metThisError;
+        ++NumSendsNarrowed;
+        return true;
+    }
+    
+    // -summary: the class and its superclasses
+    void noteHierarchy(const ObjCInterfaceDecl *interfaceDecl) {
+        for (auto cls = interfaceDecl; cls && !recorder.hasNotedClass(cls); cls = cls->getSuperClass()) {
+            recorder.noteClass(cls, isUserSourceDecl(cls));
+        }
+    }
+    
+    // -summary: the implemented class, its superclasses and what the TU implements
+    void noteImplementation(const ObjCInterfaceDecl *interfaceDecl, const ObjCImplDecl *impDecl) {
+        noteHierarchy(interfaceDecl);
+        for (auto meth : impDecl->methods()) {
+            recorder.noteImplemented(interfaceDecl, meth);
+            if (isCalledFromOutside(meth)) {
+                recorder.noteStaticRef(interfaceDecl, meth->getSelector(), meth->isInstanceMethod());
+            }
+        }
+    }
+    
+    // implemented methods that are called although the sources may never send
+    // them: by the runtime or frameworks through the system declaration they
+    // override, from nibs, or synthesized for a property
+    bool isCalledFromOutside(const ObjCMethodDecl *meth) {
+        if (meth->isImplicit() || meth->hasAttr<IBActionAttr>()) return true;
+        llvm::SmallVector<const ObjCMethodDecl *, 4> overridden;
+        meth->getOverriddenMethods(overridden);
+        for (auto decl : overridden) {
+            if (!isUserSourceDecl(decl)) return true;
+        }
+        return false;
+    }
+    
+    bool findDeclInExtButImpInDiffCategory(ObjCMethodDecl *method,  ObjCInterfaceDecl *impClassInterface, ObjCPropertyDecl **propertyDeclHitPtr, ObjCCategoryDecl **categoryDeclHitPtr) {
+        auto hit = index.categoryAccessor(impClassInterface, method->getSelector());
+        if (!hit.propertyDecl) return false;
+        *propertyDeclHitPtr = hit.propertyDecl;
+        *categoryDeclHitPtr = hit.categoryDecl;
+        return true;
+    }
+    
+    MethodNameKey generateName(const ObjCMethodDecl *methodDecl, ObjCInterfaceDecl *interfaceDecl, ObjCCategoryDecl *categoryDecl) {
+        if (!methodDecl) return MethodNameKey();
+        return generateName(methodDecl->getSelector(), methodDecl->isInstanceMethod(), interfaceDecl, categoryDecl);
     }
     
-    string generateName(const ObjCMethodDecl *methodDecl, ObjCInterfaceDecl *interfaceDecl, ObjCCategoryDecl *categoryDecl) {
-        if ((!interfaceDecl && !categoryDecl) || !methodDecl) {
-            return "";
+    MethodNameKey generateName(Selector sel, bool isInstance, ObjCInterfaceDecl *interfaceDecl, ObjCCategoryDecl *categoryDecl) {
+        if (!interfaceDecl && !categoryDecl) {
+            return MethodNameKey();
         }
         
-        string name;
-        auto sel = methodDecl->getSelector();
-        auto isInstance = methodDecl->isInstanceMethod();
+        MethodNameKey name;
         if (isUserSourceDecl(interfaceDecl)) {
             auto primaryMethDecl = interfaceDecl->getMethod(sel, isInstance);
             if (!primaryMethDecl) { // on interface's implementation
@@ -396,26 +1567,29 @@ private:
             if (primaryMethDecl->isPropertyAccessor()) {
                 // use getter name as property identifier
                 auto p = primaryMethDecl->findPropertyDecl();
-                name = Tool::generateReadableName(interfaceDecl, p->getGetterMethodDecl());
+                name = MethodNameKey::make(interfaceDecl, p->getGetterMethodDecl());
             } else {
-                name = Tool::generateReadableName(interfaceDecl, primaryMethDecl);
+                name = MethodNameKey::make(interfaceDecl, primaryMethDecl);
             }
         } else if (isUserSourceDecl(categoryDecl)) {
             auto categoryMethDecl = categoryDecl->getMethod(sel, isInstance);
             if (categoryMethDecl && categoryMethDecl->isPropertyAccessor()) {
                 auto p = categoryMethDecl->findPropertyDecl();
-                name = Tool::generateReadableName(categoryDecl, p->getGetterMethodDecl());
+                name = MethodNameKey::make(categoryDecl, p->getGetterMethodDecl());
             } else {
-                name = Tool::generateReadableName(categoryDecl, categoryMethDecl);
+                name = MethodNameKey::make(categoryDecl, categoryMethDecl);
             }
         }
         return name;
     }
 
     void handleMeth(ObjCMethodDecl *methodDecl, ObjCInterfaceDecl *passInInterfaceDecl) {
-        llvm::outs() << "LOC:  " << methodDecl->getLocation().printToString(recorder.getCompilerInstance().getSourceManager()) << "\n";
+        ++NumMethodsVisited;
         auto methodName = methodDecl->getNameAsString();
-        llvm::outs() << "NAME: " << methodName << "\n";
+        if (recorder.options.verbose) {
+            verboseOut << "LOC:  " << methodDecl->getLocation().printToString(recorder.getCompilerInstance().getSourceManager()) << "\n";
+            verboseOut << "NAME: " << methodName << "\n";
+        }
         
         if (methodDecl->isDirectMethod()) return;
         if (methodName == ".cxx_destruct") return;
@@ -434,7 +1608,7 @@ private:
         
         // overriding decl, exist in super class/super class category, protocol
         if (methodDecl->isOverriding()) {
-            string name = generateName(methodDecl, interfaceDecl, categoryDecl);
+            auto name = generateName(methodDecl, interfaceDecl, categoryDecl);
             recorder.insertUndirectableMethodName(name);
         // override
         } else {
@@ -446,7 +1620,7 @@ private:
                 // case:
                 // class A               -height
                 // class B: class A      @height
-                string name = generateName(methodDecl, interfaceDecl, categoryDecl);
+                auto name = generateName(methodDecl, interfaceDecl, categoryDecl);
                 recorder.insertUndirectableMethodName(name);
                 return;
             }
@@ -480,7 +1654,7 @@ private:
                         bool superHasDecl = (pinterfaceDecl && pSetter->getClassInterface() != pinterfaceDecl);
                         superHasDecl = superHasDecl || (pcategoryDecl && pcategoryDecl->getClassInterface() != pSetter->getClassInterface());
                         if (pGetter && superHasDecl) {
-                            string name = generateName(pGetter, pinterfaceDecl, pcategoryDecl);
+                            auto name = generateName(pGetter, pinterfaceDecl, pcategoryDecl);
                             recorder.insertUndirectableMethodName(name);
                             return;
                         }
@@ -498,7 +1672,7 @@ private:
                         bool superHasDecl = (pinterfaceDecl && pGetter->getClassInterface() != pinterfaceDecl);
                         superHasDecl = superHasDecl || (pcategoryDecl && pcategoryDecl->getClassInterface() != pGetter->getClassInterface());
                         if (pGetter && superHasDecl) {
-                            string name = generateName(pGetter, pinterfaceDecl, pcategoryDecl);
+                            auto name = generateName(pGetter, pinterfaceDecl, pcategoryDecl);
                             recorder.insertUndirectableMethodName(name);
                             return;
                         }
@@ -518,102 +1692,318 @@ private:
     
     // find the very first declaration postion
     void findFirstDeclPosition(const ObjCMethodDecl *methodDecl, ObjCInterfaceDecl **interfaceDeclPtr, ObjCCategoryDecl **categoryDeclPtr) {
-
-        bool searchWholePath = true;
-
-        ObjCInterfaceDecl *interfaceDecl = (ObjCInterfaceDecl *)methodDecl->getClassInterface();
-        ObjCCategoryDecl *categoryDecl = NULL;
-        bool classDeclFound = false;
-        bool categoryDeclFound = false;
-        ObjCInterfaceDecl *primaryClassCursor = interfaceDecl;
-        
-        Selector sel = methodDecl->getSelector();
-        bool isInstance = methodDecl->isInstanceMethod();
-
-        while (primaryClassCursor != NULL) {
-            auto primaryMethDecl = primaryClassCursor->getMethod(sel, isInstance);
-            
-            ObjCMethodDecl *methInImp = NULL;
-            if (!primaryMethDecl && primaryClassCursor != interfaceDecl) { // superclass' implementation
-                auto cursorClzImp = primaryClassCursor->getImplementation();
-                if (cursorClzImp) {
-                    methInImp = cursorClzImp->getMethod(sel, isInstance);
-                }
-            }
-            
-            if (primaryMethDecl) { // class inherited chain
-                interfaceDecl = primaryClassCursor;
-                classDeclFound = true;
-                categoryDeclFound = false;
-                if (!searchWholePath) break;
-            } else if (methInImp) { // class inherited chain's implementation
-                interfaceDecl = primaryClassCursor;
-                classDeclFound = true;
-                categoryDeclFound = false;
-                if (!searchWholePath) break;
-            } else {
-                // class inherited chain's category
-                auto begin = primaryClassCursor->visible_categories().begin(), end = primaryClassCursor->visible_categories().end();
-                while (begin != end) {
-                    auto category = *begin;
-                    auto categoryMethDecl = category->getMethod(sel, isInstance);
-                    if (categoryMethDecl) {
-                        categoryDecl = category;
-                        categoryDeclFound = true;
-                        classDeclFound = false;
-                        break;
-                    }
-                    begin++;
-                }
-                if (!searchWholePath) {
-                    if (categoryDeclFound) break;
-                }
-            }
-            primaryClassCursor = primaryClassCursor->getSuperClass();
-        }
-        
-        if (classDeclFound) {
-            *interfaceDeclPtr = interfaceDecl;
+        auto position = index.firstDeclPosition(methodDecl);
+        if (position.interfaceDecl) {
+            *interfaceDeclPtr = position.interfaceDecl;
         }
 
-        if (categoryDeclFound) {
-            *categoryDeclPtr = categoryDecl;
+        if (position.categoryDecl) {
+            *categoryDeclPtr = position.categoryDecl;
         }
     }
 
     bool isUserSourceDecl(const Decl *decl) {
-        if (!decl) return false;
-        string filename = recorder.getCompilerInstance().getSourceManager().getFilename(decl->getLocation()).str();
-        if (filename.empty()) return false;
-        return (filename.find("/Applications/Xcode") != 0);
+        return index.isUserSourceDecl(decl);
+    }
+};
+
+// collects the selectors of every protocol declared in a system header, for -index-sdk-selectors
+class SDKSelectorCollector : public RecursiveASTVisitor<SDKSelectorCollector> {
+    SourceManager &sourceManager;
+public:
+    vector<string> sels;
+    SDKSelectorCollector(SourceManager &SM) : sourceManager(SM) {}
+    
+    bool VisitObjCProtocolDecl(const ObjCProtocolDecl *D) {
+        if (!sourceManager.isInSystemHeader(D->getLocation())) return true;
+        for (auto method = D->meth_begin(), methodEnd = D->meth_end(); method != methodEnd; method++) {
+            sels.push_back(method->getSelector().getAsString());
+        }
+        return true;
+    }
+};
+
+// Commits the shard of a TU to a -store directory under the TU's manifest key.
+class StoreSink : public ShardSink {
+    CompilerInstance &compilerInstance;
+    const DFOptions &options;
+    string key;
+    ManifestEntry entry;
+public:
+    StoreSink(CompilerInstance &CI, const DFOptions &opts, string k, ManifestEntry e) : compilerInstance(CI), options(opts), key(move(k)), entry(move(e)) {}
+    
+    void consume(DirectableShard shard) override {
+        bool binary = options.format == DFOptions::ShardFormat::Binary;
+        string content = binary ? shardToBinary(shard, options.compress) : shardToJSON(shard);
+        if (auto err = commitShardToStore(options.outputDir, key, entry, content, binary ? ".dfshard" : ".json")) {
+            auto &diags = compilerInstance.getDiagnostics();
+            unsigned diagID = diags.getCustomDiagID(DiagnosticsEngine::Error, "directable-finder: %0");
+            diags.Report(diagID) << llvm::toString(move(err));
+            return;
+        }
+        NumShardBytesWritten += content.size();
     }
 };
 
 class DFConsumer : public ASTConsumer {
     CompilerInstance &compilerInstance;
+    DFOptions options;
+    ShardSink *sink;
 public:
-    DFConsumer(CompilerInstance &CI) : compilerInstance(CI) {}
+    DFConsumer(CompilerInstance &CI, const DFOptions &opts, ShardSink *s) : compilerInstance(CI), options(opts), sink(s) {}
     
     // 处理 TranslationUnit
     void HandleTranslationUnit(ASTContext &Ctx) override {
+        if (!options.indexSDKSelectorsPath.empty()) {
+            indexSDKSelectors(Ctx);
+            return;
+        }
+        
+        llvm::TimeTraceScope timeScope("DirectableFinder");
+        // declared before the recorder, which hands its shard over when destroyed
+        unique_ptr<StoreSink> storeSink;
+        if (!sink && options.store) {
+            string key = storeKey();
+            ManifestEntry entry;
+            entry.source = mainFileName();
+            entry.inputs = inputsHash();
+            // nothing this TU read changed since its shard was stored
+            if (isManifestEntryUpToDate(options.outputDir, key, entry.inputs)) return;
+            storeSink = std::make_unique<StoreSink>(compilerInstance, options, move(key), move(entry));
+        }
+        
         DirectableRecorder recorder(compilerInstance);
+        recorder.options = options;
+        recorder.sink = storeSink ? storeSink.get() : sink;
+        recorder.setSDKSelectors(options.sdkSelectors.get());
+        recorder.setDynamicSelectors(options.dynamicSelectors.get());
         MethVisitor v(recorder);
-        TranslationUnitDecl *unit = Ctx.getTranslationUnitDecl();
-        v.TraverseDecl(unit);
+        traverse(v, Ctx.getTranslationUnitDecl(), recorder);
+        if (options.verbose) {
+            v.writeVerboseLog(llvm::outs());
+        }
+    }
+    
+    void traverse(MethVisitor &v, TranslationUnitDecl *unit, DirectableRecorder &recorder) {
+        llvm::TimeTraceScope timeScope("DirectableFinder traversal");
+        if (!options.localDeclsOnly) {
+            v.TraverseDecl(unit);
+            return;
+        }
+        
+        if (compilerInstance.hasSema()) {
+            recorder.setExternalProtocolSource(&compilerInstance.getSema());
+            if (auto reader = compilerInstance.getASTReader()) recorder.insertExternalProtocolSels(*reader);
+        }
+        // noload_decls() doesn't pull in the external lexical decls of the TU
+        for (auto decl : unit->noload_decls()) {
+            if (decl->isFromASTFile()) continue;
+            v.TraverseDecl(decl);
+        }
+    }
+    
+    string mainFileName() {
+        auto &sm = compilerInstance.getSourceManager();
+        if (auto fileEntry = sm.getFileEntryForID(sm.getMainFileID())) {
+            auto realPath = fileEntry->tryGetRealPathName();
+            return (realPath.empty() ? fileEntry->getName() : realPath).str();
+        }
+        return sm.getBufferOrFake(sm.getMainFileID()).getBufferIdentifier().str();
+    }
+    
+    // the main file and the options that change its AST, so every build
+    // configuration (device/simulator, Debug/Release) of a file has its own entry
+    string storeKey() {
+        llvm::MD5 hash;
+        hash.update(mainFileName());
+        hash.update(llvm::StringRef("\0", 1));
+        hash.update(compilerInstance.getInvocation().getModuleHash());
+        llvm::MD5::MD5Result digest;
+        hash.final(digest);
+        return digest.digest().str().str();
+    }
+    
+    // every file the TU read, the modules/PCH it imported and the options that
+    // change the shard
+    string inputsHash() {
+        auto &sm = compilerInstance.getSourceManager();
+        vector<pair<llvm::StringRef, string>> files;
+        for (auto it = sm.fileinfo_begin(), end = sm.fileinfo_end(); it != end; ++it) {
+            string fingerprint;
+            if (auto buffer = it->second->getBufferIfLoaded()) {
+                fingerprint = to_string(llvm::xxHash64(buffer->getBuffer()));
+            } else {
+                fingerprint = to_string(it->first->getSize()) + ":" + to_string(it->first->getModificationTime());
+            }
+            files.push_back({it->first->getName(), move(fingerprint)});
+        }
+        if (auto reader = compilerInstance.getASTReader()) {
+            for (auto &moduleFile : reader->getModuleManager()) {
+                string signature = llvm::toHex(llvm::ArrayRef<uint8_t>(moduleFile.Signature.data(), moduleFile.Signature.size()));
+                files.push_back({moduleFile.FileName, to_string(moduleFile.Size) + ":" + to_string(moduleFile.ModTime) + ":" + signature});
+            }
+        }
+        // file info is kept in a hash table
+        llvm::sort(files);
+        
+        llvm::MD5 hash;
+        for (auto &file : files) {
+            hash.update(file.first);
+            hash.update(llvm::StringRef("\0", 1));
+            hash.update(file.second);
+        }
+        hash.update(options.format == DFOptions::ShardFormat::Binary ? "binary" : "json");
+        hash.update(options.compress ? "compress" : "");
+        hash.update(options.localDeclsOnly ? "local-decls-only" : "");
+        hash.update(options.summary ? "summary" : "");
+        hash.update(options.sendCounts ? "send-counts" : "");
+        hash.update(options.headerCache ? "header-cache" : "");
+        hash.update(options.pruneBodies ? "" : "no-body-pruning");
+        if (options.sdkSelectors) {
+            hash.update(to_string(llvm::xxHash64(options.sdkSelectors->contents())));
+        }
+        if (options.dynamicSelectors) {
+            hash.update("dynamic");
+            hash.update(to_string(llvm::xxHash64(options.dynamicSelectors->contents())));
+        }
+        llvm::MD5::MD5Result digest;
+        hash.final(digest);
+        return digest.digest().str().str();
+    }
+    
+    // accumulates into an existing snapshot, so umbrella headers can be indexed one by one
+    void indexSDKSelectors(ASTContext &Ctx) {
+        SDKSelectorCollector collector(compilerInstance.getSourceManager());
+        collector.TraverseDecl(Ctx.getTranslationUnitDecl());
+        
+        auto &path = options.indexSDKSelectorsPath;
+        if (llvm::sys::fs::exists(path)) {
+            auto existing = SelectorSnapshot::load(path);
+            if (!existing) {
+                reportError(llvm::toString(existing.takeError()));
+                return;
+            }
+            for (size_t i = 0, e = (*existing)->size(); i != e; i++) {
+                collector.sels.push_back((**existing)[i].str());
+            }
+        }
+        
+        if (auto err = SelectorSnapshot::write(path, move(collector.sels))) {
+            reportError(llvm::toString(move(err)));
+        }
+    }
+    
+    void reportError(const string &message) {
+        auto &diags = compilerInstance.getDiagnostics();
+        unsigned diagID = diags.getCustomDiagID(DiagnosticsEngine::Error, "directable-finder: %0");
+        diags.Report(diagID) << message;
     }
 };
 
 class DFAction : public PluginASTAction {
+    DFOptions options;
 protected:
     std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI, llvm::StringRef) override {
-        return std::make_unique<DFConsumer>(CI);
+        return createDirectableFinderConsumer(CI, options, NULL);
     }
 
     bool ParseArgs(const CompilerInstance &CI, const std::vector<std::string> &args) override {
+        for (auto &arg : args) {
+            llvm::StringRef value = arg;
+            if (arg == "-local-decls-only") {
+                options.localDeclsOnly = true;
+            } else if (value.consume_front("-sdk-selectors=")) {
+                auto snapshot = SelectorSnapshot::load(value);
+                if (!snapshot) {
+                    auto &diags = CI.getDiagnostics();
+                    unsigned diagID = diags.getCustomDiagID(DiagnosticsEngine::Error, "directable-finder: %0");
+                    diags.Report(diagID) << llvm::toString(snapshot.takeError());
+                    return false;
+                }
+                options.sdkSelectors = move(*snapshot);
+            } else if (value.consume_front("-dynamic-selectors=")) {
+                auto snapshot = SelectorSnapshot::load(value);
+                if (!snapshot) {
+                    auto &diags = CI.getDiagnostics();
+                    unsigned diagID = diags.getCustomDiagID(DiagnosticsEngine::Error, "directable-finder: %0");
+                    diags.Report(diagID) << llvm::toString(snapshot.takeError());
+                    return false;
+                }
+                options.dynamicSelectors = move(*snapshot);
+            } else if (value.consume_front("-index-sdk-selectors=")) {
+                options.indexSDKSelectorsPath = value.str();
+            } else if (value.consume_front("-output-dir=")) {
+                options.outputDir = value.str();
+            } else if (arg == "-format=json") {
+                options.format = DFOptions::ShardFormat::JSON;
+            } else if (arg == "-format=binary") {
+                options.format = DFOptions::ShardFormat::Binary;
+            } else if (arg == "-compress") {
+                options.compress = true;
+            } else if (arg == "-store") {
+                options.store = true;
+            } else if (arg == "-summary") {
+                options.summary = true;
+            } else if (arg == "-send-counts") {
+                options.sendCounts = true;
+            } else if (arg == "-header-cache") {
+                options.headerCache = true;
+            } else if (arg == "-verbose") {
+                options.verbose = true;
+            } else if (arg == "-no-body-pruning") {
+                options.pruneBodies = false;
+            } else if (value.consume_front("-aggregator=")) {
+                options.aggregatorSocket = value.str();
+            } else {
+                auto &diags = CI.getDiagnostics();
+                unsigned diagID = diags.getCustomDiagID(DiagnosticsEngine::Error, "directable-finder: unknown argument '%0'");
+                diags.Report(diagID) << arg;
+                return false;
+            }
+        }
+        
+        if (options.store && !options.aggregatorSocket.empty()) {
+            auto &diags = CI.getDiagnostics();
+            unsigned diagID = diags.getCustomDiagID(DiagnosticsEngine::Error, "directable-finder: -aggregator can't be combined with -store, skipped TUs would never reach the aggregator");
+            diags.Report(diagID);
+            return false;
+        }
+        
+        if (options.sendCounts && !options.aggregatorSocket.empty()) {
+            auto &diags = CI.getDiagnostics();
+            unsigned diagID = diags.getCustomDiagID(DiagnosticsEngine::Error, "directable-finder: -aggregator can't be combined with -send-counts, the aggregator doesn't keep send sites");
+            diags.Report(diagID);
+            return false;
+        }
+        
+        if (options.summary && !options.aggregatorSocket.empty()) {
+            auto &diags = CI.getDiagnostics();
+            unsigned diagID = diags.getCustomDiagID(DiagnosticsEngine::Error, "directable-finder: -aggregator can't be combined with -summary, the aggregator doesn't resolve summaries");
+            diags.Report(diagID);
+            return false;
+        }
+        
+        if (options.headerCache && !options.aggregatorSocket.empty()) {
+            auto &diags = CI.getDiagnostics();
+            unsigned diagID = diags.getCustomDiagID(DiagnosticsEngine::Error, "directable-finder: -aggregator can't be combined with -header-cache, header records are only written to the output directory");
+            diags.Report(diagID);
+            return false;
+        }
+        
+        if (options.outputDir.empty() && options.indexSDKSelectorsPath.empty()) {
+            auto &diags = CI.getDiagnostics();
+            unsigned diagID = diags.getCustomDiagID(DiagnosticsEngine::Error, "directable-finder: missing -output-dir=<directory to store results>");
+            diags.Report(diagID);
+            return false;
+        }
         return true;
     }
 };
 
+unique_ptr<ASTConsumer> createDirectableFinderConsumer(CompilerInstance &CI, const DFOptions &options, ShardSink *sink) {
+    return std::make_unique<DFConsumer>(CI, options, sink);
+}
+
 
 static FrontendPluginRegistry::Add<DFAction>
 X("directable-finder", "description");
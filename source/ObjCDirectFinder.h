@@ -0,0 +1,72 @@
+//
+//  ObjCDirectFinder.h
+//  DirectableFinder
+//
+
+#ifndef OBJC_DIRECT_FINDER_H
+#define OBJC_DIRECT_FINDER_H
+
+#include "DirectableShard.h"
+#include "SelectorSnapshot.h"
+
+#include "clang/AST/ASTConsumer.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include <memory>
+#include <string>
+
+struct DFOptions {
+    enum class ShardFormat { JSON, Binary };
+    
+    // directory the shards are written to
+    std::string outputDir;
+    // `outputDir` is a shard store, TUs whose inputs didn't change since their
+    // shard was stored are not analyzed again
+    bool store = false;
+    // json for merge.py and debugging, binary `.dfshard` for objc-direct-merge
+    ShardFormat format = ShardFormat::JSON;
+    // zlib compress binary shards
+    bool compress = false;
+    // traverse only decls parsed from this TU's own files, imported module/PCH
+    // content is deserialized on demand by hierarchy and protocol lookups
+    bool localDeclsOnly = false;
+    // system protocol selectors indexed once by -index-sdk-selectors, these are
+    // neither traversed nor recorded per TU
+    std::shared_ptr<SelectorSnapshot> sdkSelectors;
+    // selectors objc-direct-prescan found used dynamically in the sources,
+    // candidates with them are undirectable
+    std::shared_ptr<SelectorSnapshot> dynamicSelectors;
+    // index the system protocol selectors of this TU into this file instead of analyzing it
+    std::string indexSDKSelectorsPath;
+    // print the location and name of every visited method to stdout
+    bool verbose = false;
+    // skip C and C++ function bodies without ObjC tokens, off to check that
+    // skipping them doesn't change the shards
+    bool pruneBodies = true;
+    // record a summary of the TU's classes, protocols and dynamic selector uses
+    // for `objc-direct-merge --resolve`; selectors are then no longer marked
+    // undirectable only because a protocol declares them
+    bool summary = false;
+    // record the send sites of every method whose receiver type is known, the
+    // merge estimates the objc_msgSend dispatches a candidate saves from them
+    bool sendCounts = false;
+    // the protocol selectors of each header are written once to `outputDir` as
+    // a header record, keyed by the header's content, instead of into the
+    // shard of every TU importing it
+    bool headerCache = false;
+    // Unix domain socket of objc-direct-aggregator, shards are streamed there
+    // and only written to `outputDir` when it can't be reached
+    std::string aggregatorSocket;
+};
+
+// Receives the shard of each analyzed TU instead of the output directory.
+class ShardSink {
+public:
+    virtual ~ShardSink() = default;
+    virtual void consume(DirectableShard shard) = 0;
+};
+
+// Analysis consumer shared by the plugin and the standalone driver, a null
+// `sink` writes shards to `options.outputDir`.
+std::unique_ptr<clang::ASTConsumer> createDirectableFinderConsumer(clang::CompilerInstance &CI, const DFOptions &options, ShardSink *sink);
+
+#endif
@@ -0,0 +1,235 @@
+//
+//  ObjCDirectFinderTool.cpp
+//  DirectableFinder
+//
+//  Standalone driver, runs the directable-finder analysis over a compilation
+//  database on a thread pool and merges the results in memory. With --apply it
+//  annotates the declarations of a merged result in the sources instead.
+//
+
+#include "DirectableApply.h"
+#include "DirectableMerge.h"
+#include "ObjCDirectFinder.h"
+#include "ShardStore.h"
+
+#include "clang/Frontend/FrontendAction.h"
+#include "clang/Tooling/CommonOptionsParser.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/VirtualFileSystem.h"
+#include <mutex>
+
+using namespace clang::tooling;
+using namespace clang;
+using namespace std;
+
+static llvm::cl::OptionCategory FinderCategory("objc-direct-finder options");
+
+static llvm::cl::opt<unsigned> Jobs("j", llvm::cl::desc("Number of TUs analyzed in parallel, 0 uses all cores"), llvm::cl::init(0), llvm::cl::cat(FinderCategory));
+
+static llvm::cl::opt<string> OutputPath("o", llvm::cl::desc("Merged result, the same format merge.py writes"), llvm::cl::value_desc("path"), llvm::cl::cat(FinderCategory));
+
+static llvm::cl::opt<bool> LocalDeclsOnly("local-decls-only", llvm::cl::desc("Only traverse decls parsed from each TU's own files"), llvm::cl::cat(FinderCategory));
+
+static llvm::cl::opt<bool> Resolve("resolve", llvm::cl::desc("Record a summary of every TU and resolve them across the whole program, like objc-direct-merge --resolve"), llvm::cl::cat(FinderCategory));
+
+static llvm::cl::opt<string> Apply("apply", llvm::cl::desc("Annotate the properties and methods of this merged result as direct in the sources"), llvm::cl::value_desc("merged result"), llvm::cl::cat(FinderCategory));
+
+static llvm::cl::opt<bool> DryRun("dry-run", llvm::cl::desc("With --apply, print a diff of the annotations instead of editing the sources"), llvm::cl::cat(FinderCategory));
+
+static llvm::cl::opt<string> SDKSelectors("sdk-selectors", llvm::cl::desc("System protocol selector snapshot"), llvm::cl::value_desc("path"), llvm::cl::cat(FinderCategory));
+
+static llvm::cl::opt<string> DynamicSelectors("dynamic-selectors", llvm::cl::desc("Dynamic selector snapshot written by objc-direct-prescan"), llvm::cl::value_desc("path"), llvm::cl::cat(FinderCategory));
+
+// keeps the shards of one TU, the driver merges them after every job is done
+class CollectingSink : public ShardSink {
+public:
+    vector<DirectableShard> shards;
+    void consume(DirectableShard shard) override {
+        shards.push_back(move(shard));
+    }
+};
+
+class DFToolAction : public ASTFrontendAction {
+    const DFOptions &options;
+    ShardSink &sink;
+public:
+    DFToolAction(const DFOptions &opts, ShardSink &s) : options(opts), sink(s) {}
+
+    unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI, llvm::StringRef) override {
+        return createDirectableFinderConsumer(CI, options, &sink);
+    }
+};
+
+class DFToolActionFactory : public FrontendActionFactory {
+    const DFOptions &options;
+    ShardSink &sink;
+public:
+    DFToolActionFactory(const DFOptions &opts, ShardSink &s) : options(opts), sink(s) {}
+
+    unique_ptr<FrontendAction> create() override {
+        return make_unique<DFToolAction>(options, sink);
+    }
+};
+
+class DFApplyAction : public ASTFrontendAction {
+    const DirectableTargets &targets;
+    DirectableEdits &edits;
+public:
+    DFApplyAction(const DirectableTargets &t, DirectableEdits &e) : targets(t), edits(e) {}
+
+    unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI, llvm::StringRef) override {
+        return createDirectableApplyConsumer(CI, targets, edits);
+    }
+};
+
+class DFApplyActionFactory : public FrontendActionFactory {
+    const DirectableTargets &targets;
+    DirectableEdits &edits;
+public:
+    DFApplyActionFactory(const DirectableTargets &t, DirectableEdits &e) : targets(t), edits(e) {}
+
+    unique_ptr<FrontendAction> create() override {
+        return make_unique<DFApplyAction>(targets, edits);
+    }
+};
+
+// false when the file couldn't be parsed
+static bool runOnFile(const CompilationDatabase &compilations, const string &file, FrontendActionFactory &factory) {
+    // the real file system changes the process' working directory, each job gets its own
+    llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs(llvm::vfs::createPhysicalFileSystem().release());
+    ClangTool tool(compilations, {file}, make_shared<PCHContainerOperations>(), fs);
+    return tool.run(&factory) == 0;
+}
+
+// Collects the annotations of every TU in parallel, then edits each file once.
+static int applyMergedResult(const CompilationDatabase &compilations, const vector<string> &files) {
+    auto buf = llvm::MemoryBuffer::getFile(Apply);
+    if (!buf) {
+        llvm::errs() << "objc-direct-finder: " << Apply << ": " << buf.getError().message() << "\n";
+        return 1;
+    }
+    auto targets = DirectableTargets::load((*buf)->getBuffer());
+    if (!targets) {
+        llvm::errs() << "objc-direct-finder: " << Apply << ": " << llvm::toString(targets.takeError()) << "\n";
+        return 1;
+    }
+
+    DirectableEdits edits;
+    mutex errorLock;
+    size_t failures = 0;
+    {
+        llvm::ThreadPool pool(llvm::hardware_concurrency(Jobs));
+        for (auto &file : files) {
+            pool.async([&] {
+                DFApplyActionFactory factory(*targets, edits);
+                if (!runOnFile(compilations, file, factory)) {
+                    lock_guard<mutex> guard(errorLock);
+                    llvm::errs() << "objc-direct-finder: failed to parse " << file << "\n";
+                    failures++;
+                }
+            });
+        }
+        pool.wait();
+    }
+
+    for (auto &loc : edits.skippedLocs()) {
+        llvm::errs() << "objc-direct-finder: " << loc << " is spelled in a macro, annotate it by hand\n";
+    }
+    // the annotations of TUs that failed to parse are missing, the others are
+    // still applied; annotated declarations are skipped when running again
+    auto stats = edits.apply(Jobs, DryRun ? &llvm::outs() : nullptr);
+    if (!DryRun) {
+        llvm::outs() << stats.edits << "\n";
+    }
+    return failures || stats.failures ? 1 : 0;
+}
+
+int main(int argc, const char **argv) {
+    auto parser = CommonOptionsParser::create(argc, argv, FinderCategory, llvm::cl::ZeroOrMore);
+    if (!parser) {
+        llvm::errs() << parser.takeError();
+        return 1;
+    }
+
+    auto &compilations = parser->getCompilations();
+    vector<string> files = parser->getSourcePathList();
+    if (files.empty()) {
+        files = compilations.getAllFiles();
+    }
+
+    if (!Apply.empty()) {
+        return applyMergedResult(compilations, files);
+    }
+    if (OutputPath.empty()) {
+        llvm::errs() << "objc-direct-finder: -o <output path> is required\n";
+        return 1;
+    }
+
+    DFOptions options;
+    options.localDeclsOnly = LocalDeclsOnly;
+    options.summary = Resolve;
+    if (!SDKSelectors.empty()) {
+        auto snapshot = SelectorSnapshot::load(SDKSelectors);
+        if (!snapshot) {
+            llvm::errs() << "objc-direct-finder: " << snapshot.takeError() << "\n";
+            return 1;
+        }
+        options.sdkSelectors = move(*snapshot);
+    }
+    if (!DynamicSelectors.empty()) {
+        auto snapshot = SelectorSnapshot::load(DynamicSelectors);
+        if (!snapshot) {
+            llvm::errs() << "objc-direct-finder: " << snapshot.takeError() << "\n";
+            return 1;
+        }
+        options.dynamicSelectors = move(*snapshot);
+    }
+
+    // per file results, merged in file order so the output doesn't depend on scheduling
+    vector<vector<DirectableShard>> results(files.size());
+    mutex errorLock;
+    size_t failures = 0;
+    {
+        llvm::ThreadPool pool(llvm::hardware_concurrency(Jobs));
+        for (size_t i = 0; i < files.size(); i++) {
+            pool.async([&, i] {
+                CollectingSink sink;
+                DFToolActionFactory factory(options, sink);
+                if (!runOnFile(compilations, files[i], factory)) {
+                    lock_guard<mutex> guard(errorLock);
+                    llvm::errs() << "objc-direct-finder: failed to analyze " << files[i] << "\n";
+                    failures++;
+                }
+                results[i] = move(sink.shards);
+            });
+        }
+        pool.wait();
+    }
+
+    DirectableMerger merger;
+    ProgramResolver resolver;
+    for (auto &shards : results) {
+        for (auto &shard : shards) {
+            if (Resolve) {
+                resolver.add(shard);
+            } else {
+                merger.add(move(shard));
+            }
+        }
+    }
+
+    string content;
+    llvm::raw_string_ostream out(content);
+    size_t count = Resolve ? resolver.write(out) : merger.write(out);
+    if (auto err = writeFileAtomically(OutputPath, out.str())) {
+        llvm::errs() << "objc-direct-finder: " << llvm::toString(move(err)) << "\n";
+        return 1;
+    }
+    llvm::outs() << count << "\n";
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,570 @@
+//
+//  ObjCDirectMerge.cpp
+//  DirectableFinder
+//
+//  Native replacement of merge.py, same arguments and byte for byte the same output.
+//  Also reads binary `.dfshard` shards, which merge.py doesn't know, and shard
+//  stores written with -store, which are merged incrementally. With --resolve
+//  the summaries of shards written with -summary are resolved across the whole
+//  program instead, --unreferenced also reports the methods nothing references.
+//  With --link-map every entry gets the bytes it is estimated to save in the
+//  linked image, with --dispatches the objc_msgSend dispatches, and the result
+//  is ranked by them. --format=index writes the result as an
+//  index for objc-direct-query instead of json.
+//
+
+#include "DirectableIndex.h"
+#include "DirectableMerge.h"
+#include "DirectableShard.h"
+#include "DispatchProfile.h"
+#include "LinkMap.h"
+#include "ShardStore.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+using namespace std;
+using namespace llvm;
+
+static cl::opt<string> Input("input", cl::desc("input directory"), cl::value_desc("dir"));
+static cl::alias InputAlias("i", cl::desc("Alias for --input"), cl::aliasopt(Input));
+
+static cl::opt<string> Output("output", cl::desc("output file path"), cl::value_desc("path"));
+static cl::alias OutputAlias("o", cl::desc("Alias for --output"), cl::aliasopt(Output));
+
+static cl::opt<string> StatePath("state", cl::desc("Merge state of a shard store, only shards changed since the last merge are read"), cl::value_desc("path"));
+
+static cl::opt<bool> CollectGarbage("gc", cl::desc("Drop store entries of deleted sources and shards no entry references"));
+
+static cl::opt<bool> Resolve("resolve", cl::desc("Resolve the class hierarchy and selector uses of the whole program from the -summary of each shard"));
+
+static cl::opt<string> UnreferencedPath("unreferenced", cl::desc("With --resolve, also write the implemented methods nothing references, one per line"), cl::value_desc("path"));
+
+static cl::opt<string> LinkMapPath("link-map", cl::desc("ld64 link map of the app, entries are ranked by the bytes they are estimated to save"), cl::value_desc("path"));
+
+static cl::opt<bool> RelativeMethodLists("relative-method-lists", cl::desc("With --link-map, the app uses relative method lists (deployment target iOS 14 / macOS 11 or later)"));
+
+static cl::opt<bool> Dispatches("dispatches", cl::desc("Rank entries by the objc_msgSend dispatches they are estimated to save, from the send sites of shards written with -send-counts"));
+
+static cl::opt<string> ProfilePath("profile", cl::desc("Method or send site execution counts for --dispatches, text or the output of llvm-profdata show --all-functions --counts"), cl::value_desc("path"));
+
+enum class ResultFormat { JSON, Index };
+
+static cl::opt<ResultFormat> Format("format", cl::desc("Format of the merged result"), cl::init(ResultFormat::JSON),
+    cl::values(clEnumValN(ResultFormat::JSON, "json", "merge.py's json (default)"),
+               clEnumValN(ResultFormat::Index, "index", "sorted, memory mappable sections for objc-direct-query")));
+
+static cl::opt<unsigned> Jobs("j", cl::desc("Number of shards parsed in parallel, 0 uses all cores"), cl::init(0));
+
+// big shards are mmap'ed, records are handed to the visitor straight from the file
+static Error scanShardFile(StringRef path, ShardVisitor &visitor) {
+    auto buf = MemoryBuffer::getFile(path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (!buf) return createFileError(path, buf.getError());
+    if (auto err = scanShard((*buf)->getBuffer(), visitor)) return createFileError(path, move(err));
+    return Error::success();
+}
+
+// runs `makeVisitor(i)` over every shard in parallel, returns false if any shard couldn't be read
+template <typename VisitorFactory>
+static bool forEachShard(const vector<string> &paths, VisitorFactory makeVisitor) {
+    atomic<bool> ok(true);
+    ThreadPool pool(hardware_concurrency(Jobs));
+    for (size_t i = 0; i < paths.size(); i++) {
+        pool.async([&, i] {
+            auto visitor = makeVisitor(i);
+            if (auto err = scanShardFile(paths[i], visitor)) {
+                logAllUnhandledErrors(move(err), errs(), "objc-direct-merge: ");
+                ok = false;
+                return;
+            }
+            visitor.finish();
+        });
+    }
+    pool.wait();
+    return ok;
+}
+
+// pass 1: only the undirectable sets, candidates are skipped without decoding
+class UndirectableCollector : public ShardVisitor {
+    ConcurrentStringSet &sels;
+    ConcurrentStringSet &names;
+public:
+    UndirectableCollector(ConcurrentStringSet &s, ConcurrentStringSet &n) : sels(s), names(n) {}
+
+    bool wantsMeths() const override { return false; }
+    void visitSel(StringRef sel) override { sels.insert(sel); }
+    void visitUndirectMeth(StringRef name) override { names.insert(name); }
+    void finish() {}
+};
+
+// pass 2: candidates that survive the complete sets, only these are copied
+class SurvivorCollector : public ShardVisitor {
+    const ConcurrentStringSet &sels;
+    const ConcurrentStringSet &names;
+    function<void(vector<DirectableMeth>)> done;
+    vector<DirectableMeth> survivors;
+public:
+    SurvivorCollector(const ConcurrentStringSet &s, const ConcurrentStringSet &n, function<void(vector<DirectableMeth>)> d) : sels(s), names(n), done(move(d)) {}
+
+    bool wantsUndirectables() const override { return false; }
+    void visitMeth(const DirectableMethRef &ref) override {
+        if (sels.contains(ref.sel)) return;
+        if (names.contains(ref.name)) return;
+        DirectableMeth meth;
+        meth.name = ref.name.str();
+        meth.sel = ref.sel.str();
+        meth.loc = ref.loc.str();
+        meth.isPropertyAccessor = ref.isPropertyAccessor;
+        survivors.push_back(move(meth));
+    }
+    void finish() { done(move(survivors)); }
+};
+
+static vector<string> listDirectory(StringRef dir, error_code &ec) {
+    vector<string> paths;
+    for (sys::fs::directory_iterator it(dir, ec), end; it != end && !ec; it.increment(ec)) {
+        paths.push_back(it->path());
+    }
+    return paths;
+}
+
+// streamed into a temp file next to `path`, renamed when complete
+static bool writeOutput(StringRef path, function<void(raw_ostream &)> write) {
+    if (auto err = writeFileAtomically(path, write)) {
+        logAllUnhandledErrors(move(err), errs(), "objc-direct-merge: ");
+        return false;
+    }
+    return true;
+}
+
+// --link-map and --dispatches: send sites of every method, a header's sites
+// are counted once, and the property setters the summaries record
+class EstimateInputCollector : public ShardVisitor {
+    StringMap<StringSet<>> *sites;
+    PropertySetters *setters;
+    mutex &lock;
+    StringMap<StringSet<>> local;
+    vector<DirectableSummary> summaries;
+public:
+    EstimateInputCollector(StringMap<StringSet<>> *s, PropertySetters *p, mutex &l) : sites(s), setters(p), lock(l) {}
+
+    bool wantsUndirectables() const override { return false; }
+    bool wantsMeths() const override { return false; }
+    bool wantsSummary() const override { return setters; }
+    bool wantsSends() const override { return sites; }
+    void visitSummary(const DirectableSummary &summary) override {
+        summaries.push_back(summary);
+    }
+    void visitSends(StringRef name, ArrayRef<StringRef> methSites) override {
+        auto &known = local[name];
+        for (auto site : methSites) {
+            known.insert(site);
+        }
+    }
+    void finish() {
+        lock_guard<mutex> guard(lock);
+        for (auto &summary : summaries) {
+            setters->add(summary);
+        }
+        for (auto &meth : local) {
+            auto &known = (*sites)[meth.getKey()];
+            for (auto &site : meth.getValue()) {
+                known.insert(site.getKey());
+            }
+        }
+    }
+};
+
+// Dispatches a candidate saves: its calls in the profile, else the profiled
+// counts of its send sites, else one per static send site.
+static uint64_t estimateDispatches(const DirectableMeth &meth, const StringSet<> *sites, const DispatchProfile *profile, const PropertySetters &setters) {
+    if (profile) {
+        auto linkedName = linkedMethodName(meth.name);
+        auto calls = profile->methodCount(linkedName);
+        if (meth.isPropertyAccessor) {
+            auto setterSel = setters.setterSel(methodClassName(meth.name), meth.sel);
+            auto setterCalls = profile->methodCount(setterMethodName(linkedName, setterSel));
+            if (setterCalls) calls = calls.getValueOr(0) + *setterCalls;
+        }
+        if (calls) return *calls;
+
+        Optional<uint64_t> siteCalls;
+        if (sites) {
+            for (auto &site : *sites) {
+                if (auto count = profile->siteCount(site.getKey())) siteCalls = siteCalls.getValueOr(0) + *count;
+            }
+        }
+        if (siteCalls) return *siteCalls;
+    }
+    return sites ? sites->size() : 0;
+}
+
+// the entries of a merge, in result order, `visit` may move from them
+using SurvivorSource = function<void(function_ref<void(DirectableMeth &)>)>;
+
+// The merged result, with --link-map and --dispatches every entry gets its
+// estimates and the result is ranked by them, dispatches first. An index is
+// ordered by loc and keeps the estimates. `recordedSetters` are the setters of
+// a --resolve merge, other merges read them from the summaries of the shards.
+static bool writeResult(const vector<string> &shardPaths, SurvivorSource forEachSurvivor, const PropertySetters *recordedSetters, size_t &count) {
+    bool dispatches = Dispatches || !ProfilePath.empty();
+    if (LinkMapPath.empty() && !dispatches && Format == ResultFormat::JSON) {
+        return writeOutput(Output, [&](raw_ostream &out) {
+            MergedResultWriter writer(out);
+            forEachSurvivor([&](DirectableMeth &meth) { writer.add(meth); });
+            writer.finish();
+            count = writer.size();
+        });
+    }
+
+    vector<DirectableMeth> meths;
+    forEachSurvivor([&](DirectableMeth &meth) { meths.push_back(move(meth)); });
+    count = meths.size();
+    vector<MergedEstimates> estimates(meths.size());
+
+    // setters are only looked up for property accessors of the link map and the profile
+    bool needsSetters = !recordedSetters && (!LinkMapPath.empty() || !ProfilePath.empty());
+    StringMap<StringSet<>> sites;
+    PropertySetters collectedSetters;
+    if (dispatches || needsSetters) {
+        mutex inputsLock;
+        bool ok = forEachShard(shardPaths, [&](size_t) {
+            return EstimateInputCollector(dispatches ? &sites : nullptr, needsSetters ? &collectedSetters : nullptr, inputsLock);
+        });
+        if (!ok) return false;
+    }
+    const PropertySetters &setters = recordedSetters ? *recordedSetters : collectedSetters;
+
+    if (!LinkMapPath.empty()) {
+        LinkMapEstimator estimator(meths, setters);
+        if (auto err = estimator.scan(LinkMapPath, RelativeMethodLists)) {
+            logAllUnhandledErrors(move(err), errs(), "objc-direct-merge: ");
+            return false;
+        }
+        uint64_t total = 0;
+        for (size_t i = 0; i < meths.size(); i++) {
+            estimates[i].estimatedSavings = estimator.estimate(meths[i]);
+            total += *estimates[i].estimatedSavings;
+        }
+        errs() << "objc-direct-merge: " << total << " bytes estimated savings\n";
+    }
+
+    if (dispatches) {
+        Optional<DispatchProfile> profile;
+        if (!ProfilePath.empty()) {
+            auto buf = MemoryBuffer::getFile(ProfilePath, /*IsText=*/true);
+            auto loaded = buf ? DispatchProfile::load((*buf)->getBuffer()) : Expected<DispatchProfile>(errorCodeToError(buf.getError()));
+            if (!loaded) {
+                logAllUnhandledErrors(createFileError(ProfilePath, loaded.takeError()), errs(), "objc-direct-merge: ");
+                return false;
+            }
+            profile = move(*loaded);
+        }
+
+        uint64_t total = 0;
+        for (size_t i = 0; i < meths.size(); i++) {
+            auto &meth = meths[i];
+            auto methSites = sites.find(meth.name);
+            auto known = methSites == sites.end() ? nullptr : &methSites->getValue();
+            estimates[i].staticSends = known ? known->size() : 0;
+            estimates[i].estimatedDispatches = estimateDispatches(meth, known, profile ? profile.getPointer() : nullptr, setters);
+            total += *estimates[i].estimatedDispatches;
+        }
+        errs() << "objc-direct-merge: " << total << " objc_msgSend dispatches estimated saved\n";
+    }
+
+    if (Format == ResultFormat::Index) {
+        return writeOutput(Output, [&](raw_ostream &out) {
+            DirectableIndex::write(out, meths, estimates);
+        });
+    }
+
+    vector<size_t> order(meths.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    auto rank = [&](size_t i) {
+        return make_pair(estimates[i].estimatedDispatches.getValueOr(0), estimates[i].estimatedSavings.getValueOr(0));
+    };
+    llvm::sort(order, [&](size_t a, size_t b) {
+        if (rank(a) != rank(b)) return rank(a) > rank(b);
+        return meths[a].loc < meths[b].loc;
+    });
+    return writeOutput(Output, [&](raw_ostream &out) {
+        MergedResultWriter writer(out);
+        for (auto i : order) {
+            writer.add(meths[i], estimates[i]);
+        }
+        writer.finish();
+    });
+}
+
+// --resolve: shards are parsed in parallel and joined into a single program graph
+static int resolveShards(const vector<string> &paths) {
+    ProgramResolver resolver;
+    mutex resolverLock;
+    atomic<bool> ok(true);
+    {
+        ThreadPool pool(hardware_concurrency(Jobs));
+        for (auto &path : paths) {
+            pool.async([&] {
+                auto buf = MemoryBuffer::getFile(path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+                auto shard = buf ? readShard((*buf)->getBuffer()) : Expected<DirectableShard>(errorCodeToError(buf.getError()));
+                if (!shard) {
+                    logAllUnhandledErrors(createFileError(path, shard.takeError()), errs(), "objc-direct-merge: ");
+                    ok = false;
+                    return;
+                }
+                lock_guard<mutex> guard(resolverLock);
+                resolver.add(*shard);
+            });
+        }
+        pool.wait();
+    }
+    if (!ok) return 1;
+
+    size_t count = 0;
+    auto survivors = [&](function_ref<void(DirectableMeth &)> visit) { resolver.forEachSurvivor(visit); };
+    if (!writeResult(paths, survivors, &resolver.propertySetters(), count)) return 1;
+    if (!UnreferencedPath.empty()) {
+        size_t unreferenced = 0;
+        if (!writeOutput(UnreferencedPath, [&](raw_ostream &out) { unreferenced = resolver.writeUnreferenced(out); })) return 1;
+        if (resolver.hasMissingSummaries()) {
+            errs() << "objc-direct-merge: warning: some shards have no -summary, methods only they reference are reported\n";
+        }
+        errs() << "objc-direct-merge: " << unreferenced << " unreferenced methods\n";
+    }
+    outs() << count << "\n";
+    return 0;
+}
+
+// A -store directory: the shards the manifest references are diffed against
+// the ones applied to the merge state, and only the difference is read.
+static int mergeStore() {
+    SmallString<256> manifestDir(Input);
+    sys::path::append(manifestDir, StoreManifestDir);
+    error_code ec;
+    auto entryPaths = listDirectory(manifestDir, ec);
+    if (ec) {
+        errs() << "objc-direct-merge: can't list " << manifestDir << ": " << ec.message() << "\n";
+        return 1;
+    }
+
+    // builds touch the entries they write or find up to date, an entry older
+    // than the last merge whose source was built since in another configuration
+    // belongs to a configuration no longer built
+    SmallString<256> lastMergePath(Input);
+    sys::path::append(lastMergePath, StoreLastMergeFile);
+    sys::fs::file_status lastMerge;
+    bool hasLastMerge = !sys::fs::status(lastMergePath, lastMerge);
+    if (auto err = writeFileAtomically(lastMergePath, "")) {
+        logAllUnhandledErrors(move(err), errs(), "objc-direct-merge: ");
+        return 1;
+    }
+
+    struct ListedEntry {
+        string path;
+        ManifestEntry entry;
+        bool touched;
+    };
+    vector<ListedEntry> entries;
+    StringSet<> builtSources;
+    for (auto &entryPath : entryPaths) {
+        auto key = sys::path::filename(entryPath);
+        // leftover of a job killed while writing its entry
+        if (key.contains(".tmp-")) continue;
+        auto entry = readManifestEntry(Input, key);
+        if (!entry) {
+            logAllUnhandledErrors(entry.takeError(), errs(), "objc-direct-merge: ");
+            return 1;
+        }
+        sys::fs::file_status status;
+        bool touched = !hasLastMerge || sys::fs::status(entryPath, status) || status.getLastModificationTime() >= lastMerge.getLastModificationTime();
+        if (touched) builtSources.insert(entry->source);
+        entries.push_back({entryPath, move(*entry), touched});
+    }
+
+    StringMap<uint64_t> referenced;
+    for (auto &listed : entries) {
+        if (CollectGarbage && (!sys::fs::exists(listed.entry.source) || (!listed.touched && builtSources.count(listed.entry.source)))) {
+            sys::fs::remove(listed.path);
+            continue;
+        }
+        referenced[listed.entry.object]++;
+    }
+
+    auto objectPath = [&](StringRef object) {
+        SmallString<256> path(Input);
+        sys::path::append(path, StoreObjectsDir, object);
+        return path;
+    };
+    // the whole program is resolved from scratch, the merge state isn't used
+    if (Resolve) {
+        vector<string> paths;
+        for (auto &object : referenced) {
+            paths.push_back(objectPath(object.getKey()).str().str());
+        }
+        llvm::sort(paths);
+        return resolveShards(paths);
+    }
+
+    MergeState state;
+    if (!StatePath.empty() && sys::fs::exists(StatePath)) {
+        auto buf = MemoryBuffer::getFile(StatePath, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+        auto loaded = buf ? MergeState::load((*buf)->getBuffer()) : Expected<MergeState>(createFileError(StatePath, buf.getError()));
+        if (loaded) {
+            state = move(*loaded);
+        } else {
+            // a state that can't be read is rebuilt from every shard
+            logAllUnhandledErrors(loaded.takeError(), errs(), "objc-direct-merge: ignoring merge state: ");
+        }
+    }
+
+    auto applyObject = [&](StringRef object, int64_t delta) -> Error {
+        auto path = objectPath(object);
+        auto buf = MemoryBuffer::getFile(path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+        if (!buf) return createFileError(path, buf.getError());
+        if (auto err = state.applyShard((*buf)->getBuffer(), delta)) return createFileError(path, move(err));
+        return Error::success();
+    };
+
+    // a removed shard has to be read to be subtracted, when one is already
+    // gone the state is rebuilt
+    vector<pair<string, int64_t>> deltas;
+    bool rebuild = false;
+    for (auto &applied : state.objects) {
+        int64_t delta = (int64_t)referenced.lookup(applied.getKey()) - (int64_t)applied.getValue();
+        if (delta == 0) continue;
+        if (delta < 0 && !sys::fs::exists(objectPath(applied.getKey()))) rebuild = true;
+        deltas.push_back({applied.getKey().str(), delta});
+    }
+    for (auto &wanted : referenced) {
+        if (!state.objects.count(wanted.getKey())) deltas.push_back({wanted.getKey().str(), (int64_t)wanted.getValue()});
+    }
+    if (rebuild) {
+        state = MergeState();
+        deltas.clear();
+        for (auto &wanted : referenced) {
+            deltas.push_back({wanted.getKey().str(), (int64_t)wanted.getValue()});
+        }
+    }
+    // StringMap order is arbitrary, applying in name order keeps runs reproducible
+    llvm::sort(deltas);
+    for (auto &delta : deltas) {
+        if (auto err = applyObject(delta.first, delta.second)) {
+            logAllUnhandledErrors(move(err), errs(), "objc-direct-merge: ");
+            return 1;
+        }
+    }
+    state.objects = move(referenced);
+
+    vector<string> paths;
+    for (auto &object : state.objects) {
+        paths.push_back(objectPath(object.getKey()).str().str());
+    }
+    llvm::sort(paths);
+    size_t count = 0;
+    auto survivors = [&](function_ref<void(DirectableMeth &)> visit) { state.forEachSurvivor(visit); };
+    if (!writeResult(paths, survivors, nullptr, count)) return 1;
+    if (!StatePath.empty() && !writeOutput(StatePath, [&](raw_ostream &out) { state.save(out); })) return 1;
+
+    // only after the state no longer needs removed shards
+    if (CollectGarbage) {
+        SmallString<256> objectsDir(Input);
+        sys::path::append(objectsDir, StoreObjectsDir);
+        for (auto &path : listDirectory(objectsDir, ec)) {
+            if (!state.objects.count(sys::path::filename(path))) sys::fs::remove(path);
+        }
+    }
+    outs() << count << "\n";
+    return 0;
+}
+
+int main(int argc, const char **argv) {
+    InitLLVM X(argc, argv);
+    cl::ParseCommandLineOptions(argc, argv, "merge plugin result into a single file\n");
+    if (!UnreferencedPath.empty() && !Resolve) {
+        errs() << "objc-direct-merge: --unreferenced requires --resolve\n";
+        return 1;
+    }
+
+    if (Input.empty() || !sys::fs::is_directory(Input)) {
+        outs() << "😡 There is no input directory to merge :(\n";
+        return 0;
+    }
+
+    SmallString<256> manifestDir(Input);
+    sys::path::append(manifestDir, StoreManifestDir);
+    if (sys::fs::is_directory(manifestDir)) return mergeStore();
+
+    // directory order, which is the order merge.py reads shards in
+    vector<string> paths;
+    error_code ec;
+    for (sys::fs::directory_iterator it(Input, ec), end; it != end && !ec; it.increment(ec)) {
+        StringRef path = it->path();
+        if (path.endswith(".json") || path.endswith(".dfshard")) {
+            paths.push_back(it->path());
+        }
+    }
+    if (ec) {
+        errs() << "objc-direct-merge: can't list " << Input << ": " << ec.message() << "\n";
+        return 1;
+    }
+    if (Resolve) return resolveShards(paths);
+
+    ConcurrentStringSet undirectableSels, undirectableNames;
+    bool ok = forEachShard(paths, [&](size_t) {
+        return UndirectableCollector(undirectableSels, undirectableNames);
+    });
+    if (!ok) return 1;
+
+    // Survivors are folded in shard order as soon as a prefix of shards is done,
+    // so the same header candidate repeated by thousands of shards is only kept
+    // once. The last candidate of a loc wins, at the position of the first one.
+    vector<DirectableMeth> entries;
+    StringMap<size_t> positionByLoc;
+    vector<vector<DirectableMeth>> pending(paths.size());
+    vector<bool> done(paths.size());
+    size_t nextToFold = 0;
+    mutex foldLock;
+    ok = forEachShard(paths, [&](size_t i) {
+        return SurvivorCollector(undirectableSels, undirectableNames, [&, i](vector<DirectableMeth> survivors) {
+            lock_guard<mutex> guard(foldLock);
+            pending[i] = move(survivors);
+            done[i] = true;
+            for (; nextToFold < paths.size() && done[nextToFold]; nextToFold++) {
+                for (auto &meth : pending[nextToFold]) {
+                    auto inserted = positionByLoc.insert({meth.loc, entries.size()});
+                    if (inserted.second) {
+                        entries.push_back(move(meth));
+                    } else {
+                        entries[inserted.first->second] = move(meth);
+                    }
+                }
+                pending[nextToFold] = vector<DirectableMeth>();
+            }
+        });
+    });
+    if (!ok) return 1;
+
+    size_t count = 0;
+    auto survivors = [&](function_ref<void(DirectableMeth &)> visit) {
+        for (auto &meth : entries) {
+            visit(meth);
+        }
+    };
+    if (!writeResult(paths, survivors, nullptr, count)) return 1;
+    outs() << count << "\n";
+    return 0;
+}
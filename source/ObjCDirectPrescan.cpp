@@ -0,0 +1,98 @@
+//
+//  ObjCDirectPrescan.cpp
+//  DirectableFinder
+//
+//  Scans the raw sources of a project for selectors used dynamically, string
+//  literals passed to NSSelectorFromString, KVC/KVO key paths and @selector,
+//  without compiling anything. The snapshot it writes is loaded by the plugin
+//  with -dynamic-selectors=<path>, candidates with these selectors are undirectable.
+//
+
+#include "SelectorSnapshot.h"
+#include "SourcePrescan.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include <atomic>
+
+using namespace std;
+using namespace llvm;
+
+static cl::list<string> Inputs(cl::Positional, cl::desc("<source file or directory>..."), cl::OneOrMore);
+
+static cl::opt<string> Output("o", cl::desc("Selector snapshot to write"), cl::value_desc("path"), cl::Required);
+
+static cl::opt<unsigned> Jobs("j", cl::desc("Number of files scanned in parallel, 0 uses all cores"), cl::init(0));
+
+static bool isObjCSource(StringRef path) {
+    auto extension = sys::path::extension(path);
+    return extension == ".h" || extension == ".m" || extension == ".mm";
+}
+
+// files are taken as they are, directories are walked for headers and ObjC sources
+static bool collectFiles(vector<string> &files) {
+    for (auto &input : Inputs) {
+        if (!sys::fs::is_directory(input)) {
+            files.push_back(input);
+            continue;
+        }
+        error_code ec;
+        for (sys::fs::recursive_directory_iterator it(input, ec), end; it != end && !ec; it.increment(ec)) {
+            if (it->type() != sys::fs::file_type::directory_file && isObjCSource(it->path())) {
+                files.push_back(it->path());
+            }
+        }
+        if (ec) {
+            errs() << "objc-direct-prescan: " << input << ": " << ec.message() << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, const char **argv) {
+    InitLLVM X(argc, argv);
+    cl::ParseCommandLineOptions(argc, argv, "Dynamic selector prescan of ObjC sources\n");
+
+    vector<string> files;
+    if (!collectFiles(files)) return 1;
+
+    // per file results, concatenated in file order
+    vector<vector<string>> results(files.size());
+    atomic<bool> ok(true);
+    {
+        ThreadPool pool(hardware_concurrency(Jobs));
+        for (size_t i = 0; i < files.size(); i++) {
+            pool.async([&, i] {
+                auto buf = MemoryBuffer::getFile(files[i], /*IsText=*/false, /*RequiresNullTerminator=*/false);
+                if (!buf) {
+                    errs() << "objc-direct-prescan: " << files[i] << ": " << buf.getError().message() << "\n";
+                    ok = false;
+                    return;
+                }
+                auto &sels = results[i];
+                prescanSource((*buf)->getBuffer(), sels);
+                llvm::sort(sels);
+                sels.erase(unique(sels.begin(), sels.end()), sels.end());
+            });
+        }
+        pool.wait();
+    }
+    if (!ok) return 1;
+
+    vector<string> sels;
+    for (auto &fileSels : results) {
+        move(fileSels.begin(), fileSels.end(), back_inserter(sels));
+    }
+    if (auto err = SelectorSnapshot::write(Output, move(sels))) {
+        logAllUnhandledErrors(move(err), errs(), "objc-direct-prescan: ");
+        return 1;
+    }
+    return 0;
+}
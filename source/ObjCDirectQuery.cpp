@@ -0,0 +1,390 @@
+//
+//  ObjCDirectQuery.cpp
+//  DirectableFinder
+//
+//  Lookups in a merged result written by `objc-direct-merge --format=index`,
+//  the index is mapped and binary searched, nothing else is read (merge.py's
+//  json is accepted too, and indexed in memory first). Matching
+//  entries are printed as one json object per line; the exit status is 0 when
+//  something matched, 1 when nothing did and 2 on errors, like grep.
+//  --compare joins the result with an earlier one and prints the entries
+//  disqualified and qualified since, with --shards the reason of each
+//  disqualification is looked up in the shards of the current run. Either side
+//  may be json, which is streamed against the other side's index. The exit
+//  status is 1 when something was disqualified, for CI.
+//
+
+#include "DirectableIndex.h"
+#include "DirectableMerge.h"
+#include "ShardStore.h"
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <mutex>
+
+using namespace std;
+using namespace llvm;
+
+static cl::opt<string> IndexPath(cl::Positional, cl::desc("<index or merged json>"), cl::Required);
+
+static cl::list<string> Names("name", cl::desc("Entries of a method, e.g. '-[Foo bar]'"), cl::value_desc("name"));
+
+static cl::list<string> Locs("loc", cl::desc("Entry declared at a location, path:line:column"), cl::value_desc("loc"));
+
+static cl::list<string> Files("file", cl::desc("Entries declared in a file"), cl::value_desc("path"));
+
+static cl::opt<bool> ListFiles("list-files", cl::desc("Print the files with entries"));
+
+static cl::opt<string> ExportJSON("export-json", cl::desc("Write the index as merge.py's json, in loc order"), cl::value_desc("path"));
+
+static cl::opt<string> ComparePath("compare", cl::desc("Print the entries disqualified and qualified since this earlier result, an index or merged json"), cl::value_desc("path"));
+
+static cl::opt<string> ShardsDir("shards", cl::desc("With --compare, output directory or store of the current run, the reason of every disqualification is looked up there"), cl::value_desc("dir"));
+
+static cl::opt<unsigned> Jobs("j", cl::desc("Number of shards read in parallel with --shards, 0 uses all cores"), cl::init(0));
+
+static void printEntry(raw_ostream &out, const DirectableIndex::Entry &entry) {
+    json::OStream json(out);
+    json.object([&] {
+        if (entry.estimates.estimatedDispatches) json.attribute("estimatedDispatches", (int64_t)*entry.estimates.estimatedDispatches);
+        if (entry.estimates.estimatedSavings) json.attribute("estimatedSavings", (int64_t)*entry.estimates.estimatedSavings);
+        json.attribute("isPropertyAccessor", entry.isPropertyAccessor);
+        json.attribute("loc", entry.loc);
+        json.attribute("name", entry.name);
+        json.attribute("sel", entry.sel);
+        if (entry.estimates.staticSends) json.attribute("staticSends", (int64_t)*entry.estimates.staticSends);
+    });
+    out << "\n";
+}
+
+// What the shards of the current run recorded about the disqualified entries.
+// A reason is the first of:
+//   removed      no shard has the candidate anymore: deleted, renamed or already direct
+//   override     a TU marked its name undirectable, it overrides or is overridden
+//   @selector    a -summary shard uses the selector in @selector
+//   id-receiver  a -summary shard sends the selector to id, Class or id<Protocol>
+//   protocol     a protocol of a -summary shard declares the method
+//   selector     a shard without summary marks the selector undirectable, for any
+//                of the three above
+//   override     the hierarchy of the -summary shards has it in a superclass or
+//                subclass too
+//   unknown      none of the above
+class Disqualifications {
+    StringSet<> locs;
+    StringSet<> names;
+    StringSet<> sels;
+    mutex lock;
+
+    // found in the shards
+    StringSet<> candidateLocs;
+    StringSet<> undirectNames;
+    StringSet<> selectorRefs;
+    StringSet<> dynamicSends;
+    // signed selectors
+    StringSet<> protocolMeths;
+    StringSet<> plainSels;
+    // the summaries, for the hierarchy
+    ProgramResolver resolver;
+
+    // one per shard, merged when the shard is done since strings only live while it is scanned
+    class Scanner : public ShardVisitor {
+        Disqualifications &found;
+        vector<string> candidateLocs, undirectNames, selectorRefs, dynamicSends, protocolMeths, sels;
+        DirectableShard summaryShard;
+    public:
+        Scanner(Disqualifications &f) : found(f) {}
+
+        bool wantsSummary() const override { return true; }
+        void visitSel(StringRef sel) override {
+            if (found.sels.count(sel)) sels.push_back(sel.str());
+        }
+        void visitUndirectMeth(StringRef name) override {
+            if (found.names.count(name)) undirectNames.push_back(name.str());
+        }
+        void visitMeth(const DirectableMethRef &meth) override {
+            if (found.locs.count(meth.loc)) candidateLocs.push_back(meth.loc.str());
+        }
+        void visitSummary(const DirectableSummary &summary) override {
+            summaryShard.hasSummary = true;
+            summaryShard.summary = summary;
+            for (auto &sel : summary.selectorRefs) {
+                if (found.sels.count(sel)) selectorRefs.push_back(sel);
+            }
+            for (auto &sel : summary.dynamicSends) {
+                if (found.sels.count(sel)) dynamicSends.push_back(sel);
+            }
+            for (auto &protocol : summary.protocols) {
+                for (StringRef meth : protocol.meths) {
+                    if (found.sels.count(meth.drop_front())) protocolMeths.push_back(meth.str());
+                }
+            }
+        }
+        void finish() {
+            lock_guard<mutex> guard(found.lock);
+            for (auto &loc : candidateLocs) found.candidateLocs.insert(loc);
+            for (auto &name : undirectNames) found.undirectNames.insert(name);
+            for (auto &sel : selectorRefs) found.selectorRefs.insert(sel);
+            for (auto &sel : dynamicSends) found.dynamicSends.insert(sel);
+            for (auto &meth : protocolMeths) found.protocolMeths.insert(meth);
+            // the resolver only reads the sels of shards without summary
+            if (!summaryShard.hasSummary) {
+                for (auto &sel : sels) found.plainSels.insert(sel);
+                return;
+            }
+            found.resolver.add(summaryShard);
+        }
+    };
+
+public:
+    void want(const DirectableMeth &entry) {
+        locs.insert(entry.loc);
+        names.insert(entry.name);
+        sels.insert(entry.sel);
+    }
+
+    Error scan(StringRef dir) {
+        auto paths = listShardFiles(dir);
+        if (!paths) return paths.takeError();
+        Error failed = Error::success();
+        {
+            ThreadPool pool(hardware_concurrency(Jobs));
+            for (auto &path : *paths) {
+                pool.async([&] {
+                    Scanner scanner(*this);
+                    auto buf = MemoryBuffer::getFile(path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+                    Error err = buf ? scanShard((*buf)->getBuffer(), scanner) : errorCodeToError(buf.getError());
+                    if (err) {
+                        lock_guard<mutex> guard(lock);
+                        failed = joinErrors(move(failed), createFileError(path, move(err)));
+                        return;
+                    }
+                    scanner.finish();
+                });
+            }
+            pool.wait();
+        }
+        return failed;
+    }
+
+    StringRef reason(const DirectableMeth &entry) const {
+        if (!candidateLocs.count(entry.loc)) return "removed";
+        if (undirectNames.count(entry.name)) return "override";
+        if (selectorRefs.count(entry.sel)) return "@selector";
+        if (dynamicSends.count(entry.sel)) return "id-receiver";
+        if (protocolMeths.count((StringRef(entry.name).take_front() + entry.sel).str())) return "protocol";
+        if (plainSels.count(entry.sel)) return "selector";
+        if (resolver.isOverride(entry)) return "override";
+        return "unknown";
+    }
+};
+
+static void printChange(raw_ostream &out, StringRef change, const DirectableMeth &entry, StringRef reason) {
+    json::OStream json(out);
+    json.object([&] {
+        json.attribute("change", change);
+        json.attribute("loc", entry.loc);
+        json.attribute("name", entry.name);
+        if (!reason.empty()) json.attribute("reason", reason);
+        json.attribute("sel", entry.sel);
+    });
+    out << "\n";
+}
+
+// a side of --compare, an index or merge.py's json
+struct CompareSide {
+    unique_ptr<DirectableIndex> index;
+    unique_ptr<MemoryBuffer> json;
+};
+
+static Expected<CompareSide> openCompareSide(StringRef path) {
+    auto buf = MemoryBuffer::getFile(path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (!buf) return createFileError(path, buf.getError());
+    CompareSide side;
+    if (!DirectableIndex::isIndex((*buf)->getBuffer())) {
+        side.json = move(*buf);
+        return side;
+    }
+    auto index = DirectableIndex::load(move(*buf));
+    if (!index) return index.takeError();
+    side.index = move(*index);
+    return side;
+}
+
+static bool byLocAndName(const DirectableMeth &a, const DirectableMeth &b) {
+    return a.loc != b.loc ? a.loc < b.loc : a.name < b.name;
+}
+
+// Both indexes are sorted by (loc, name), one pass over each finds the entries
+// only one of them has.
+static void joinIndexes(const DirectableIndex &before, const DirectableIndex &current, vector<DirectableMeth> &disqualified, vector<DirectableMeth> &qualified) {
+    size_t i = 0, j = 0;
+    while (i < before.size() || j < current.size()) {
+        if (j == current.size()) {
+            disqualified.push_back(before[i++].meth());
+            continue;
+        }
+        if (i == before.size()) {
+            qualified.push_back(current[j++].meth());
+            continue;
+        }
+        auto a = before[i], b = current[j];
+        int order = a.loc.compare(b.loc);
+        if (order == 0) order = a.name.compare(b.name);
+        if (order < 0) {
+            disqualified.push_back(a.meth());
+            i++;
+        } else if (order > 0) {
+            qualified.push_back(b.meth());
+            j++;
+        } else {
+            i++;
+            j++;
+        }
+    }
+}
+
+// The json is streamed and each of its entries looked up by loc in the index,
+// a bit per index entry marks the matched ones. Only the entries one side has
+// are kept.
+static Error joinJSON(const MemoryBuffer &json, const DirectableIndex &index, vector<DirectableMeth> &onlyJSON, vector<DirectableMeth> &onlyIndex) {
+    BitVector matched(index.size());
+    auto err = scanMergedResultJSON(json.getBuffer(), [&](const DirectableMethRef &ref) {
+        auto i = index.findLoc(ref.loc);
+        if (i && index[*i].name == ref.name) {
+            matched.set(*i);
+            return;
+        }
+        DirectableMeth meth;
+        meth.name = ref.name.str();
+        meth.sel = ref.sel.str();
+        meth.loc = ref.loc.str();
+        meth.isPropertyAccessor = ref.isPropertyAccessor;
+        onlyJSON.push_back(move(meth));
+    });
+    if (err) return createFileError(json.getBufferIdentifier(), move(err));
+    llvm::sort(onlyJSON, byLocAndName);
+    for (size_t i = 0; i < index.size(); i++) {
+        if (!matched.test(i)) onlyIndex.push_back(index[i].meth());
+    }
+    return Error::success();
+}
+
+// Changes are printed in (loc, name) order, disqualified first. Two json
+// results would have to be indexed in memory, one side has to be an index.
+static int compare(StringRef currentPath) {
+    auto before = openCompareSide(ComparePath);
+    if (!before) {
+        logAllUnhandledErrors(before.takeError(), errs(), "objc-direct-query: ");
+        return 2;
+    }
+    auto current = openCompareSide(currentPath);
+    if (!current) {
+        logAllUnhandledErrors(current.takeError(), errs(), "objc-direct-query: ");
+        return 2;
+    }
+    if (!before->index && !current->index) {
+        errs() << "objc-direct-query: --compare needs an index on one side, write it with objc-direct-merge --format=index\n";
+        return 2;
+    }
+
+    vector<DirectableMeth> disqualified, qualified;
+    if (before->index && current->index) {
+        joinIndexes(*before->index, *current->index, disqualified, qualified);
+    } else {
+        auto err = current->index ? joinJSON(*before->json, *current->index, disqualified, qualified)
+                                  : joinJSON(*current->json, *before->index, qualified, disqualified);
+        if (err) {
+            logAllUnhandledErrors(move(err), errs(), "objc-direct-query: ");
+            return 2;
+        }
+    }
+
+    Disqualifications reasons;
+    if (!ShardsDir.empty()) {
+        for (auto &entry : disqualified) {
+            reasons.want(entry);
+        }
+        if (auto err = reasons.scan(ShardsDir)) {
+            logAllUnhandledErrors(move(err), errs(), "objc-direct-query: ");
+            return 2;
+        }
+    }
+    for (auto &entry : disqualified) {
+        printChange(outs(), "disqualified", entry, ShardsDir.empty() ? StringRef() : reasons.reason(entry));
+    }
+    for (auto &entry : qualified) {
+        printChange(outs(), "qualified", entry, StringRef());
+    }
+    errs() << "objc-direct-query: " << disqualified.size() << " disqualified, " << qualified.size() << " qualified\n";
+    return disqualified.empty() ? 0 : 1;
+}
+
+int main(int argc, const char **argv) {
+    InitLLVM X(argc, argv);
+    cl::ParseCommandLineOptions(argc, argv, "query a directable index\n");
+    if (!ShardsDir.empty() && ComparePath.empty()) {
+        errs() << "objc-direct-query: --shards requires --compare\n";
+        return 2;
+    }
+
+    if (!ComparePath.empty()) return compare(IndexPath);
+
+    auto index = DirectableIndex::loadResult(IndexPath);
+    if (!index) {
+        logAllUnhandledErrors(index.takeError(), errs(), "objc-direct-query: ");
+        return 2;
+    }
+    auto &entries = **index;
+
+    if (!ExportJSON.empty()) {
+        string content;
+        raw_string_ostream out(content);
+        MergedResultWriter writer(out);
+        for (size_t i = 0; i < entries.size(); i++) {
+            auto entry = entries[i];
+            writer.add(entry.meth(), entry.estimates);
+        }
+        writer.finish();
+        if (auto err = writeFileAtomically(ExportJSON, out.str())) {
+            logAllUnhandledErrors(move(err), errs(), "objc-direct-query: ");
+            return 2;
+        }
+        return 0;
+    }
+
+    bool matched = false;
+    for (auto &name : Names) {
+        for (auto i : entries.findName(name)) {
+            printEntry(outs(), entries[i]);
+            matched = true;
+        }
+    }
+    for (auto &loc : Locs) {
+        if (auto i = entries.findLoc(loc)) {
+            printEntry(outs(), entries[*i]);
+            matched = true;
+        }
+    }
+    for (auto &file : Files) {
+        auto range = entries.findFile(file);
+        for (auto i = range.first; i < range.second; i++) {
+            printEntry(outs(), entries[i]);
+            matched = true;
+        }
+    }
+    if (ListFiles) {
+        for (size_t i = 0; i < entries.fileCount(); i++) {
+            outs() << entries.file(i) << "\n";
+        }
+        matched |= entries.fileCount() != 0;
+    }
+    return matched ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+//
+//  SelectorSnapshot.cpp
+//  DirectableFinder
+//
+
+#include "SelectorSnapshot.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/EndianStream.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace std;
+using namespace llvm;
+
+static const char Magic[8] = {'D', 'F', 'S', 'E', 'L', 'T', 'B', '1'};
+static const size_t HeaderSize = sizeof(Magic) + sizeof(uint32_t);
+
+Expected<unique_ptr<SelectorSnapshot>> SelectorSnapshot::load(StringRef path) {
+    // large tables are mmap'ed by MemoryBuffer
+    auto buf = MemoryBuffer::getFile(path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (!buf) {
+        return createFileError(path, buf.getError());
+    }
+
+    StringRef data = (*buf)->getBuffer();
+    if (data.size() < HeaderSize || !data.startswith(StringRef(Magic, sizeof(Magic)))) {
+        return createFileError(path, make_error<StringError>("not a selector snapshot", inconvertibleErrorCode()));
+    }
+
+    uint32_t count = support::endian::read32le(data.data() + sizeof(Magic));
+    uint64_t blobStart = HeaderSize + (uint64_t(count) + 1) * sizeof(uint32_t);
+    if (data.size() < blobStart) {
+        return createFileError(path, make_error<StringError>("truncated selector snapshot", inconvertibleErrorCode()));
+    }
+
+    unique_ptr<SelectorSnapshot> snapshot(new SelectorSnapshot(move(*buf)));
+    snapshot->count = count;
+    snapshot->offsets = data.data() + HeaderSize;
+    snapshot->blob = data.data() + blobStart;
+    uint32_t blobSize = support::endian::read32le(snapshot->offsets + count * sizeof(uint32_t));
+    if (blobStart + blobSize > data.size()) {
+        return createFileError(path, make_error<StringError>("truncated selector snapshot", inconvertibleErrorCode()));
+    }
+    return snapshot;
+}
+
+StringRef SelectorSnapshot::operator[](size_t i) const {
+    uint32_t begin = support::endian::read32le(offsets + i * sizeof(uint32_t));
+    uint32_t end = support::endian::read32le(offsets + (i + 1) * sizeof(uint32_t));
+    return StringRef(blob + begin, end - begin);
+}
+
+bool SelectorSnapshot::contains(StringRef sel) const {
+    size_t low = 0, high = count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        int order = (*this)[mid].compare(sel);
+        if (order == 0) return true;
+        if (order < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return false;
+}
+
+Error SelectorSnapshot::write(StringRef path, vector<string> sels) {
+    llvm::sort(sels);
+    sels.erase(unique(sels.begin(), sels.end()), sels.end());
+
+    int fd;
+    SmallString<128> tmpPath;
+    if (auto ec = sys::fs::createUniqueFile(path + ".tmp-%%%%%%", fd, tmpPath)) {
+        return createFileError(path, ec);
+    }
+
+    {
+        raw_fd_ostream out(fd, /*shouldClose=*/true);
+        out.write(Magic, sizeof(Magic));
+        support::endian::write<uint32_t>(out, sels.size(), support::little);
+        uint32_t offset = 0;
+        for (auto &sel : sels) {
+            support::endian::write<uint32_t>(out, offset, support::little);
+            offset += sel.size();
+        }
+        support::endian::write<uint32_t>(out, offset, support::little);
+        for (auto &sel : sels) {
+            out << sel;
+        }
+        out.close();
+        if (out.has_error()) {
+            auto ec = out.error();
+            out.clear_error();
+            sys::fs::remove(tmpPath);
+            return createFileError(path, ec);
+        }
+    }
+
+    if (auto ec = sys::fs::rename(tmpPath, path)) {
+        sys::fs::remove(tmpPath);
+        return createFileError(path, ec);
+    }
+    return Error::success();
+}
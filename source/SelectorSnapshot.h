@@ -0,0 +1,48 @@
+//
+//  SelectorSnapshot.h
+//  DirectableFinder
+//
+
+#ifndef SELECTOR_SNAPSHOT_H
+#define SELECTOR_SNAPSHOT_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// A sorted, memory-mapped selector table.
+//
+// Layout (little endian):
+//   char     magic[8]            "DFSELTB1"
+//   uint32_t count
+//   uint32_t offsets[count + 1]  entry i is blob[offsets[i], offsets[i + 1])
+//   char     blob[]
+//
+// Selectors are unique and sorted bytewise, so lookups are a binary search
+// directly over the mapped file.
+class SelectorSnapshot {
+    std::unique_ptr<llvm::MemoryBuffer> buffer;
+    uint32_t count = 0;
+    const char *offsets = nullptr;
+    const char *blob = nullptr;
+
+    SelectorSnapshot(std::unique_ptr<llvm::MemoryBuffer> buf) : buffer(std::move(buf)) {}
+
+public:
+    static llvm::Expected<std::unique_ptr<SelectorSnapshot>> load(llvm::StringRef path);
+
+    // sorts and uniques `sels`, replaces `path` atomically
+    static llvm::Error write(llvm::StringRef path, std::vector<std::string> sels);
+
+    size_t size() const { return count; }
+    // the whole mapped file, to hash it
+    llvm::StringRef contents() const { return buffer->getBuffer(); }
+    llvm::StringRef operator[](size_t i) const;
+    bool contains(llvm::StringRef sel) const;
+};
+
+#endif
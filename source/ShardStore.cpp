@@ -0,0 +1,215 @@
+//
+//  ShardStore.cpp
+//  DirectableFinder
+//
+
+#include "ShardStore.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+#include <chrono>
+
+using namespace std;
+using namespace llvm;
+
+const char *const StoreObjectsDir = "objects";
+const char *const StoreManifestDir = "tus";
+const char *const StoreLastMergeFile = "last-merge";
+const char *const HeaderRecordPrefix = "header-";
+
+static Error storeError(const Twine &message) {
+    return make_error<StringError>(message, inconvertibleErrorCode());
+}
+
+string manifestEntryToString(const ManifestEntry &entry) {
+    return "source\t" + entry.source + "\ninputs\t" + entry.inputs + "\nobject\t" + entry.object + "\n";
+}
+
+Expected<ManifestEntry> manifestEntryFromString(StringRef content) {
+    ManifestEntry entry;
+    SmallVector<StringRef, 4> lines;
+    content.split(lines, '\n', -1, /*KeepEmpty=*/false);
+    for (auto line : lines) {
+        auto field = line.split('\t');
+        if (field.first == "source") {
+            entry.source = field.second.str();
+        } else if (field.first == "inputs") {
+            entry.inputs = field.second.str();
+        } else if (field.first == "object") {
+            entry.object = field.second.str();
+        }
+    }
+    if (entry.object.empty()) return storeError("manifest entry without object");
+    return entry;
+}
+
+static SmallString<256> storePath(StringRef storeDir, StringRef subdir, StringRef name) {
+    SmallString<256> path(storeDir);
+    sys::path::append(path, subdir, name);
+    return path;
+}
+
+Expected<ManifestEntry> readManifestEntry(StringRef storeDir, StringRef key) {
+    auto path = storePath(storeDir, StoreManifestDir, key);
+    auto buf = MemoryBuffer::getFile(path);
+    if (!buf) return createFileError(path, buf.getError());
+    auto entry = manifestEntryFromString((*buf)->getBuffer());
+    if (!entry) return createFileError(path, entry.takeError());
+    return entry;
+}
+
+Expected<vector<string>> listShardFiles(StringRef dir) {
+    vector<string> paths;
+    error_code ec;
+    SmallString<256> manifestDir(dir);
+    sys::path::append(manifestDir, StoreManifestDir);
+    if (!sys::fs::is_directory(manifestDir)) {
+        for (sys::fs::directory_iterator it(dir, ec), end; it != end && !ec; it.increment(ec)) {
+            StringRef path = it->path();
+            if (path.endswith(".json") || path.endswith(".dfshard")) paths.push_back(path.str());
+        }
+        if (ec) return createFileError(dir, ec);
+        llvm::sort(paths);
+        return paths;
+    }
+    
+    for (sys::fs::directory_iterator it(manifestDir, ec), end; it != end && !ec; it.increment(ec)) {
+        auto key = sys::path::filename(it->path());
+        // leftover of a job killed while writing its entry
+        if (key.contains(".tmp-")) continue;
+        auto entry = readManifestEntry(dir, key);
+        if (!entry) return entry.takeError();
+        paths.push_back(storePath(dir, StoreObjectsDir, entry->object).str().str());
+    }
+    if (ec) return createFileError(manifestDir, ec);
+    llvm::sort(paths);
+    paths.erase(unique(paths.begin(), paths.end()), paths.end());
+    return paths;
+}
+
+// the entry is still produced by a build, see `--gc`
+static void touchManifestEntry(StringRef storeDir, StringRef key) {
+    int fd;
+    if (sys::fs::openFileForWrite(storePath(storeDir, StoreManifestDir, key), fd, sys::fs::CD_OpenExisting, sys::fs::OF_Append)) return;
+    sys::fs::setLastAccessAndModificationTime(fd, chrono::system_clock::now());
+    sys::Process::SafelyCloseFileDescriptor(fd);
+}
+
+bool isManifestEntryUpToDate(StringRef storeDir, StringRef key, StringRef inputs) {
+    auto entry = readManifestEntry(storeDir, key);
+    if (!entry) {
+        consumeError(entry.takeError());
+        return false;
+    }
+    if (entry->inputs != inputs || !sys::fs::exists(storePath(storeDir, StoreObjectsDir, entry->object))) return false;
+    touchManifestEntry(storeDir, key);
+    return true;
+}
+
+Error writeFileAtomically(StringRef path, StringRef content) {
+    return llvm::writeFileAtomically((path + ".tmp-%%%%%%%%").str(), path, content);
+}
+
+Error writeFileAtomically(StringRef path, function<void(raw_ostream &)> write) {
+    return llvm::writeFileAtomically((path + ".tmp-%%%%%%%%").str(), path, [&](raw_ostream &out) {
+        write(out);
+        return Error::success();
+    });
+}
+
+Error commitShardToStore(StringRef storeDir, StringRef key, ManifestEntry entry, StringRef content, StringRef extension) {
+    for (auto subdir : {StoreObjectsDir, StoreManifestDir}) {
+        SmallString<256> dir(storeDir);
+        sys::path::append(dir, subdir);
+        if (auto ec = sys::fs::create_directories(dir)) return createFileError(dir, ec);
+    }
+
+    MD5 hash;
+    hash.update(content);
+    MD5::MD5Result digest;
+    hash.final(digest);
+    entry.object = (digest.digest() + extension).str();
+
+    // same name, same content: an existing object is never rewritten
+    auto objectPath = storePath(storeDir, StoreObjectsDir, entry.object);
+    if (!sys::fs::exists(objectPath)) {
+        if (auto err = writeFileAtomically(objectPath, content)) return err;
+    }
+    return writeFileAtomically(storePath(storeDir, StoreManifestDir, key), manifestEntryToString(entry));
+}
+
+Expected<bool> writeFileIfAbsent(StringRef path, StringRef content) {
+    int fd;
+    SmallString<256> tempPath;
+    if (auto ec = sys::fs::createUniqueFile(path + ".tmp-%%%%%%%%", fd, tempPath)) return createFileError(path, ec);
+    {
+        raw_fd_ostream out(fd, /*shouldClose=*/true);
+        out << content;
+        out.close();
+        if (out.has_error()) {
+            out.clear_error();
+            sys::fs::remove(tempPath);
+            return createFileError(tempPath, storeError("can't write"));
+        }
+    }
+    // linking fails instead of replacing, unlike a rename
+    auto ec = sys::fs::create_hard_link(tempPath, path);
+    sys::fs::remove(tempPath);
+    if (ec == errc::file_exists) return false;
+    if (ec) return createFileError(path, ec);
+    return true;
+}
+
+static SmallString<256> headerRecordPath(StringRef outputDir, StringRef key, StringRef extension) {
+    SmallString<256> path(outputDir);
+    sys::path::append(path, HeaderRecordPrefix + key + extension);
+    return path;
+}
+
+Expected<Optional<string>> readHeaderRecord(StringRef outputDir, bool store, StringRef key, StringRef extension) {
+    SmallString<256> path;
+    if (store) {
+        string entryKey = (HeaderRecordPrefix + key).str();
+        if (!sys::fs::exists(storePath(outputDir, StoreManifestDir, entryKey))) return Optional<string>();
+        auto entry = readManifestEntry(outputDir, entryKey);
+        if (!entry) return entry.takeError();
+        path = storePath(outputDir, StoreObjectsDir, entry->object);
+        touchManifestEntry(outputDir, entryKey);
+    } else {
+        path = headerRecordPath(outputDir, key, extension);
+        if (!sys::fs::exists(path)) return Optional<string>();
+    }
+    auto buf = MemoryBuffer::getFile(path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (!buf) return createFileError(path, buf.getError());
+    return Optional<string>((*buf)->getBuffer().str());
+}
+
+Expected<bool> commitHeaderRecord(StringRef outputDir, bool store, StringRef key, StringRef source, StringRef content, StringRef extension) {
+    if (!store) return writeFileIfAbsent(headerRecordPath(outputDir, key, extension), content);
+    
+    for (auto subdir : {StoreObjectsDir, StoreManifestDir}) {
+        SmallString<256> dir(outputDir);
+        sys::path::append(dir, subdir);
+        if (auto ec = sys::fs::create_directories(dir)) return createFileError(dir, ec);
+    }
+    MD5 hash;
+    hash.update(content);
+    MD5::MD5Result digest;
+    hash.final(digest);
+    ManifestEntry entry;
+    entry.source = source.str();
+    entry.inputs = key.str();
+    entry.object = (digest.digest() + extension).str();
+    auto objectPath = storePath(outputDir, StoreObjectsDir, entry.object);
+    if (!sys::fs::exists(objectPath)) {
+        if (auto err = writeFileAtomically(objectPath, content)) return {move(err)};
+    }
+    return writeFileIfAbsent(storePath(outputDir, StoreManifestDir, (HeaderRecordPrefix + key).str()), manifestEntryToString(entry));
+}
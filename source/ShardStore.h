@@ -0,0 +1,78 @@
+//
+//  ShardStore.h
+//  DirectableFinder
+//
+
+#ifndef SHARD_STORE_H
+#define SHARD_STORE_H
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+// Content-addressed shard store, the layout of -output-dir with -store:
+//   objects/<md5 of content>.<json|dfshard>  shards, identical TUs share one
+//   tus/<tu key>                             manifest entry, the current shard of a TU
+//   last-merge                               written by every merge, entries older
+//                                            than it weren't touched by a build since
+// A TU key is derived from its main file and compile options, so every build
+// configuration of a file has its own entry. Every file is written to a
+// temporary name and renamed, parallel compile jobs never see torn files.
+// Entries found up to date, and header records found, are touched.
+extern const char *const StoreObjectsDir;
+extern const char *const StoreManifestDir;
+extern const char *const StoreLastMergeFile;
+
+struct ManifestEntry {
+    // main file of the TU
+    std::string source;
+    // hash of every input file of the TU
+    std::string inputs;
+    // file name in objects/
+    std::string object;
+};
+
+std::string manifestEntryToString(const ManifestEntry &entry);
+llvm::Expected<ManifestEntry> manifestEntryFromString(llvm::StringRef content);
+llvm::Expected<ManifestEntry> readManifestEntry(llvm::StringRef storeDir, llvm::StringRef key);
+
+// the shards of a flat output directory, or the objects a store's entries
+// reference, sorted
+llvm::Expected<std::vector<std::string>> listShardFiles(llvm::StringRef dir);
+
+// true if the TU's entry was analyzed from the same inputs and its shard still
+// exists, the entry is touched then
+bool isManifestEntryUpToDate(llvm::StringRef storeDir, llvm::StringRef key, llvm::StringRef inputs);
+
+// stores `content` under its hash unless it already exists, then points the
+// TU's entry, `source` and `inputs` filled in by the caller, at it
+llvm::Error commitShardToStore(llvm::StringRef storeDir, llvm::StringRef key, ManifestEntry entry, llvm::StringRef content, llvm::StringRef extension);
+
+// temp file + rename next to `path`
+llvm::Error writeFileAtomically(llvm::StringRef path, llvm::StringRef content);
+// same, `write` streams into the temp file instead of building the content first
+llvm::Error writeFileAtomically(llvm::StringRef path, std::function<void(llvm::raw_ostream &)> write);
+
+// temp file + hard link, an existing `path` is kept; false when it already existed
+llvm::Expected<bool> writeFileIfAbsent(llvm::StringRef path, llvm::StringRef content);
+
+// Header records of -header-cache, shards holding what every TU importing a
+// header would record about it. They are merged like any other shard:
+//   <output dir>/header-<key><extension>     without -store
+//   tus/header-<key>                         manifest entry with -store, `source` is the header
+// The key covers the header's real path, `source` is the only header a record is for.
+// A record is never replaced once written, TUs that find one leave its content
+// out of their own shard.
+extern const char *const HeaderRecordPrefix;
+
+// the record's content, None if there is none yet
+llvm::Expected<llvm::Optional<std::string>> readHeaderRecord(llvm::StringRef outputDir, bool store, llvm::StringRef key, llvm::StringRef extension);
+
+// false when a concurrent job already wrote the record
+llvm::Expected<bool> commitHeaderRecord(llvm::StringRef outputDir, bool store, llvm::StringRef key, llvm::StringRef source, llvm::StringRef content, llvm::StringRef extension);
+
+#endif
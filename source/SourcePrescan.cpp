@@ -0,0 +1,155 @@
+//
+//  SourcePrescan.cpp
+//  DirectableFinder
+//
+
+#include "SourcePrescan.h"
+
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/MathExtras.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+using namespace std;
+using namespace llvm;
+
+// first '@' or '"' in [p, end), `end` if there is none; 16 bytes per step
+// with SSE2 or NEON, the tail and other targets byte by byte
+static const char *findSpecial(const char *p, const char *end) {
+#if defined(__SSE2__)
+    const __m128i at = _mm_set1_epi8('@');
+    const __m128i quote = _mm_set1_epi8('"');
+    for (; end - p >= 16; p += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, at), _mm_cmpeq_epi8(chunk, quote)));
+        if (mask) return p + countTrailingZeros(mask);
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const uint8x16_t at = vdupq_n_u8('@');
+    const uint8x16_t quote = vdupq_n_u8('"');
+    for (; end - p >= 16; p += 16) {
+        uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t *>(p));
+        // the hit is located by the loop below
+        if (vmaxvq_u8(vorrq_u8(vceqq_u8(chunk, at), vceqq_u8(chunk, quote)))) break;
+    }
+#endif
+    for (; p != end; p++) {
+        if (*p == '@' || *p == '"') return p;
+    }
+    return end;
+}
+
+static bool isIdentifierHead(char c) {
+    return isAlpha(c) || c == '_';
+}
+
+static bool isIdentifierBody(char c) {
+    return isAlnum(c) || c == '_';
+}
+
+static bool isIdentifier(StringRef text) {
+    if (text.empty() || !isIdentifierHead(text.front())) return false;
+    return all_of(text.drop_front(), isIdentifierBody);
+}
+
+// "foo:", "foo:bar:", "foo::"
+static bool isKeywordSelector(StringRef text) {
+    if (!text.endswith(":") || !isIdentifierHead(text.front())) return false;
+    return all_of(text, [](char c) { return isIdentifierBody(c) || c == ':'; });
+}
+
+// the key and the accessors valueForKey: and setValue:forKey: look up for it
+static void addKey(StringRef key, vector<string> &sels) {
+    auto capitalized = key.take_front(1).upper() + key.drop_front(1).str();
+    sels.push_back(key.str());
+    sels.push_back("get" + capitalized);
+    sels.push_back("is" + capitalized);
+    sels.push_back(("_" + key).str());
+    sels.push_back("set" + capitalized + ":");
+    sels.push_back("_set" + capitalized + ":");
+}
+
+static void addLiteral(StringRef literal, vector<string> &sels) {
+    if (literal.empty()) return;
+    if (isKeywordSelector(literal)) {
+        sels.push_back(literal.str());
+        return;
+    }
+
+    // key paths, "@avg.price" collection operators are not keys
+    SmallVector<StringRef, 4> keys;
+    literal.split(keys, '.');
+    for (auto key : keys) {
+        if (!key.startswith("@") && !isIdentifier(key)) return;
+    }
+    for (auto key : keys) {
+        if (!key.startswith("@")) addKey(key, sels);
+    }
+}
+
+// @selector( foo:bar: ), `p` is after "@selector"
+static const char *scanSelectorExpr(const char *p, const char *end, vector<string> &sels) {
+    while (p != end && isSpace(*p)) p++;
+    if (p == end || *p != '(') return p;
+    string sel;
+    for (p++; p != end && *p != ')'; p++) {
+        if (isSpace(*p)) continue;
+        if (!isIdentifierBody(*p) && *p != ':') return p;
+        sel += *p;
+    }
+    if (!sel.empty()) sels.push_back(move(sel));
+    return p;
+}
+
+// `p` is after the opening quote; literals end at the closing quote or the
+// end of the line, a '"' in a comment has no closing quote
+static const char *scanLiteral(const char *p, const char *end, bool record, vector<string> &sels) {
+    const char *begin = p;
+    bool escaped = false;
+    for (; p != end && *p != '"' && *p != '\n'; p++) {
+        if (*p == '\\') {
+            escaped = true;
+            if (++p == end) break;
+        }
+    }
+    if (p == end || *p != '"') return p;
+    // escapes are never part of selectors or keys
+    if (record && !escaped) addLiteral(StringRef(begin, p - begin), sels);
+    return p + 1;
+}
+
+// whether `p` is on a preprocessor directive line, "Foo.h" is no key path
+static bool isDirectiveLine(const char *bufferStart, const char *p) {
+    const char *lineStart = p;
+    while (lineStart != bufferStart && lineStart[-1] != '\n') lineStart--;
+    while (lineStart != p && (*lineStart == ' ' || *lineStart == '\t')) lineStart++;
+    return *lineStart == '#';
+}
+
+void prescanSource(StringRef buffer, vector<string> &sels) {
+    const char *p = buffer.begin();
+    const char *end = buffer.end();
+    while ((p = findSpecial(p, end)) != end) {
+        if (*p == '@') {
+            // @"..." is read at its quote
+            StringRef rest(p + 1, end - p - 1);
+            if (rest.startswith("selector")) {
+                p = scanSelectorExpr(p + 1 + strlen("selector"), end, sels);
+            } else {
+                p++;
+            }
+            continue;
+        }
+        // '"' and '\"' character literals
+        if (p != buffer.begin() && (p[-1] == '\'' || p[-1] == '\\')) {
+            p++;
+            continue;
+        }
+        p = scanLiteral(p + 1, end, !isDirectiveLine(buffer.begin(), p), sels);
+    }
+}
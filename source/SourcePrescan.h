@@ -0,0 +1,24 @@
+//
+//  SourcePrescan.h
+//  DirectableFinder
+//
+
+#ifndef SOURCE_PRESCAN_H
+#define SOURCE_PRESCAN_H
+
+#include "llvm/ADT/StringRef.h"
+#include <string>
+#include <vector>
+
+// Lexical scan of a raw source buffer for selectors that may be used
+// dynamically, without preprocessing or parsing:
+//   @selector(foo:bar:)                         "foo:bar:"
+//   @"foo:bar:", "foo:bar:"                     "foo:bar:", NSSelectorFromString
+//   @"foo", @"foo.bar", @"@sum.foo"             every key of the key path and the
+//                                               accessors KVC looks up for it:
+//                                               foo getFoo isFoo _foo setFoo: _setFoo:
+// Comments and unused code are scanned too, the result is a superset of what
+// the AST would show. Literals of #include/#import lines are skipped.
+void prescanSource(llvm::StringRef buffer, std::vector<std::string> &sels);
+
+#endif
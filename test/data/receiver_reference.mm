@@ -0,0 +1,47 @@
+// id receivers narrowed to the classes assigned in the body, ObjC++ can also
+// write a variable through a reference
+
+__attribute__((objc_root_class))
+@interface TestObject {
+    Class isa;
+}
++ (instancetype)alloc;
+- (instancetype)init;
+@end
+
+@interface Cell : TestObject
+- (void)refresh;
+- (void)layout;
+- (void)draw;
+@end
+
+@interface Button : TestObject
+- (void)refresh;
+- (void)layout;
+- (void)draw;
+@end
+
+static void rebind(id &target, id value) {
+    target = value;
+}
+
+// sends refresh to a Button
+void refreshThroughReference(Button *button) {
+    id item = [[Cell alloc] init];
+    id &alias = item;
+    alias = button;
+    [item refresh];
+}
+
+// sends layout to a Button
+void layoutThroughParameter(Button *button) {
+    id item = [[Cell alloc] init];
+    rebind(item, button);
+    [item layout];
+}
+
+// only ever a Cell
+void drawCell() {
+    id item = [[Cell alloc] init];
+    [item draw];
+}
@@ -0,0 +1,503 @@
+#!/usr/bin/python3
+
+# Regression tests of the tools built next to the plugin, on synthetic shards
+# of bench/gen_shards.py and the fixtures in test/data:
+#
+#   merge      objc-direct-merge writes merge.py's bytes, from json and binary shards
+#              and --gc drops store entries of configurations no longer built
+#   shards     json and binary shards read back as the shard they were written from
+#   index      objc-direct-query finds what the merged json has
+#   link map   --link-map savings of candidates in bench/data/sample.linkmap
+#   compare    objc-direct-query --compare finds the changes of a run and their reasons
+#   aggregator objc-direct-aggregator streams to the result objc-direct-merge writes,
+#              with --aggregator-tool only
+#   plugin     shards the plugin writes for the sources in test/data, with --clang
+#              and --plugin only
+#
+# Run by `ninja check-directable-finder`, or by hand with the tool paths.
+
+import argparse
+import json
+import os
+import pathlib
+import shutil
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+import unittest
+
+ROOT = pathlib.Path(__file__).resolve().parent.parent
+DATA = ROOT / "test" / "data"
+sys.path.insert(0, str(ROOT / "bench"))
+
+import gen_shards
+
+tools = None
+
+
+def run(cmd, expect=0):
+	proc = subprocess.run([str(c) for c in cmd], stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True)
+	if proc.returncode != expect:
+		raise AssertionError("%s exited with %d, expected %d\n%s" % (" ".join(str(c) for c in cmd), proc.returncode, expect, proc.stderr))
+	return proc.stdout
+
+
+def read_json(path):
+	with open(path, encoding="utf-8") as f:
+		return json.load(f)
+
+
+class CorpusTestCase(unittest.TestCase):
+	# one corpus per class, big enough for repeated header candidates and collisions
+	@classmethod
+	def setUpClass(cls):
+		cls.tmp = tempfile.TemporaryDirectory()
+		cls.shards = os.path.join(cls.tmp.name, "shards")
+		gen_shards.make_corpus(cls.shards, 120, 300, 20, 7)
+
+	@classmethod
+	def tearDownClass(cls):
+		cls.tmp.cleanup()
+
+	def path(self, name):
+		return os.path.join(self.tmp.name, name)
+
+
+class MergeTests(CorpusTestCase):
+	def test_same_bytes_as_merge_py(self):
+		run([sys.executable, ROOT / "merge.py", "-i", self.shards, "-o", self.path("merge_py.json")])
+		run([tools.merge_tool, "-i", self.shards, "-o", self.path("native.json"), "-j", "4"])
+		with open(self.path("merge_py.json"), "rb") as a, open(self.path("native.json"), "rb") as b:
+			self.assertEqual(a.read(), b.read())
+
+	def test_binary_shards_merge_the_same(self):
+		binary = self.path("binary")
+		os.makedirs(binary)
+		run([tools.roundtrip_tool, "--binary-dir=" + binary] + [os.path.join(self.shards, f) for f in sorted(os.listdir(self.shards))])
+		run([tools.merge_tool, "-i", self.shards, "-o", self.path("from_json.json")])
+		run([tools.merge_tool, "-i", binary, "-o", self.path("from_binary.json")])
+		# the order follows the directory, the entries don't
+		self.assertEqual(read_json(self.path("from_json.json")), read_json(self.path("from_binary.json")))
+
+	def test_gc_drops_configurations_no_longer_built(self):
+		# a -store directory with one source built in two configurations
+		store = self.path("store")
+		source = self.path("Feed.m")
+		open(source, "w").close()
+		for subdir in ("objects", "tus"):
+			os.makedirs(os.path.join(store, subdir))
+		for config, name in (("debug", "-[Feed reload]"), ("release", "-[Feed layout]")):
+			with open(os.path.join(store, "objects", config + ".json"), "w") as f:
+				json.dump({"sels": [], "meths": [meth(name, "/src/Feed.h:%d:1" % len(config))], "undirect_meths": []}, f)
+			with open(os.path.join(store, "tus", config), "w") as f:
+				f.write("source\t%s\ninputs\t%s\nobject\t%s.json\n" % (source, config, config))
+
+		def merged():
+			run([tools.merge_tool, "-i", store, "-o", self.path("store.json"), "--gc"])
+			return sorted(m["name"] for m in read_json(self.path("store.json")).values())
+
+		self.assertEqual(merged(), ["-[Feed layout]", "-[Feed reload]"])
+		# the next build only touches the debug entry
+		now = time.time()
+		os.utime(os.path.join(store, "tus", "release"), (now - 60, now - 60))
+		os.utime(os.path.join(store, "tus", "debug"), (now + 60, now + 60))
+		self.assertEqual(merged(), ["-[Feed reload]"])
+		self.assertEqual(sorted(os.listdir(os.path.join(store, "objects"))), ["debug.json"])
+
+
+class ShardTests(CorpusTestCase):
+	def test_round_trip(self):
+		run([tools.roundtrip_tool, DATA / "summary.json"] + [os.path.join(self.shards, f) for f in sorted(os.listdir(self.shards))[:20]])
+
+	def test_malformed_shard_is_rejected(self):
+		bad = self.path("bad.json")
+		with open(bad, "w") as f:
+			f.write('{"sels": [], "meths": [{"name": 1}], "undirect_meths": []}')
+		run([tools.roundtrip_tool, bad], expect=1)
+
+
+class IndexTests(CorpusTestCase):
+	@classmethod
+	def setUpClass(cls):
+		super().setUpClass()
+		run([tools.merge_tool, "-i", cls.shards, "-o", os.path.join(cls.tmp.name, "result.json")])
+		run([tools.merge_tool, "-i", cls.shards, "-o", os.path.join(cls.tmp.name, "result.dfindex"), "--format=index"])
+		cls.merged = read_json(os.path.join(cls.tmp.name, "result.json"))
+
+	def query(self, *args, expect=0):
+		out = run([tools.query_tool, self.path("result.dfindex")] + list(args), expect=expect)
+		return [json.loads(line) for line in out.splitlines()]
+
+	def test_lookups(self):
+		meth = sorted(self.merged.values(), key=lambda m: m["loc"])[len(self.merged) // 2]
+		self.assertEqual(self.query("--loc=" + meth["loc"]), [meth])
+		self.assertIn(meth, self.query("--name=" + meth["name"]))
+		path = meth["loc"].rsplit(":", 2)[0]
+		in_file = [m for m in self.merged.values() if m["loc"].rsplit(":", 2)[0] == path]
+		self.assertCountEqual(self.query("--file=" + path), in_file)
+
+	def test_no_match(self):
+		self.assertEqual(self.query("--name=-[GLNoSuchClass nothing]", expect=1), [])
+
+	def test_list_files(self):
+		files = run([tools.query_tool, self.path("result.dfindex"), "--list-files"]).splitlines()
+		self.assertEqual(sorted(files), sorted({m["loc"].rsplit(":", 2)[0] for m in self.merged.values()}))
+
+	def test_export_json(self):
+		run([tools.query_tool, self.path("result.dfindex"), "--export-json=" + self.path("exported.json")])
+		self.assertEqual(read_json(self.path("exported.json")), self.merged)
+
+
+def meth(name, loc, accessor=False):
+	return {"isPropertyAccessor": accessor, "loc": loc, "name": name, "sel": name[2:-1].split(" ")[1]}
+
+
+class LinkMapTests(unittest.TestCase):
+	# candidates of the link map, and their savings on arm64 with absolute and
+	# relative method lists: a method_t entry, the selref and the name when
+	# the selector has a single implementation, a property_t and the setter
+	METHS = [
+		(meth("-[SampleFeed reloadItems]", "/Users/dev/Sample/SampleFeed.m:10:1"), 24, 12),
+		(meth("-[SampleFeed itemCount]", "/Users/dev/Sample/SampleFeed.h:5:41", True), 24 + 8 + 10 + 16 + 24 + 8 + 14, 12 + 8 + 10 + 16 + 12 + 8 + 14),
+		(meth("-[SampleProfile reloadItems]", "/Users/dev/Sample/SampleProfile.m:20:1"), 24, 12),
+		(meth("+[SampleProfile sharedProfile]", "/Users/dev/Sample/SampleProfile.m:8:1"), 24 + 8 + 14, 12 + 8 + 14),
+		(meth("-[SampleProfile(Layout) layoutAvatarWithSize:]", "/Users/dev/Sample/SampleProfile+Layout.m:6:1"), 24 + 8 + 23, 12 + 8 + 23),
+		(meth("-[SampleProfile title]", "/Users/dev/Sample/SampleProfile.h:7:39", True), 24 + 8 + 6 + 16, 12 + 8 + 6 + 16),
+		(meth("-[SampleProfile unusedHelper]", "/Users/dev/Sample/SampleProfile.m:30:1"), 0, 0),
+	]
+
+	def setUp(self):
+		self.tmp = tempfile.TemporaryDirectory()
+		self.shards = os.path.join(self.tmp.name, "shards")
+		os.makedirs(self.shards)
+		self.write_shard("candidates", {"meths": [m for m, _, _ in self.METHS], "sels": [], "undirect_meths": []})
+
+	def tearDown(self):
+		self.tmp.cleanup()
+
+	def write_shard(self, name, shard):
+		with open(os.path.join(self.shards, name + ".json"), "w") as f:
+			json.dump(shard, f)
+
+	def savings(self, *args):
+		out = os.path.join(self.tmp.name, "result.json")
+		run([tools.merge_tool, "-i", self.shards, "-o", out, "--link-map", ROOT / "bench" / "data" / "sample.linkmap"] + list(args))
+		return {m["name"]: m["estimatedSavings"] for m in read_json(out).values()}
+
+	def test_savings(self):
+		self.assertEqual(self.savings(), {m["name"]: absolute for m, absolute, _ in self.METHS})
+
+	def test_relative_method_lists(self):
+		self.assertEqual(self.savings("--relative-method-lists"), {m["name"]: relative for m, _, relative in self.METHS})
+
+	def test_recorded_setter(self):
+		# the summary records setCount: as the setter, setItemCount: isn't the property's
+		clz = {"categories": [], "declared": [], "implemented": [], "name": "SampleFeed", "properties": ["itemCount setCount:"], "protocols": [], "super": "NSObject"}
+		self.write_shard("summary", {"meths": [], "sels": [], "undirect_meths": [], "summary": {"classes": [clz], "dynamic_sends": [], "protocols": [], "selector_refs": []}})
+		expected = {m["name"]: absolute for m, absolute, _ in self.METHS}
+		expected["-[SampleFeed itemCount]"] = 24 + 8 + 10 + 16
+		self.assertEqual(self.savings(), expected)
+		self.assertEqual(self.savings("--resolve"), expected)
+
+
+class CompareTests(CorpusTestCase):
+	@classmethod
+	def setUpClass(cls):
+		super().setUpClass()
+		run([tools.merge_tool, "-i", cls.shards, "-o", os.path.join(cls.tmp.name, "before.json")])
+		run([tools.merge_tool, "-i", cls.shards, "-o", os.path.join(cls.tmp.name, "before.dfindex"), "--format=index"])
+		cls.before = read_json(os.path.join(cls.tmp.name, "before.json"))
+
+	def compare(self, current, earlier, *args, expect=1):
+		out = run([tools.query_tool, current, "--compare=" + earlier] + list(args), expect=expect)
+		return [json.loads(line) for line in out.splitlines()]
+
+	def unique(self, key):
+		counts = {}
+		for meth in self.before.values():
+			counts[meth[key]] = counts.get(meth[key], 0) + 1
+		return [meth for meth in sorted(self.before.values(), key=lambda m: m["loc"]) if counts[meth[key]] == 1]
+
+	def test_changes_and_reasons(self):
+		shards = self.path("after-shards")
+		shutil.copytree(self.shards, shards)
+		names = sorted(os.listdir(shards))
+		# one entry per reason, whose selector and name only they have
+		by_sel = self.unique("sel")
+		by_name = [m for m in self.unique("name") if m not in by_sel[:1]]
+		sel_meth, override_meth = by_sel[0], by_name[len(by_name) // 2]
+		removed_meth = [m for m in by_sel[1:] if m not in (override_meth,)][-1]
+		added = {"isPropertyAccessor": False, "loc": "/Users/dev/App/Added/GLAdded.h:3:1", "name": "-[GLAdded refresh]", "sel": "refreshAdded"}
+		for i, name in enumerate(names):
+			path = os.path.join(shards, name)
+			shard = read_json(path)
+			shard["meths"] = [m for m in shard["meths"] if m["loc"] != removed_meth["loc"]]
+			if i == 0:
+				shard["sels"].append(sel_meth["sel"])
+				shard["meths"].append(added)
+			if i == 1:
+				shard["undirect_meths"].append(override_meth["name"])
+			with open(path, "w") as f:
+				json.dump(shard, f)
+		run([tools.merge_tool, "-i", shards, "-o", self.path("after.json")])
+		run([tools.merge_tool, "-i", shards, "-o", self.path("after.dfindex"), "--format=index"])
+
+		changes = self.compare(self.path("after.dfindex"), self.path("before.json"), "--shards=" + shards)
+		self.assertEqual({c["loc"]: c["reason"] for c in changes if c["change"] == "disqualified"}, {
+			sel_meth["loc"]: "selector",
+			override_meth["loc"]: "override",
+			removed_meth["loc"]: "removed",
+		})
+		self.assertEqual([c["loc"] for c in changes if c["change"] == "qualified"], [added["loc"]])
+		# the json side is streamed whichever side it is on, indexes are joined in place
+		self.assertEqual(self.compare(self.path("after.json"), self.path("before.dfindex"), "--shards=" + shards), changes)
+		self.assertEqual(self.compare(self.path("after.dfindex"), self.path("before.dfindex"), "--shards=" + shards), changes)
+
+	def test_no_changes(self):
+		self.assertEqual(self.compare(self.path("before.dfindex"), self.path("before.json"), expect=0), [])
+
+	def test_two_json_results(self):
+		self.compare(self.path("before.json"), self.path("before.json"), expect=2)
+
+	def test_hierarchy_reasons(self):
+		shards = self.path("summary-shards")
+		os.makedirs(shards)
+		meths = [
+			meth("-[GLBase draw]", "/Users/dev/App/GLBase.h:5:1"),
+			meth("-[GLSub draw]", "/Users/dev/App/GLSub.h:5:1"),
+			meth("-[GLSub title]", "/Users/dev/App/GLSub.h:6:40", True),
+			meth("-[GLSub layout]", "/Users/dev/App/GLSub.h:7:1"),
+		]
+		classes = [
+			{"categories": [], "declared": ["-draw"], "implemented": ["-draw"], "name": "GLBase", "properties": [], "protocols": [], "super": "NSObject"},
+			{"categories": [], "declared": ["-draw", "-title", "-setTitle:", "-layout"], "implemented": ["-draw", "-layout"], "name": "GLSub", "properties": ["title setTitle:"], "protocols": [], "super": "GLBase"},
+		]
+		# setTitle: is used by @selector, which disqualifies the property but isn't a reason of title's own
+		summary = {"classes": classes, "dynamic_sends": [], "protocols": [], "selector_refs": ["setTitle:"]}
+		with open(os.path.join(shards, "GLSub.json"), "w") as f:
+			json.dump({"meths": meths, "sels": [], "undirect_meths": [], "summary": summary}, f)
+		run([tools.merge_tool, "-i", shards, "-o", self.path("unresolved.json")])
+		run([tools.merge_tool, "-i", shards, "-o", self.path("resolved.dfindex"), "--format=index", "--resolve"])
+
+		changes = self.compare(self.path("resolved.dfindex"), self.path("unresolved.json"), "--shards=" + shards)
+		self.assertEqual({c["name"]: c["reason"] for c in changes}, {
+			"-[GLBase draw]": "override",
+			"-[GLSub draw]": "override",
+			"-[GLSub title]": "unknown",
+		})
+
+
+def uleb128(value):
+	out = bytearray()
+	while True:
+		byte = value & 0x7f
+		value >>= 7
+		out.append(byte | (0x80 if value else 0))
+		if not value:
+			return bytes(out)
+
+
+# a plugin connection, speaking the frames of source/Aggregator.h
+class AggregatorClient:
+	def __init__(self, socket_path):
+		self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+		self.sock.connect(socket_path)
+
+	def send(self, kind, body=b""):
+		payload = kind + body
+		self.sock.sendall(struct.pack("<I", len(payload)) + payload)
+
+	def receive(self):
+		size = struct.unpack("<I", self.read(4))[0]
+		return self.read(size)
+
+	def read(self, size):
+		data = b""
+		while len(data) < size:
+			chunk = self.sock.recv(size - len(data))
+			if not chunk:
+				raise AssertionError("the aggregator closed the connection")
+			data += chunk
+		return data
+
+	def close(self):
+		self.sock.close()
+
+
+class AggregatorTests(CorpusTestCase):
+	@classmethod
+	def setUpClass(cls):
+		super().setUpClass()
+		cls.all_shards = sorted(os.listdir(cls.shards))[:30]
+
+	def setUp(self):
+		if not tools.aggregator_tool:
+			self.skipTest("needs --aggregator-tool")
+		self.dir = tempfile.TemporaryDirectory()
+		self.socket = os.path.join(self.dir.name, "aggregator.sock")
+		self.daemon = subprocess.Popen([str(tools.aggregator_tool), "--socket=" + self.socket], stdout=subprocess.DEVNULL)
+		for _ in range(100):
+			if os.path.exists(self.socket):
+				break
+			time.sleep(0.05)
+		self.parts = 0
+
+	def tearDown(self):
+		if self.daemon.poll() is None:
+			self.daemon.kill()
+		self.daemon.wait()
+		self.dir.cleanup()
+
+	# the binary form of a json shard, as a plugin batches it
+	def binary(self, shard):
+		self.parts += 1
+		part = os.path.join(self.dir.name, "part%d.json" % self.parts)
+		binary_dir = os.path.join(self.dir.name, "binary")
+		os.makedirs(binary_dir, exist_ok=True)
+		with open(part, "w") as f:
+			json.dump(shard, f)
+		run([tools.roundtrip_tool, "--binary-dir=" + binary_dir, part])
+		with open(os.path.join(binary_dir, "part%d.dfshard" % self.parts), "rb") as f:
+			return f.read()
+
+	# undirectables first, one batch each, like sendShardToAggregator
+	def batches(self, shard):
+		return [self.binary({"sels": shard["sels"], "meths": [], "undirect_meths": []}),
+			self.binary({"sels": [], "meths": [], "undirect_meths": shard["undirect_meths"]}),
+			self.binary({"sels": [], "meths": shard["meths"], "undirect_meths": []})]
+
+	def stream(self, shard):
+		client = AggregatorClient(self.socket)
+		for batch in self.batches(shard):
+			client.send(b"B", batch)
+		client.send(b"E")
+		self.assertEqual(client.receive(), b"A")
+		client.close()
+
+	def finish(self, *args):
+		output = os.path.join(self.dir.name, "aggregated.json")
+		count = int(run([tools.aggregator_tool, "--socket=" + self.socket, "--finish", "-o", output] + list(args)))
+		self.assertEqual(self.daemon.wait(10), 0)
+		result = read_json(output)
+		self.assertEqual(count, len(result))
+		return result
+
+	# objc-direct-merge over the same shards, both results are keyed by loc
+	def merged(self, shards):
+		merge_dir = os.path.join(self.dir.name, "merge-input")
+		os.makedirs(merge_dir)
+		for i, shard in enumerate(shards):
+			with open(os.path.join(merge_dir, "shard%d.json" % i), "w") as f:
+				json.dump(shard, f)
+		run([tools.merge_tool, "-i", merge_dir, "-o", os.path.join(self.dir.name, "merged.json")])
+		return read_json(os.path.join(self.dir.name, "merged.json"))
+
+	def corpus(self):
+		return [read_json(os.path.join(self.shards, name)) for name in self.all_shards]
+
+	def test_same_result_as_merge(self):
+		shards = self.corpus()
+		for shard in shards:
+			self.stream(shard)
+		self.assertEqual(self.finish(), self.merged(shards))
+
+	def test_undirectable_sel_after_its_candidates(self):
+		candidate = meth("-[Feed reload]", "/src/Feed.h:3:1")
+		shards = [{"sels": [], "meths": [candidate, meth("-[Feed layout]", "/src/Feed.h:4:1")], "undirect_meths": []},
+			{"sels": ["reload"], "meths": [], "undirect_meths": []}]
+		for shard in shards:
+			self.stream(shard)
+		result = self.finish()
+		self.assertNotIn(candidate["loc"], result)
+		self.assertEqual(result, self.merged(shards))
+
+	def test_undirectable_names(self):
+		# a name arriving before its candidate filters it on arrival, after it when writing
+		shards = [{"sels": [], "meths": [], "undirect_meths": ["-[Feed reload]"]},
+			{"sels": [], "meths": [meth("-[Feed reload]", "/src/Feed.h:3:1"), meth("-[Feed layout]", "/src/Feed.h:4:1"), meth("-[Feed draw]", "/src/Feed.h:5:1")], "undirect_meths": []},
+			{"sels": [], "meths": [], "undirect_meths": ["-[Feed draw]"]}]
+		for shard in shards:
+			self.stream(shard)
+		result = self.finish()
+		self.assertEqual(sorted(m["name"] for m in result.values()), ["-[Feed layout]"])
+		self.assertEqual(result, self.merged(shards))
+
+	def test_fallback_dir(self):
+		shards = self.corpus()
+		fallback = os.path.join(self.dir.name, "fallback")
+		os.makedirs(fallback)
+		for i, shard in enumerate(shards):
+			if i % 3:
+				self.stream(shard)
+				continue
+			with open(os.path.join(fallback, "shard%d.json" % i), "w") as f:
+				json.dump(shard, f)
+		self.assertEqual(self.finish("--fallback-dir=" + fallback), self.merged(shards))
+
+	def test_finish_while_streaming(self):
+		shards = self.corpus()[:2]
+		self.stream(shards[0])
+		client = AggregatorClient(self.socket)
+		batches = self.batches(shards[1])
+		client.send(b"B", batches[0])
+
+		output = os.path.join(self.dir.name, "aggregated.json")
+		finishing = subprocess.Popen([str(tools.aggregator_tool), "--socket=" + self.socket, "--finish", "-o", output], stdout=subprocess.DEVNULL)
+		# the result waits for the TU still streaming
+		time.sleep(0.5)
+		self.assertIsNone(finishing.poll())
+		for batch in batches[1:]:
+			client.send(b"B", batch)
+		client.send(b"E")
+		self.assertEqual(client.receive(), b"A")
+		client.close()
+
+		self.assertEqual(finishing.wait(10), 0)
+		self.assertEqual(self.daemon.wait(10), 0)
+		self.assertEqual(read_json(output), self.merged(shards))
+
+
+class PluginTests(unittest.TestCase):
+	def setUp(self):
+		if not (tools.clang and tools.plugin):
+			self.skipTest("needs --clang and --plugin")
+		self.tmp = tempfile.TemporaryDirectory()
+
+	def tearDown(self):
+		self.tmp.cleanup()
+
+	# the shard of one source, compiled like the bench corpus
+	def shard(self, source, *plugin_args):
+		out = os.path.join(self.tmp.name, "shards")
+		os.makedirs(out, exist_ok=True)
+		flags = ["-fsyntax-only", "-fobjc-runtime=gnustep-2.0", "-fobjc-arc", "-I", DATA]
+		flags += ["-Xclang", "-load", "-Xclang", tools.plugin, "-Xclang", "-plugin", "-Xclang", "directable-finder"]
+		for arg in ["-output-dir=" + out] + list(plugin_args):
+			flags += ["-Xclang", "-plugin-arg-directable-finder", "-Xclang", arg]
+		run([tools.clang] + flags + [DATA / source])
+		shards = [f for f in os.listdir(out) if f.endswith(".json")]
+		self.assertEqual(len(shards), 1)
+		return read_json(os.path.join(out, shards[0]))
+
+	def test_receivers_written_through_references(self):
+		# `item` is a Cell, until a reference or an `id &` parameter rebinds it to a Button
+		shard = self.shard("receiver_reference.mm")
+		self.assertIn("refresh", shard["sels"])
+		self.assertIn("layout", shard["sels"])
+		self.assertNotIn("draw", shard["sels"])
+		self.assertIn("-[Cell draw]", shard["undirect_meths"])
+
+
+if __name__ == "__main__":
+	parser = argparse.ArgumentParser(description="regression tests of the directable-finder tools")
+	parser.add_argument("--merge-tool", type=pathlib.Path, required=True, help="objc-direct-merge executable")
+	parser.add_argument("--query-tool", type=pathlib.Path, required=True, help="objc-direct-query executable")
+	parser.add_argument("--roundtrip-tool", type=pathlib.Path, required=True, help="directable-shard-roundtrip executable")
+	parser.add_argument("--aggregator-tool", type=pathlib.Path, help="objc-direct-aggregator executable, enables the aggregator tests")
+	parser.add_argument("--clang", type=pathlib.Path, help="clang the plugin was built for, enables the plugin tests")
+	parser.add_argument("--plugin", type=pathlib.Path, help="ObjCDirectFinder plugin library")
+	tools, rest = parser.parse_known_args()
+	unittest.main(argv=[sys.argv[0]] + rest)
@@ -0,0 +1,116 @@
+//
+//  shard_roundtrip.cpp
+//  DirectableFinder
+//
+//  Reads json shards and checks that writing them back, as json and as binary
+//  `.dfshard` with and without compression, gives the same shard, through
+//  readShard and through a visitor scan. With --binary-dir the binary form of
+//  every shard is also written there, for merges of both forms to be compared.
+//  Prints one line per failure and exits with 1 if there was any.
+//
+
+#include "DirectableShard.h"
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace std;
+using namespace llvm;
+
+static cl::list<string> Inputs(cl::Positional, cl::desc("<json shard>..."), cl::OneOrMore);
+
+static cl::opt<string> BinaryDir("binary-dir", cl::desc("Also write the binary form of every shard to this directory"), cl::value_desc("dir"));
+
+// the records a scan hands out, rebuilt into a shard
+class ShardRebuilder : public ShardVisitor {
+public:
+    DirectableShard shard;
+
+    bool wantsSummary() const override { return true; }
+    bool wantsSends() const override { return true; }
+    void visitSel(StringRef sel) override { shard.sels.push_back(sel.str()); }
+    void visitUndirectMeth(StringRef name) override { shard.undirectMeths.push_back(name.str()); }
+    void visitMeth(const DirectableMethRef &ref) override {
+        DirectableMeth meth;
+        meth.name = ref.name.str();
+        meth.sel = ref.sel.str();
+        meth.loc = ref.loc.str();
+        meth.isPropertyAccessor = ref.isPropertyAccessor;
+        shard.meths.push_back(move(meth));
+    }
+    void visitSummary(const DirectableSummary &summary) override {
+        shard.hasSummary = true;
+        shard.summary = summary;
+    }
+    void visitSends(StringRef name, ArrayRef<StringRef> sites) override {
+        DirectableSends sends;
+        sends.name = name.str();
+        for (auto site : sites) {
+            sends.sites.push_back(site.str());
+        }
+        shard.sends.push_back(move(sends));
+    }
+};
+
+static unsigned failures = 0;
+
+static void fail(StringRef path, const Twine &message) {
+    errs() << path << ": " << message << "\n";
+    failures++;
+}
+
+// shards are compared through their json, which covers every field
+static void check(StringRef path, StringRef form, StringRef content, StringRef expected) {
+    auto shard = readShard(content);
+    if (!shard) {
+        fail(path, form + " doesn't read back: " + toString(shard.takeError()));
+        return;
+    }
+    if (shardToJSON(*shard) != expected) fail(path, form + " reads back as a different shard");
+
+    ShardRebuilder rebuilder;
+    if (auto err = scanShard(content, rebuilder)) {
+        fail(path, form + " doesn't scan: " + toString(move(err)));
+        return;
+    }
+    if (shardToJSON(rebuilder.shard) != expected) fail(path, form + " scans as a different shard");
+}
+
+int main(int argc, const char **argv) {
+    InitLLVM X(argc, argv);
+    cl::ParseCommandLineOptions(argc, argv, "round trip shards through the json and binary formats\n");
+
+    for (auto &path : Inputs) {
+        auto buf = MemoryBuffer::getFile(path);
+        if (!buf) {
+            fail(path, buf.getError().message());
+            continue;
+        }
+        auto shard = shardFromJSON((*buf)->getBuffer());
+        if (!shard) {
+            fail(path, toString(shard.takeError()));
+            continue;
+        }
+        auto expected = shardToJSON(*shard);
+        check(path, "json", expected, expected);
+        check(path, "binary", shardToBinary(*shard, /*compress=*/false), expected);
+        auto compressed = shardToBinary(*shard, /*compress=*/true);
+        check(path, "compressed binary", compressed, expected);
+
+        if (BinaryDir.empty()) continue;
+        SmallString<256> binaryPath(BinaryDir);
+        sys::path::append(binaryPath, sys::path::stem(path) + ".dfshard");
+        error_code ec;
+        raw_fd_ostream out(binaryPath, ec);
+        if (ec) {
+            fail(binaryPath, ec.message());
+            continue;
+        }
+        out << compressed;
+    }
+    return failures ? 1 : 0;
+}